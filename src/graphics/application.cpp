@@ -1,22 +1,34 @@
 #include "application.h"
 
 #include <cstdio>
+#include <cstring>
 
 #include "utils.h"
 
-size_t GraphicsApplication::get_queue_family(VkQueueFlags flags) {
+size_t GraphicsApplication::get_queue_family(VkQueueFlags flags,
+                                             VkQueueFlags excluded) {
     for (size_t i = 0; i < queue_families.size(); i++) {
-        if (queue_families.at(i).queueFlags & flags) {
+        VkQueueFlags family_flags = queue_families.at(i).queueFlags;
+        if ((family_flags & flags) && !(family_flags & excluded)) {
             return i;
         }
     }
     return -1;
 }
 
+bool GraphicsApplication::supports_format(VkFormat format,
+                                          VkFormatFeatureFlags features) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(device, format, &properties);
+    return (properties.optimalTilingFeatures & features) == features;
+}
+
 void GraphicsApplication::destroy() {
     device = {};
     properties = {};
     features = {};
+    features12 = {};
+    features13 = {};
     queue_families.clear();
 
     vkDestroyInstance(instance, nullptr);
@@ -61,6 +73,23 @@ GraphicsApplication GraphicsApplicationBuilder::build() {
     // TODO: setup debugging messages
     // https://vulkan-tutorial.com/Drawing_a_triangle/Setup/Validation_layers#page_Message-callback
 
+    // Machines without the SDK (CI, render farms) have no validation layers,
+    // run without the missing ones instead of failing
+    uint32_t layer_count = 0;
+    vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
+    std::vector<VkLayerProperties> available_layers(layer_count);
+    vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
+
+    std::erase_if(validation_layers, [&](const char *layer) {
+        for (auto &available : available_layers) {
+            if (!strcmp(available.layerName, layer)) {
+                return false;
+            }
+        }
+        printf("layer %s is not available\n", layer);
+        return true;
+    });
+
     instance_info.enabledLayerCount = (uint32_t)validation_layers.size();
     instance_info.ppEnabledLayerNames = validation_layers.data();
     instance_info.enabledExtensionCount = (uint32_t)instance_extensions.size();
@@ -78,7 +107,17 @@ GraphicsApplication GraphicsApplicationBuilder::build() {
 
     for (auto device : devices) {
         vkGetPhysicalDeviceProperties(device, &destination.properties);
-        vkGetPhysicalDeviceFeatures(device, &destination.features);
+        destination.features13 = VkPhysicalDeviceVulkan13Features{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES};
+        destination.features12 = VkPhysicalDeviceVulkan12Features{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+            .pNext = &destination.features13};
+        VkPhysicalDeviceFeatures2 features2{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &destination.features12};
+        vkGetPhysicalDeviceFeatures2(device, &features2);
+        destination.features = features2.features;
+        destination.features12.pNext = nullptr;
 
         uint32_t qfam_count = 0;
         vkGetPhysicalDeviceQueueFamilyProperties(device, &qfam_count, nullptr);
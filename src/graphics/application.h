@@ -13,9 +13,15 @@ class GraphicsApplication {
 
     VkPhysicalDeviceProperties properties;
     VkPhysicalDeviceFeatures features;
+    // pNext is cleared after the query, these are copied around by value
+    VkPhysicalDeviceVulkan12Features features12;
+    VkPhysicalDeviceVulkan13Features features13;
     std::vector<VkQueueFamilyProperties> queue_families;
 
-    size_t get_queue_family(VkQueueFlags flags);
+    // First family with some of `flags` and none of `excluded`, -1 if none
+    size_t get_queue_family(VkQueueFlags flags, VkQueueFlags excluded = 0);
+    // Whether optimally tiled images of `format` have all of `features`
+    bool supports_format(VkFormat format, VkFormatFeatureFlags features);
     void destroy();
 };
 
@@ -0,0 +1,141 @@
+#include "bindless.h"
+
+#include <cstdio>
+
+GraphicsBindlessBuilder* GraphicsBindlessBuilder::set_max_textures(
+    uint32_t count) {
+    m_max_textures = count;
+    return this;
+}
+
+GraphicsBindlessBuilder* GraphicsBindlessBuilder::set_max_buffers(
+    uint32_t count) {
+    m_max_buffers = count;
+    return this;
+}
+
+GraphicsBindless GraphicsBindlessBuilder::build() {
+    GraphicsBindless out{};
+    out.m_device = m_device;
+    out.m_max_textures = m_max_textures;
+    out.m_max_buffers = m_max_buffers;
+
+    VkDescriptorBindingFlags array_flags =
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+    out.layout =
+        GraphicsDescriptorLayoutBuilder(m_device)
+            .add_binding(0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                         VK_SHADER_STAGE_FRAGMENT_BIT, m_max_textures,
+                         array_flags)
+            ->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_VERTEX_BIT |
+                              VK_SHADER_STAGE_FRAGMENT_BIT,
+                          m_max_buffers, array_flags)
+            ->add_binding(2, VK_DESCRIPTOR_TYPE_SAMPLER,
+                          VK_SHADER_STAGE_FRAGMENT_BIT)
+            ->set_flags(
+                VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT)
+            ->build();
+
+    out.m_pool =
+        GraphicsDescriptorPoolBuilder(m_device)
+            .add_size(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, m_max_textures)
+            ->add_size(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_max_buffers)
+            ->add_size(VK_DESCRIPTOR_TYPE_SAMPLER, 1)
+            ->set_flags(VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT)
+            ->build();
+    out.set = out.m_pool.allocate(out.layout);
+
+    // Trilinear and repeating, the textures are projected on the meshes
+    VkSamplerCreateInfo sampler_info{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .maxLod = VK_LOD_CLAMP_NONE,
+    };
+    assert(!vkCreateSampler(m_device, &sampler_info, nullptr, &out.m_sampler));
+
+    VkDescriptorImageInfo sampler{.sampler = out.m_sampler};
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = out.set,
+        .dstBinding = 2,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .pImageInfo = &sampler,
+    };
+    vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+
+    return out;
+}
+
+uint32_t GraphicsBindless::add_texture(VkImageView view) {
+    uint32_t index;
+    if (!m_free_textures.empty()) {
+        index = m_free_textures.back();
+        m_free_textures.pop_back();
+    } else if (m_texture_count < m_max_textures) {
+        index = m_texture_count++;
+    } else {
+        printf("too many bindless textures (%u)\n", m_max_textures);
+        return none;
+    }
+    VkDescriptorImageInfo image{
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = 0,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .pImageInfo = &image,
+    };
+    vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+    return index;
+}
+
+// The descriptor keeps its view, the binding is partially bound so a stale
+// descriptor is valid as long as no shader samples it
+void GraphicsBindless::remove_texture(uint32_t index) {
+    assert(index < m_texture_count);
+    m_free_textures.push_back(index);
+}
+
+uint32_t GraphicsBindless::add_buffer(VkBuffer buffer, VkDeviceSize offset,
+                                      VkDeviceSize range) {
+    if (m_buffer_count == m_max_buffers) {
+        printf("too many bindless buffers (%u)\n", m_max_buffers);
+        return none;
+    }
+    VkDescriptorBufferInfo info{
+        .buffer = buffer,
+        .offset = offset,
+        .range = range,
+    };
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = 1,
+        .dstArrayElement = m_buffer_count,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &info,
+    };
+    vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+    return m_buffer_count++;
+}
+
+void GraphicsBindless::destroy() {
+    vkDestroySampler(m_device, m_sampler, nullptr);
+    m_pool.destroy();
+    vkDestroyDescriptorSetLayout(m_device, layout, nullptr);
+}
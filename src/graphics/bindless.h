@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "descriptor.h"
+#include "utils.h"
+
+// Matches Material in material.frag (std430)
+struct GpuMaterial {
+    glm::vec4 color;
+    // Index in the bindless textures, GraphicsBindless::none without one
+    uint32_t texture;
+    // Texture repeats per model space unit, the meshes have no uvs so the
+    // texture is projected on them
+    float uv_scale;
+    uint32_t padding[2];
+};
+
+// One descriptor set that every pipeline binds as set 1, with arrays of
+// sampled images and storage buffers indexed from the shaders, e.g. through
+// the material of the instance. The arrays are update-after-bind and
+// partially bound: resources can be added while frames in flight use the
+// set, as long as those frames do not use the new slots.
+class GraphicsBindless {
+   public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    VkDescriptorSetLayout layout;
+    VkDescriptorSet set;
+
+    // The view has to stay alive as long as the set may use it, the returned
+    // index does not change until it is removed. Reuses a removed index
+    // first.
+    uint32_t add_texture(VkImageView view);
+    // Frees the index for the next texture, once no frame in flight samples
+    // it anymore
+    void remove_texture(uint32_t index);
+    uint32_t add_buffer(VkBuffer buffer, VkDeviceSize offset = 0,
+                        VkDeviceSize range = VK_WHOLE_SIZE);
+    // Textures that were added and not removed
+    uint32_t texture_count() const {
+        return m_texture_count - m_free_textures.size();
+    };
+    uint32_t buffer_count() const { return m_buffer_count; };
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    GraphicsDescriptorPool m_pool;
+    VkSampler m_sampler;
+    uint32_t m_max_textures;
+    uint32_t m_max_buffers;
+    // Indices written so far, some of which may be free
+    uint32_t m_texture_count;
+    uint32_t m_buffer_count;
+    std::vector<uint32_t> m_free_textures;
+
+    friend class GraphicsBindlessBuilder;
+};
+
+class GraphicsBindlessBuilder {
+   public:
+    // The device needs the descriptor indexing features: runtime arrays,
+    // partially bound bindings, update-after-bind and update-unused-while-
+    // pending of sampled images and storage buffers, and non uniform sampled
+    // image indexing
+    GraphicsBindlessBuilder(VkDevice device)
+        : m_device(device), m_max_textures(4096), m_max_buffers(256){};
+
+    GraphicsBindlessBuilder* set_max_textures(uint32_t count);
+    GraphicsBindlessBuilder* set_max_buffers(uint32_t count);
+    GraphicsBindless build();
+
+   private:
+    VkDevice m_device;
+    uint32_t m_max_textures;
+    uint32_t m_max_buffers;
+};
@@ -36,3 +36,28 @@ void GraphicsCommand::destroy() {
     vkDestroyFence(m_device, fence_render, nullptr);
     vkDestroyCommandPool(m_device, cmd_pool, nullptr);
 }
+
+GraphicsSecondaryCommands GraphicsSecondaryCommandsBuilder::build() {
+    GraphicsSecondaryCommands out{};
+    out.m_device = m_device;
+    out.cmd_pools.resize(m_thread_count);
+    out.cmd_bufs.resize(m_thread_count);
+
+    for (uint32_t i = 0; i < m_thread_count; i++) {
+        assert(!vkCreateCommandPool(m_device, &command_pool_info, nullptr,
+                                    &out.cmd_pools[i]));
+
+        cmdbuf_alloc_info.commandPool = out.cmd_pools[i];
+        assert(!vkAllocateCommandBuffers(m_device, &cmdbuf_alloc_info,
+                                         &out.cmd_bufs[i]));
+    }
+    return out;
+}
+
+void GraphicsSecondaryCommands::destroy() {
+    for (auto pool : cmd_pools) {
+        vkDestroyCommandPool(m_device, pool, nullptr);
+    }
+    cmd_pools.clear();
+    cmd_bufs.clear();
+}
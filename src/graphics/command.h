@@ -2,6 +2,8 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <vector>
+
 class GraphicsCommand {
    public:
     VkCommandPool cmd_pool;
@@ -54,3 +56,48 @@ class GraphicsCommandBuilder {
     VkSemaphoreCreateInfo semph_info;
     VkDevice m_device;
 };
+
+// Secondary command buffers of one frame in flight for the recording
+// threads. Every thread has its own pool, so they never synchronize, and the
+// pools are reset as a whole once the frame is done.
+class GraphicsSecondaryCommands {
+   public:
+    std::vector<VkCommandPool> cmd_pools;
+    std::vector<VkCommandBuffer> cmd_bufs;
+
+    size_t size() const { return cmd_bufs.size(); };
+    void destroy();
+
+   private:
+    VkDevice m_device;
+
+    friend class GraphicsSecondaryCommandsBuilder;
+};
+
+class GraphicsSecondaryCommandsBuilder {
+   public:
+    GraphicsSecondaryCommandsBuilder(VkDevice device, uint32_t queue_family,
+                                     uint32_t thread_count)
+        : command_pool_info(VkCommandPoolCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+              .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+              .queueFamilyIndex = queue_family,
+          }),
+
+          cmdbuf_alloc_info(VkCommandBufferAllocateInfo{
+              .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+              .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+              .commandBufferCount = 1,
+          }),
+
+          m_thread_count(thread_count),
+          m_device(device){};
+
+    GraphicsSecondaryCommands build();
+
+   private:
+    VkCommandPoolCreateInfo command_pool_info;
+    VkCommandBufferAllocateInfo cmdbuf_alloc_info;
+    uint32_t m_thread_count;
+    VkDevice m_device;
+};
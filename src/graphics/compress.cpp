@@ -0,0 +1,584 @@
+#include "compress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// The 4x4 texels of a block, RGBA, rows from top to bottom
+struct Block {
+    uint8_t texels[16][4];
+};
+
+// BC7 interpolation weights of the 4 bit indices, out of 64
+static const uint32_t bc7_weights[16]{0,  4,  9,  13, 17, 21, 26, 30,
+                                      34, 38, 43, 47, 51, 55, 60, 64};
+
+// ETC1 intensity modifiers, selectors 0 and 1 add them, 2 and 3 subtract
+// them
+static const int etc_modifiers[8][2]{{2, 8},   {5, 17},  {9, 29},
+                                     {13, 42}, {18, 60}, {24, 80},
+                                     {33, 106}, {47, 183}};
+
+static Block fetch_block(const ImageData &image, uint32_t block_x,
+                         uint32_t block_y) {
+    Block out;
+    for (uint32_t y = 0; y < 4; y++) {
+        uint32_t image_y = std::min(block_y * 4 + y, image.height - 1);
+        for (uint32_t x = 0; x < 4; x++) {
+            uint32_t image_x = std::min(block_x * 4 + x, image.width - 1);
+            memcpy(out.texels[y * 4 + x],
+                   image.pixels.data() +
+                       (size_t(image_y) * image.width + image_x) * 4,
+                   4);
+        }
+    }
+    return out;
+}
+
+static void put_le(uint8_t *out, uint64_t value, uint32_t bytes) {
+    for (uint32_t i = 0; i < bytes; i++) {
+        out[i] = uint8_t(value >> (i * 8));
+    }
+}
+
+static int clamp_byte(int value) { return std::clamp(value, 0, 255); }
+
+// Mean and principal axis (unit length, or zero for a flat block) of the
+// first `channels` channels of the texels, by power iteration on their
+// covariance
+static void principal_axis(const Block &block, uint32_t channels,
+                           float mean[4], float axis[4]) {
+    for (uint32_t c = 0; c < 4; c++) {
+        mean[c] = 0.f;
+        axis[c] = 0.f;
+        for (uint32_t i = 0; i < 16 && c < channels; i++) {
+            mean[c] += block.texels[i][c] / 16.f;
+        }
+    }
+    float covariance[4][4]{};
+    for (uint32_t i = 0; i < 16; i++) {
+        float delta[4]{};
+        for (uint32_t c = 0; c < channels; c++) {
+            delta[c] = block.texels[i][c] - mean[c];
+        }
+        for (uint32_t a = 0; a < channels; a++) {
+            for (uint32_t b = 0; b < channels; b++) {
+                covariance[a][b] += delta[a] * delta[b];
+            }
+        }
+    }
+
+    // Starting from the row of the largest variance, which is never
+    // orthogonal to the axis unless the block is flat
+    uint32_t largest = 0;
+    for (uint32_t c = 1; c < channels; c++) {
+        if (covariance[c][c] > covariance[largest][largest]) {
+            largest = c;
+        }
+    }
+    float vector[4]{};
+    memcpy(vector, covariance[largest], sizeof(vector));
+    for (uint32_t iteration = 0; iteration < 8; iteration++) {
+        float next[4]{};
+        float length = 0.f;
+        for (uint32_t a = 0; a < channels; a++) {
+            for (uint32_t b = 0; b < channels; b++) {
+                next[a] += covariance[a][b] * vector[b];
+            }
+            length = std::max(length, std::abs(next[a]));
+        }
+        if (length < 1e-6f) {
+            return;
+        }
+        for (uint32_t c = 0; c < 4; c++) {
+            vector[c] = next[c] / length;
+        }
+    }
+    float length = 0.f;
+    for (uint32_t c = 0; c < channels; c++) {
+        length += vector[c] * vector[c];
+    }
+    length = std::sqrt(length);
+    for (uint32_t c = 0; c < channels && length > 0.f; c++) {
+        axis[c] = vector[c] / length;
+    }
+}
+
+// Ends of the segment of the axis that the texels project to
+static void axis_extent(const Block &block, uint32_t channels,
+                        const float mean[4], const float axis[4],
+                        float low[4], float high[4]) {
+    float min = 0.f;
+    float max = 0.f;
+    for (uint32_t i = 0; i < 16; i++) {
+        float t = 0.f;
+        for (uint32_t c = 0; c < channels; c++) {
+            t += (block.texels[i][c] - mean[c]) * axis[c];
+        }
+        min = std::min(min, t);
+        max = std::max(max, t);
+    }
+    for (uint32_t c = 0; c < 4; c++) {
+        low[c] = mean[c] + min * axis[c];
+        high[c] = mean[c] + max * axis[c];
+    }
+}
+
+// Endpoints that minimize the squared error of the texels, given the weight
+// of the second endpoint for each of them. False when every weight is the
+// same.
+static bool least_squares(const Block &block, uint32_t channels,
+                          const float weights[16], float low[4],
+                          float high[4]) {
+    float aa = 0.f, ab = 0.f, bb = 0.f;
+    float at[4]{}, bt[4]{};
+    for (uint32_t i = 0; i < 16; i++) {
+        float a = 1.f - weights[i];
+        float b = weights[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (uint32_t c = 0; c < channels; c++) {
+            at[c] += a * block.texels[i][c];
+            bt[c] += b * block.texels[i][c];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f) {
+        return false;
+    }
+    for (uint32_t c = 0; c < channels; c++) {
+        low[c] = std::clamp((bb * at[c] - ab * bt[c]) / determinant, 0.f,
+                            255.f);
+        high[c] = std::clamp((aa * bt[c] - ab * at[c]) / determinant, 0.f,
+                             255.f);
+    }
+    return true;
+}
+
+static uint16_t pack_565(const float color[4]) {
+    uint32_t r = std::clamp(int(std::lround(color[0] * 31.f / 255.f)), 0, 31);
+    uint32_t g = std::clamp(int(std::lround(color[1] * 63.f / 255.f)), 0, 63);
+    uint32_t b = std::clamp(int(std::lround(color[2] * 31.f / 255.f)), 0, 31);
+    return uint16_t(r << 11 | g << 5 | b);
+}
+
+static void unpack_565(uint16_t packed, int color[3]) {
+    int r = packed >> 11;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+}
+
+// Indices of the BC1 block of two endpoints, in the four color mode, and
+// the squared error they give. Swaps the endpoints to select that mode.
+static uint32_t bc1_indices(const Block &block, uint16_t &c0, uint16_t &c1,
+                            uint32_t &error) {
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+    int palette[4][3];
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (uint32_t c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    error = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        uint32_t best = 0;
+        uint32_t best_error = UINT32_MAX;
+        // Both endpoints are equal in the three color mode, where only the
+        // first index is the same
+        for (uint32_t index = 0; index < (c0 == c1 ? 1u : 4u); index++) {
+            uint32_t texel_error = 0;
+            for (uint32_t c = 0; c < 3; c++) {
+                int delta = palette[index][c] - block.texels[i][c];
+                texel_error += delta * delta;
+            }
+            if (texel_error < best_error) {
+                best = index;
+                best_error = texel_error;
+            }
+        }
+        indices |= best << (i * 2);
+        error += best_error;
+    }
+    return indices;
+}
+
+// 8 bytes: the endpoints, then 2 bit indices. Used for the color of BC3
+// too, which always decodes it in the four color mode.
+static void encode_bc1(const Block &block, uint8_t *out) {
+    float mean[4], axis[4], low[4], high[4];
+    principal_axis(block, 3, mean, axis);
+    axis_extent(block, 3, mean, axis, low, high);
+    // Insetting the ends by a 16th of the range lowers the average error, as
+    // the texels rarely sit on them
+    for (uint32_t c = 0; c < 3; c++) {
+        float inset = (high[c] - low[c]) / 16.f;
+        low[c] += inset;
+        high[c] -= inset;
+    }
+
+    uint16_t c0 = pack_565(high);
+    uint16_t c1 = pack_565(low);
+    uint32_t error;
+    uint32_t indices = bc1_indices(block, c0, c1, error);
+
+    // Refits the endpoints to the chosen indices, while it helps
+    static const float index_weights[4]{0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+    for (uint32_t iteration = 0; iteration < 2 && error; iteration++) {
+        float weights[16];
+        for (uint32_t i = 0; i < 16; i++) {
+            weights[i] = index_weights[(indices >> (i * 2)) & 3];
+        }
+        if (!least_squares(block, 3, weights, high, low)) {
+            break;
+        }
+        uint16_t refit0 = pack_565(high);
+        uint16_t refit1 = pack_565(low);
+        uint32_t refit_error;
+        uint32_t refit = bc1_indices(block, refit0, refit1, refit_error);
+        if (refit_error >= error) {
+            break;
+        }
+        c0 = refit0;
+        c1 = refit1;
+        indices = refit;
+        error = refit_error;
+    }
+
+    put_le(out, c0, 2);
+    put_le(out + 2, c1, 2);
+    put_le(out + 4, indices, 4);
+}
+
+// 8 bytes: the alpha range, then 3 bit indices into the 6 values between
+// its ends
+static void encode_bc3_alpha(const Block &block, uint8_t *out) {
+    int a0 = 0;
+    int a1 = 255;
+    for (uint32_t i = 0; i < 16; i++) {
+        a0 = std::max<int>(a0, block.texels[i][3]);
+        a1 = std::min<int>(a1, block.texels[i][3]);
+    }
+    int palette[8]{a0, a1};
+    for (int i = 2; i < 8; i++) {
+        palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+    }
+
+    uint64_t indices = 0;
+    for (uint32_t i = 0; i < 16 && a0 != a1; i++) {
+        uint64_t best = 0;
+        for (uint32_t index = 1; index < 8; index++) {
+            if (std::abs(palette[index] - block.texels[i][3]) <
+                std::abs(palette[best] - block.texels[i][3])) {
+                best = index;
+            }
+        }
+        indices |= best << (i * 3);
+    }
+    out[0] = uint8_t(a0);
+    out[1] = uint8_t(a1);
+    put_le(out + 2, indices, 6);
+}
+
+// Mode 6 endpoints: 7 bits per channel and a shared lowest bit per endpoint
+struct Bc7Endpoints {
+    uint32_t color[2][4];
+    uint32_t pbit[2];
+};
+
+// Best index of every texel for the endpoints, and the squared error
+static uint32_t bc7_indices(const Block &block, const Bc7Endpoints &ends,
+                            uint8_t indices[16]) {
+    int e0[4], e1[4], palette[16][4];
+    for (uint32_t c = 0; c < 4; c++) {
+        e0[c] = ends.color[0][c] << 1 | ends.pbit[0];
+        e1[c] = ends.color[1][c] << 1 | ends.pbit[1];
+    }
+    for (uint32_t index = 0; index < 16; index++) {
+        for (uint32_t c = 0; c < 4; c++) {
+            palette[index][c] = ((64 - bc7_weights[index]) * e0[c] +
+                                 bc7_weights[index] * e1[c] + 32) >>
+                                6;
+        }
+    }
+
+    // The texel is projected on the segment, only the closest indices to
+    // the projection are compared
+    float direction[4];
+    float length = 0.f;
+    for (uint32_t c = 0; c < 4; c++) {
+        direction[c] = float(e1[c] - e0[c]);
+        length += direction[c] * direction[c];
+    }
+    uint32_t error = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+        float t = 0.f;
+        for (uint32_t c = 0; c < 4; c++) {
+            t += (block.texels[i][c] - e0[c]) * direction[c];
+        }
+        int guess = length > 0.f ? int(std::lround(t / length * 15.f)) : 0;
+        guess = std::clamp(guess, 0, 15);
+
+        uint32_t best_error = UINT32_MAX;
+        for (int index = std::max(0, guess - 1);
+             index <= std::min(15, guess + 1); index++) {
+            uint32_t texel_error = 0;
+            for (uint32_t c = 0; c < 4; c++) {
+                int delta = palette[index][c] - block.texels[i][c];
+                texel_error += delta * delta;
+            }
+            if (texel_error < best_error) {
+                indices[i] = uint8_t(index);
+                best_error = texel_error;
+            }
+        }
+        error += best_error;
+    }
+    return error;
+}
+
+// Quantizes the endpoints with each of the 4 shared bit combinations and
+// keeps the best one
+static uint32_t bc7_quantize(const Block &block, const float low[4],
+                             const float high[4], Bc7Endpoints &ends,
+                             uint8_t indices[16]) {
+    uint32_t best_error = UINT32_MAX;
+    for (uint32_t pbits = 0; pbits < 4; pbits++) {
+        Bc7Endpoints candidate{.pbit{pbits & 1, pbits >> 1}};
+        for (uint32_t c = 0; c < 4; c++) {
+            candidate.color[0][c] = std::clamp(
+                int(std::lround((low[c] - candidate.pbit[0]) / 2.f)), 0, 127);
+            candidate.color[1][c] = std::clamp(
+                int(std::lround((high[c] - candidate.pbit[1]) / 2.f)), 0,
+                127);
+        }
+        uint8_t candidate_indices[16];
+        uint32_t error = bc7_indices(block, candidate, candidate_indices);
+        if (error < best_error) {
+            best_error = error;
+            ends = candidate;
+            memcpy(indices, candidate_indices, 16);
+        }
+    }
+    return best_error;
+}
+
+// 16 bytes in mode 6: a single subset of RGBA endpoints with 4 bit indices
+static void encode_bc7(const Block &block, uint8_t *out) {
+    float mean[4], axis[4], low[4], high[4];
+    principal_axis(block, 4, mean, axis);
+    axis_extent(block, 4, mean, axis, low, high);
+
+    Bc7Endpoints ends;
+    uint8_t indices[16];
+    uint32_t error = bc7_quantize(block, low, high, ends, indices);
+    for (uint32_t iteration = 0; iteration < 2 && error; iteration++) {
+        float weights[16];
+        for (uint32_t i = 0; i < 16; i++) {
+            weights[i] = bc7_weights[indices[i]] / 64.f;
+        }
+        if (!least_squares(block, 4, weights, low, high)) {
+            break;
+        }
+        Bc7Endpoints refit;
+        uint8_t refit_indices[16];
+        uint32_t refit_error =
+            bc7_quantize(block, low, high, refit, refit_indices);
+        if (refit_error >= error) {
+            break;
+        }
+        ends = refit;
+        memcpy(indices, refit_indices, 16);
+        error = refit_error;
+    }
+
+    // The highest bit of the first index is implied to be 0, the weights
+    // are symmetric so swapping the endpoints flips the indices
+    if (indices[0] & 8) {
+        std::swap(ends.color[0], ends.color[1]);
+        std::swap(ends.pbit[0], ends.pbit[1]);
+        for (uint8_t &index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    uint64_t bits[2]{};
+    uint32_t position = 0;
+    auto put = [&](uint64_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++, position++) {
+            bits[position / 64] |= ((value >> i) & 1) << (position % 64);
+        }
+    };
+    put(1 << 6, 7);
+    for (uint32_t c = 0; c < 4; c++) {
+        put(ends.color[0][c], 7);
+        put(ends.color[1][c], 7);
+    }
+    put(ends.pbit[0], 1);
+    put(ends.pbit[1], 1);
+    put(indices[0], 3);
+    for (uint32_t i = 1; i < 16; i++) {
+        put(indices[i], 4);
+    }
+    put_le(out, bits[0], 8);
+    put_le(out + 8, bits[1], 8);
+}
+
+// Best modifier table and selectors of the texels of one half of an ETC1
+// block (`half` tells which), around a base color. Returns the squared
+// error, the selectors are added to the 32 low bits of the block.
+static uint32_t etc_half(const Block &block, const bool half[16],
+                         const int base[3], uint64_t &bits,
+                         uint32_t &table) {
+    uint32_t best_error = UINT32_MAX;
+    uint64_t best_bits = 0;
+    for (uint32_t candidate = 0; candidate < 8; candidate++) {
+        uint32_t error = 0;
+        uint64_t candidate_bits = 0;
+        for (uint32_t i = 0; i < 16; i++) {
+            if (!half[i]) {
+                continue;
+            }
+            uint32_t best = 0;
+            uint32_t best_texel_error = UINT32_MAX;
+            for (uint32_t selector = 0; selector < 4; selector++) {
+                int modifier = etc_modifiers[candidate][selector & 1];
+                modifier = selector & 2 ? -modifier : modifier;
+                uint32_t texel_error = 0;
+                for (uint32_t c = 0; c < 3; c++) {
+                    int delta = clamp_byte(base[c] + modifier) -
+                                block.texels[i][c];
+                    texel_error += delta * delta;
+                }
+                if (texel_error < best_texel_error) {
+                    best = selector;
+                    best_texel_error = texel_error;
+                }
+            }
+            error += best_texel_error;
+            // Texels are numbered down the columns, the high bits of all of
+            // them come first
+            uint32_t column_major = (i % 4) * 4 + i / 4;
+            candidate_bits |= uint64_t(best >> 1) << (16 + column_major);
+            candidate_bits |= uint64_t(best & 1) << column_major;
+        }
+        if (error < best_error) {
+            best_error = error;
+            best_bits = candidate_bits;
+            table = candidate;
+        }
+    }
+    bits |= best_bits;
+    return best_error;
+}
+
+// 8 bytes, big endian: two halves (side by side, or one above the other
+// when flipped) each with a base color and a modifier table. Only the ETC1
+// modes are used, which ETC2 decodes the same way.
+static void encode_etc2(const Block &block, uint8_t *out) {
+    uint32_t best_error = UINT32_MAX;
+    uint64_t best_bits = 0;
+    for (uint32_t flip = 0; flip < 2; flip++) {
+        bool halves[2][16];
+        float average[2][3]{};
+        for (uint32_t i = 0; i < 16; i++) {
+            bool second = flip ? i / 4 >= 2 : i % 4 >= 2;
+            halves[0][i] = !second;
+            halves[1][i] = second;
+            for (uint32_t c = 0; c < 3; c++) {
+                average[second][c] += block.texels[i][c] / 8.f;
+            }
+        }
+
+        // Differential mode: 5 bit base colors, the second one stored as a
+        // 3 bit signed difference
+        int first5[3], delta[3], bases[2][3];
+        for (uint32_t c = 0; c < 3; c++) {
+            first5[c] = int(std::lround(average[0][c] * 31.f / 255.f));
+            int second5 = int(std::lround(average[1][c] * 31.f / 255.f));
+            delta[c] = std::clamp(second5 - first5[c], -4, 3);
+            second5 = first5[c] + delta[c];
+            bases[0][c] = first5[c] << 3 | first5[c] >> 2;
+            bases[1][c] = second5 << 3 | second5 >> 2;
+        }
+        uint64_t bits = uint64_t(1) << 33 | uint64_t(flip) << 32;
+        uint32_t tables[2];
+        uint32_t error = etc_half(block, halves[0], bases[0], bits, tables[0]);
+        error += etc_half(block, halves[1], bases[1], bits, tables[1]);
+        for (uint32_t c = 0; c < 3; c++) {
+            bits |= uint64_t(first5[c]) << (59 - c * 8);
+            bits |= uint64_t(delta[c] & 7) << (56 - c * 8);
+        }
+        bits |= uint64_t(tables[0]) << 37 | uint64_t(tables[1]) << 34;
+        if (error < best_error) {
+            best_error = error;
+            best_bits = bits;
+        }
+
+        // Individual mode: two 4 bit base colors
+        int colors4[2][3];
+        for (uint32_t half = 0; half < 2; half++) {
+            for (uint32_t c = 0; c < 3; c++) {
+                colors4[half][c] =
+                    int(std::lround(average[half][c] * 15.f / 255.f));
+                bases[half][c] = colors4[half][c] * 17;
+            }
+        }
+        bits = uint64_t(flip) << 32;
+        error = etc_half(block, halves[0], bases[0], bits, tables[0]);
+        error += etc_half(block, halves[1], bases[1], bits, tables[1]);
+        for (uint32_t c = 0; c < 3; c++) {
+            bits |= uint64_t(colors4[0][c]) << (60 - c * 8);
+            bits |= uint64_t(colors4[1][c]) << (56 - c * 8);
+        }
+        bits |= uint64_t(tables[0]) << 37 | uint64_t(tables[1]) << 34;
+        if (error < best_error) {
+            best_error = error;
+            best_bits = bits;
+        }
+    }
+    for (uint32_t i = 0; i < 8; i++) {
+        out[i] = uint8_t(best_bits >> (56 - i * 8));
+    }
+}
+
+bool can_compress(const BlockFormat &format) {
+    return format.format != VK_FORMAT_ASTC_4x4_SRGB_BLOCK;
+}
+
+void compress_blocks(const ImageData &image, const BlockFormat &format,
+                     uint32_t first_row, uint32_t end_row, uint8_t *out) {
+    uint32_t blocks_x = (image.width + 3) / 4;
+    for (uint32_t block_y = first_row; block_y < end_row; block_y++) {
+        for (uint32_t block_x = 0; block_x < blocks_x; block_x++) {
+            Block block = fetch_block(image, block_x, block_y);
+            uint8_t *dst = out + (size_t(block_y) * blocks_x + block_x) *
+                                     format.block_bytes;
+            switch (format.format) {
+                case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                    encode_bc1(block, dst);
+                    break;
+                case VK_FORMAT_BC3_SRGB_BLOCK:
+                    encode_bc3_alpha(block, dst);
+                    encode_bc1(block, dst + 8);
+                    break;
+                case VK_FORMAT_BC7_SRGB_BLOCK:
+                    encode_bc7(block, dst);
+                    break;
+                case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+                    encode_etc2(block, dst);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
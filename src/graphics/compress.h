@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+#include "image.h"
+#include "ktx.h"
+
+// Whether compress_blocks encodes `format`: BC1, BC3, BC7 and ETC2 (through
+// its ETC1 modes), not ASTC
+bool can_compress(const BlockFormat &format);
+// Encodes the rows of blocks [first_row, end_row) of `image` to `format`,
+// into `out` which holds the whole level (block_level_size bytes). The
+// blocks that cross the right or bottom edge repeat its last column or row.
+// Distinct row ranges can be encoded concurrently.
+void compress_blocks(const ImageData &image, const BlockFormat &format,
+                     uint32_t first_row, uint32_t end_row, uint8_t *out);
@@ -0,0 +1,129 @@
+#include "cull.h"
+
+#include <bit>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+Frustum Frustum::from_matrix(const glm::mat4& m) {
+    // Rows of the matrix, glm is column major
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++) {
+        row[i] = glm::vec4{m[0][i], m[1][i], m[2][i], m[3][i]};
+    }
+
+    Frustum out{.planes{
+        row[3] + row[0],  // left
+        row[3] - row[0],  // right
+        row[3] + row[1],  // top or bottom, depending on the y flip
+        row[3] - row[1],
+        row[2],           // near
+        row[3] - row[2],  // far
+    }};
+
+    for (auto& plane : out.planes) {
+        float length = std::sqrt(plane.x * plane.x + plane.y * plane.y +
+                                 plane.z * plane.z);
+        plane = plane / length;
+    }
+    return out;
+}
+
+void BoundsSoA::resize(size_t count) {
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    radius.resize(count);
+}
+
+size_t cull_spheres(const Frustum& frustum, const BoundsSoA& bounds,
+                    uint32_t* visible) {
+    const size_t count = bounds.size();
+    size_t out = 0;
+    size_t i = 0;
+
+#if defined(__AVX__)
+    __m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+    for (int p = 0; p < 6; p++) {
+        plane_x[p] = _mm256_set1_ps(frustum.planes[p].x);
+        plane_y[p] = _mm256_set1_ps(frustum.planes[p].y);
+        plane_z[p] = _mm256_set1_ps(frustum.planes[p].z);
+        plane_w[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(&bounds.x[i]);
+        __m256 y = _mm256_loadu_ps(&bounds.y[i]);
+        __m256 z = _mm256_loadu_ps(&bounds.z[i]);
+        __m256 neg_radius =
+            _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds.radius[i]));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(plane_x[p], x),
+                              _mm256_mul_ps(plane_y[p], y)),
+                _mm256_add_ps(_mm256_mul_ps(plane_z[p], z), plane_w[p]));
+            inside = _mm256_and_ps(
+                inside, _mm256_cmp_ps(distance, neg_radius, _CMP_GE_OQ));
+        }
+
+        unsigned mask = (unsigned)_mm256_movemask_ps(inside);
+        while (mask) {
+            visible[out++] = (uint32_t)(i + std::countr_zero(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+    for (int p = 0; p < 6; p++) {
+        plane_x[p] = _mm_set1_ps(frustum.planes[p].x);
+        plane_y[p] = _mm_set1_ps(frustum.planes[p].y);
+        plane_z[p] = _mm_set1_ps(frustum.planes[p].z);
+        plane_w[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(&bounds.x[i]);
+        __m128 y = _mm_loadu_ps(&bounds.y[i]);
+        __m128 z = _mm_loadu_ps(&bounds.z[i]);
+        __m128 neg_radius =
+            _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m128 distance =
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], x),
+                                      _mm_mul_ps(plane_y[p], y)),
+                           _mm_add_ps(_mm_mul_ps(plane_z[p], z), plane_w[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, neg_radius));
+        }
+
+        unsigned mask = (unsigned)_mm_movemask_ps(inside);
+        while (mask) {
+            visible[out++] = (uint32_t)(i + std::countr_zero(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Scalar fallback, and the tail that does not fill a whole register
+    for (; i < count; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            float distance = plane.x * bounds.x[i] + plane.y * bounds.y[i] +
+                             plane.z * bounds.z[i] + plane.w;
+            inside &= distance >= -bounds.radius[i];
+        }
+        if (inside) {
+            visible[out++] = (uint32_t)i;
+        }
+    }
+
+    return out;
+}
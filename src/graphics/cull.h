@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+// Planes as (normal, distance), a point p is inside when
+// dot(normal, p) + distance >= 0 for all of them
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Extracts the planes of the Vulkan clip volume (0 <= z <= w) from a
+    // view-projection matrix, already normalized for sphere tests
+    static Frustum from_matrix(const glm::mat4& viewproj);
+};
+
+// World space bounding spheres, stored as a structure of arrays so that the
+// culling tests several of them per instruction
+struct BoundsSoA {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+
+    void resize(size_t count);
+    size_t size() const { return x.size(); };
+};
+
+// Writes the indices of the spheres that intersect the frustum to
+// `visible`, in increasing order, and returns how many there are.
+// Uses AVX or SSE when the build enables them, scalar code otherwise.
+size_t cull_spheres(const Frustum& frustum, const BoundsSoA& bounds,
+                    uint32_t* visible);
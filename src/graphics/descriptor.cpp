@@ -0,0 +1,102 @@
+#include "descriptor.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+GraphicsDescriptorLayoutBuilder* GraphicsDescriptorLayoutBuilder::add_binding(
+    uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages,
+    uint32_t count, VkDescriptorBindingFlags flags) {
+    bindings.push_back(VkDescriptorSetLayoutBinding{
+        .binding = binding,
+        .descriptorType = type,
+        .descriptorCount = count,
+        .stageFlags = stages,
+    });
+    binding_flags.push_back(flags);
+    return this;
+}
+
+GraphicsDescriptorLayoutBuilder* GraphicsDescriptorLayoutBuilder::set_flags(
+    VkDescriptorSetLayoutCreateFlags flags) {
+    layout_info.flags = flags;
+    return this;
+}
+
+GraphicsDescriptorLayoutBuilder* GraphicsDescriptorLayoutBuilder::set_registry(
+    GraphicsPipelineRegistry* registry) {
+    m_registry = registry;
+    return this;
+}
+
+VkDescriptorSetLayout GraphicsDescriptorLayoutBuilder::build() {
+    VkDescriptorSetLayout out;
+
+    layout_info.bindingCount = (uint32_t)bindings.size();
+    layout_info.pBindings = bindings.data();
+
+    // Only chained when used, it needs Vulkan 1.2
+    layout_info.pNext = nullptr;
+    if (std::any_of(binding_flags.begin(), binding_flags.end(),
+                    [](VkDescriptorBindingFlags f) { return f != 0; })) {
+        binding_flags_info.bindingCount = (uint32_t)binding_flags.size();
+        binding_flags_info.pBindingFlags = binding_flags.data();
+        layout_info.pNext = &binding_flags_info;
+    }
+    if (m_registry) {
+        return m_registry->descriptor_set_layout(layout_info);
+    }
+    assert(!vkCreateDescriptorSetLayout(m_device, &layout_info, nullptr, &out));
+
+    return out;
+}
+
+GraphicsDescriptorPoolBuilder* GraphicsDescriptorPoolBuilder::add_size(
+    VkDescriptorType type, uint32_t count) {
+    sizes.push_back(VkDescriptorPoolSize{
+        .type = type,
+        .descriptorCount = count,
+    });
+    return this;
+}
+
+GraphicsDescriptorPoolBuilder* GraphicsDescriptorPoolBuilder::set_max_sets(
+    uint32_t count) {
+    pool_info.maxSets = count;
+    return this;
+}
+
+GraphicsDescriptorPoolBuilder* GraphicsDescriptorPoolBuilder::set_flags(
+    VkDescriptorPoolCreateFlags flags) {
+    pool_info.flags = flags;
+    return this;
+}
+
+GraphicsDescriptorPool GraphicsDescriptorPoolBuilder::build() {
+    GraphicsDescriptorPool out{};
+    out.m_device = m_device;
+
+    pool_info.poolSizeCount = (uint32_t)sizes.size();
+    pool_info.pPoolSizes = sizes.data();
+    assert(!vkCreateDescriptorPool(m_device, &pool_info, nullptr, &out.pool));
+
+    return out;
+}
+
+VkDescriptorSet GraphicsDescriptorPool::allocate(VkDescriptorSetLayout layout) {
+    VkDescriptorSet out;
+
+    VkDescriptorSetAllocateInfo alloc_info{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout,
+    };
+    assert(!vkAllocateDescriptorSets(m_device, &alloc_info, &out));
+
+    return out;
+}
+
+void GraphicsDescriptorPool::destroy() {
+    vkDestroyDescriptorPool(m_device, pool, nullptr);
+}
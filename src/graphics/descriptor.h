@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "pipelineregistry.h"
+
+class GraphicsDescriptorLayoutBuilder {
+   public:
+    GraphicsDescriptorLayoutBuilder(VkDevice device)
+        : m_device(device),
+          m_registry(nullptr),
+          bindings(),
+          binding_flags(),
+          layout_info(VkDescriptorSetLayoutCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+          }),
+          binding_flags_info(VkDescriptorSetLayoutBindingFlagsCreateInfo{
+              .sType =
+                  VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+          }){};
+
+    // `flags` needs the matching descriptor indexing features, e.g.
+    // VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+    GraphicsDescriptorLayoutBuilder* add_binding(
+        uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages,
+        uint32_t count = 1, VkDescriptorBindingFlags flags = 0);
+    GraphicsDescriptorLayoutBuilder* set_flags(
+        VkDescriptorSetLayoutCreateFlags flags);
+    // Takes the layout from the registry, so that identical bindings share
+    // it. The registry destroys it, not the caller.
+    GraphicsDescriptorLayoutBuilder* set_registry(
+        GraphicsPipelineRegistry* registry);
+    VkDescriptorSetLayout build();
+
+   private:
+    VkDevice m_device;
+    GraphicsPipelineRegistry* m_registry;
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    // Indexed like bindings
+    std::vector<VkDescriptorBindingFlags> binding_flags;
+    VkDescriptorSetLayoutCreateInfo layout_info;
+    VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info;
+};
+
+class GraphicsDescriptorPool {
+   public:
+    VkDescriptorPool pool;
+
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+    void destroy();
+
+   private:
+    VkDevice m_device;
+
+    friend class GraphicsDescriptorPoolBuilder;
+};
+
+class GraphicsDescriptorPoolBuilder {
+   public:
+    GraphicsDescriptorPoolBuilder(VkDevice device)
+        : m_device(device),
+          sizes(),
+          pool_info(VkDescriptorPoolCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .maxSets = 1,
+          }){};
+
+    GraphicsDescriptorPoolBuilder* add_size(VkDescriptorType type,
+                                            uint32_t count);
+    GraphicsDescriptorPoolBuilder* set_max_sets(uint32_t count);
+    GraphicsDescriptorPoolBuilder* set_flags(VkDescriptorPoolCreateFlags flags);
+    GraphicsDescriptorPool build();
+
+   private:
+    VkDevice m_device;
+    std::vector<VkDescriptorPoolSize> sizes;
+    VkDescriptorPoolCreateInfo pool_info;
+};
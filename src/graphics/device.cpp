@@ -36,16 +36,45 @@ GraphicsDeviceBuilder *GraphicsDeviceBuilder::add_queue(uint32_t family,
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
         .queueFamilyIndex = (uint32_t)family,
         .queueCount = 1,
-        .pQueuePriorities = &queue_priorities.at(queue_priorities.size() - 1),
     };
 
     queue_infos.push_back(info);
     return this;
 };
 
+GraphicsDeviceBuilder *GraphicsDeviceBuilder::set_features(
+    VkPhysicalDeviceFeatures enabled) {
+    features = enabled;
+    return this;
+}
+
+GraphicsDeviceBuilder *GraphicsDeviceBuilder::set_features12(
+    VkPhysicalDeviceVulkan12Features enabled) {
+    features12 = enabled;
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    return this;
+}
+
+GraphicsDeviceBuilder *GraphicsDeviceBuilder::set_features13(
+    VkPhysicalDeviceVulkan13Features enabled) {
+    features13 = enabled;
+    features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    return this;
+}
+
 GraphicsDevice GraphicsDeviceBuilder::build() {
     GraphicsDevice destination{};
 
+    // Chained here since the builder may have been copied or moved
+    features13.pNext = nullptr;
+    features12.pNext = &features13;
+    device_info.pNext = &features12;
+    device_info.pEnabledFeatures = &features;
+
+    // Pointed to here, adding queues may have moved the priorities
+    for (size_t i = 0; i < queue_infos.size(); i++) {
+        queue_infos[i].pQueuePriorities = &queue_priorities[i];
+    }
     device_info.queueCreateInfoCount = (uint32_t)queue_infos.size();
     device_info.pQueueCreateInfos = queue_infos.data();
     device_info.enabledExtensionCount = (uint32_t)device_extensions.size();
@@ -59,7 +88,8 @@ GraphicsDevice GraphicsDeviceBuilder::build() {
         GraphicsQueue queue{
             .family = queue_infos.at(i).queueFamilyIndex,
         };
-        vkGetDeviceQueue(destination.device, queue.family, i, &queue.handle);
+        // One queue per family
+        vkGetDeviceQueue(destination.device, queue.family, 0, &queue.handle);
         destination.queues.at(i) = queue;
     }
 
@@ -25,12 +25,21 @@ class GraphicsDeviceBuilder {
 
     GraphicsDeviceBuilder *add_device_extension(const char *layer);
     GraphicsDeviceBuilder *add_queue(uint32_t family, float priority);
+    GraphicsDeviceBuilder *set_features(VkPhysicalDeviceFeatures enabled);
+    GraphicsDeviceBuilder *set_features12(
+        VkPhysicalDeviceVulkan12Features enabled);
+    GraphicsDeviceBuilder *set_features13(
+        VkPhysicalDeviceVulkan13Features enabled);
 
     GraphicsDeviceBuilder(VkPhysicalDevice physical_device)
         : physical_device(physical_device),
           features(VkPhysicalDeviceFeatures{}),
+          features12(VkPhysicalDeviceVulkan12Features{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES}),
+          features13(VkPhysicalDeviceVulkan13Features{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES}),
+          // The swapchain extension is added by the callers that present
           device_extensions(std::vector<const char *>{
-              VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 #ifndef NDEBUG
               VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,
 #endif
@@ -46,6 +55,8 @@ class GraphicsDeviceBuilder {
    private:
     VkPhysicalDevice physical_device;
     VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceVulkan12Features features12;
+    VkPhysicalDeviceVulkan13Features features13;
     std::vector<const char *> device_extensions;
     std::vector<float> queue_priorities;
     std::vector<VkDeviceQueueCreateInfo> queue_infos;
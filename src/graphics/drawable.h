@@ -1,6 +1,6 @@
 #pragma once
 
-#include "glm/mat4x4.hpp"
+#include <cstddef>
 
 typedef size_t Handle;
 
@@ -8,5 +8,6 @@ class Drawable {
 public:
     Handle mesh_hdl;
     Handle material_hdl;
-    glm::mat4 model;
+    // Index in the engine transforms
+    Handle transform_hdl;
 };
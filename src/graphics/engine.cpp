@@ -1,11 +1,19 @@
 #include "engine.h"
 
 #include <src/shaders/color.frag.h>
+#include <src/shaders/material.frag.h>
 #include <src/shaders/mesh.vert.h>
+#include <src/shaders/mesh_quantized.vert.h>
 #include <src/shaders/normal.frag.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdio>
+#include <iterator>
+#include <random>
+#include <unordered_map>
 
 #include "glm/glm.hpp"
 #include "glm/gtx/transform.hpp"
@@ -16,8 +24,11 @@
 const int64_t one_second_ns = 1'000'000'000;
 
 // public
-GraphicsEngine::GraphicsEngine()
-    : m_frame_count(),
+GraphicsEngine::GraphicsEngine(GraphicsEngineConfig config)
+    : m_config(config),
+      m_frame_count(),
+      m_frames_in_flight(std::clamp<uint32_t>(config.frames_in_flight, 1,
+                                              MAX_FRAMES_IN_FLIGHT)),
       m_window_extent({1280, 720}),
       m_window(),
       m_surface(),
@@ -25,27 +36,77 @@ GraphicsEngine::GraphicsEngine()
       m_device(),
       m_qfamily_graphics(uint32_t(~0)),
       m_q_graphics(),
+      m_qfamily_transfer(uint32_t(~0)),
+      m_q_transfer(),
       m_allocator(),
+      m_upload(),
+      m_geometry(),
       m_swapchain(),
+      m_offscreen(),
       m_render(),
       m_commands(),
+      m_secondary(),
+      m_frames(),
+      m_descriptor_pool(),
+      m_instance_layout(),
+      m_gpu_culling(),
       m_pipelines(),
-      m_meshes() {
+      m_meshes(),
+      m_gpu_meshes(),
+      m_mesh_buffer(),
+      m_bindless(),
+      m_materials(),
+      m_material_buffer(),
+      m_streamer(),
+      m_streamed_materials(),
+      m_residency(),
+      m_stream_wait(),
+      m_bounds(),
+      m_visible(),
+      m_queue(),
+      m_transforms(),
+      m_instance_transforms(),
+      m_stats(),
+      m_stats_total(),
+      m_stats_frames(),
+      m_pending_capture(),
+      m_profiler(),
+      m_frame_ms(),
+      m_record_ms(),
+      m_submit_ms(),
+      m_gpu_ms(),
+      m_last_frame(),
+      m_latency_ms(),
+      m_last_input(),
+      m_frame_input(),
+      m_latency_pending(),
+      m_pipeline_cache(),
+      m_pipeline_registry(),
+      m_pipeline_batch(ThreadPool::global()),
+      m_pipeline_ids(),
+      m_swapchain_dirty(),
+      m_retired_swapchains(),
+      m_pipeline_ms() {
     // NOTE: vk-bootstrap is giving me problems on windows.
     //       Using raw vulkan fixes all issues, even though it is more complex.
 
-    // Get window
-    SDL_InitSubSystem(SDL_INIT_VIDEO);
-    m_window = SDL_CreateWindow("Learning Vulkan", SDL_WINDOWPOS_UNDEFINED,
-                                SDL_WINDOWPOS_UNDEFINED, m_window_extent.width,
-                                m_window_extent.height, SDL_WINDOW_VULKAN);
+    // Get window, headless runs have neither a window nor a surface
+    std::vector<const char *> sdl_extensions;
+    if (!m_config.headless) {
+        SDL_InitSubSystem(SDL_INIT_VIDEO);
+        m_window = SDL_CreateWindow(
+            "Learning Vulkan", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            m_window_extent.width, m_window_extent.height,
+            SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
 
-    uint32_t sdl_extension_count;
-    SDL_Vulkan_GetInstanceExtensions(m_window, &sdl_extension_count, nullptr);
+        uint32_t sdl_extension_count;
+        SDL_Vulkan_GetInstanceExtensions(m_window, &sdl_extension_count,
+                                         nullptr);
 
-    std::vector<const char *> sdl_extensions(sdl_extension_count);
-    SDL_Vulkan_GetInstanceExtensions(m_window, &sdl_extension_count,
-                                     sdl_extensions.data());
+        sdl_extensions.resize(sdl_extension_count);
+        SDL_Vulkan_GetInstanceExtensions(m_window, &sdl_extension_count,
+                                         sdl_extensions.data());
+    }
 
     m_application = GraphicsApplicationBuilder()
                         .set_application_name("Learning Vulkan")
@@ -53,15 +114,118 @@ GraphicsEngine::GraphicsEngine()
                         ->add_instance_extension(sdl_extensions)
                         ->build();
 
-    SDL_Vulkan_CreateSurface(m_window, m_application.instance, &m_surface);
+    if (!m_config.headless) {
+        SDL_Vulkan_CreateSurface(m_window, m_application.instance, &m_surface);
+    }
 
     m_qfamily_graphics = m_application.get_queue_family(VK_QUEUE_GRAPHICS_BIT);
 
-    m_device = GraphicsDeviceBuilder(m_application.device)
-                   .add_queue(m_qfamily_graphics, .99f)
-                   ->build();
+    // Indirect draws with a gpu written count, addressing the model matrices
+    // through firstInstance
+    bool gpu_culling_supported =
+        m_application.features.multiDrawIndirect &&
+        m_application.features.drawIndirectFirstInstance &&
+        m_application.features12.drawIndirectCount;
+    if (m_config.gpu_culling && !gpu_culling_supported) {
+        printf("gpu culling is not supported, culling on the cpu\n");
+        m_config.gpu_culling = false;
+    }
+    // The clusters are only drawn by the gpu culling path
+    m_config.cluster_culling =
+        m_config.cluster_culling && m_config.gpu_culling;
+
+    if (m_config.dynamic_rendering &&
+        !m_application.features13.dynamicRendering) {
+        printf("dynamic rendering is not supported, using a render pass\n");
+        m_config.dynamic_rendering = false;
+    }
+
+    // Runtime sized arrays, indexed with values that vary within a draw and
+    // updated while the frames in flight use other elements
+    const VkPhysicalDeviceVulkan12Features &features12 =
+        m_application.features12;
+    bool bindless_supported =
+        features12.runtimeDescriptorArray &&
+        features12.descriptorBindingPartiallyBound &&
+        features12.descriptorBindingSampledImageUpdateAfterBind &&
+        features12.descriptorBindingStorageBufferUpdateAfterBind &&
+        features12.descriptorBindingUpdateUnusedWhilePending &&
+        features12.shaderSampledImageArrayNonUniformIndexing;
+    if (m_config.bindless && !bindless_supported) {
+        printf("descriptor indexing is not supported, one pipeline per "
+               "material\n");
+        m_config.bindless = false;
+    }
+
+    // The textures are only streamed with bindless materials, through a
+    // queue of their own when the device has one that only copies
+    m_qfamily_transfer = m_qfamily_graphics;
+    size_t transfer_family = m_application.get_queue_family(
+        VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    if (m_config.bindless && transfer_family != size_t(-1)) {
+        m_qfamily_transfer = transfer_family;
+    }
+
+    // Block formats the streamed textures may have been baked to, in order
+    // of preference: BC7 keeps the most detail, BC1 and ETC2 only hold the
+    // opaque textures. Their features are enabled when the device has them.
+    const VkPhysicalDeviceFeatures &features = m_application.features;
+    bool compressed = m_config.bindless && m_config.compressed_textures;
+    VkBool32 bc = compressed && features.textureCompressionBC;
+    VkBool32 etc2 = compressed && features.textureCompressionETC2;
+    VkBool32 astc = compressed && features.textureCompressionASTC_LDR;
+    std::pair<VkFormat, VkBool32> candidates[]{
+        {VK_FORMAT_BC7_SRGB_BLOCK, bc},
+        {VK_FORMAT_ASTC_4x4_SRGB_BLOCK, astc},
+        {VK_FORMAT_BC3_SRGB_BLOCK, bc},
+        {VK_FORMAT_BC1_RGB_SRGB_BLOCK, bc},
+        {VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, etc2},
+    };
+    const VkFormatFeatureFlags texture_features =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    std::vector<VkFormat> texture_formats;
+    for (auto [format, enabled] : candidates) {
+        if (enabled &&
+            m_application.supports_format(format, texture_features)) {
+            texture_formats.push_back(format);
+        }
+    }
+
+    GraphicsDeviceBuilder device_builder(m_application.device);
+    device_builder.add_queue(m_qfamily_graphics, .99f);
+    if (m_qfamily_transfer != m_qfamily_graphics) {
+        device_builder.add_queue(m_qfamily_transfer, .5f);
+    }
+    device_builder
+        .set_features(VkPhysicalDeviceFeatures{
+            .multiDrawIndirect = m_config.gpu_culling,
+            .drawIndirectFirstInstance = m_config.gpu_culling,
+            .textureCompressionETC2 = etc2,
+            .textureCompressionASTC_LDR = astc,
+            .textureCompressionBC = bc,
+        })
+        ->set_features12(VkPhysicalDeviceVulkan12Features{
+            .drawIndirectCount = m_config.gpu_culling,
+            .shaderSampledImageArrayNonUniformIndexing = m_config.bindless,
+            .descriptorBindingSampledImageUpdateAfterBind = m_config.bindless,
+            .descriptorBindingStorageBufferUpdateAfterBind = m_config.bindless,
+            .descriptorBindingUpdateUnusedWhilePending = m_config.bindless,
+            .descriptorBindingPartiallyBound = m_config.bindless,
+            .runtimeDescriptorArray = m_config.bindless,
+            .timelineSemaphore = m_config.bindless,
+        })
+        ->set_features13(VkPhysicalDeviceVulkan13Features{
+            .dynamicRendering = m_config.dynamic_rendering,
+        });
+    if (!m_config.headless) {
+        device_builder.add_device_extension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+    m_device = device_builder.build();
 
     m_q_graphics = m_device.get_queue(m_qfamily_graphics);
+    m_q_transfer = m_device.get_queue(m_qfamily_transfer);
 
     // create allocator
     VmaAllocatorCreateInfo allocator_info{
@@ -71,78 +235,251 @@ GraphicsEngine::GraphicsEngine()
     };
     vmaCreateAllocator(&allocator_info, &m_allocator);
 
-    m_swapchain = GraphicsSwapchainBuilder(m_application.device, m_allocator,
-                                           m_device.device, m_surface)
-                      .set_extent(m_window_extent)
-                      ->build();
+    m_upload = GraphicsUploadBuilder(m_device.device, m_allocator,
+                                     m_qfamily_graphics, m_q_graphics)
+                   .build();
+
+    m_geometry = GraphicsGeometryBuilder(m_upload).build();
+
+    m_pipeline_registry =
+        GraphicsPipelineRegistryBuilder(m_device.device).build();
+    m_pipeline_cache =
+        GraphicsPipelineCacheBuilder(m_device.device, m_application.properties)
+            .set_path(m_config.pipeline_cache_path)
+            ->build();
 
     // Get Render pass
-    m_render = GraphicsRenderBuilder(m_swapchain, m_device.device).build();
+    if (m_config.headless) {
+        m_offscreen = GraphicsOffscreenBuilder(m_allocator, m_device.device)
+                          .set_extent(m_window_extent)
+                          ->set_image_count(m_frames_in_flight)
+                          ->set_readback(!m_config.capture_prefix.empty())
+                          ->build();
+        m_render = GraphicsRenderBuilder(m_offscreen, m_device.device)
+                       .set_dynamic_rendering(m_config.dynamic_rendering)
+                       ->build();
+    } else {
+        m_swapchain =
+            GraphicsSwapchainBuilder(m_application.device, m_allocator,
+                                     m_device.device, m_surface)
+                .set_extent(m_window_extent)
+                ->set_present_mode(m_config.present_mode)
+                ->set_image_count(m_config.swapchain_images)
+                ->build();
+        m_render = GraphicsRenderBuilder(m_swapchain, m_device.device)
+                       .set_dynamic_rendering(m_config.dynamic_rendering)
+                       ->build();
+        m_window_extent = m_swapchain.extent;
+        printf("Swapchain: %s, %zu images, %u frames in flight%s\n",
+               present_mode_name(m_swapchain.present_mode),
+               m_swapchain.images.size(), m_frames_in_flight,
+               m_config.low_latency ? ", low latency" : "");
+    }
 
-    for (size_t i = 0; i < FRAME_OVERLAP; i++) {
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
         m_commands[i] =
             GraphicsCommandBuilder{m_device.device, m_qfamily_graphics}.build();
     }
 
+    Profiler::global().set_enabled(m_config.profile);
+    if (m_config.profile) {
+        m_profiler =
+            GraphicsProfilerBuilder(
+                m_device.device,
+                m_application.properties.limits.timestampPeriod,
+                m_application.queue_families[m_qfamily_graphics]
+                    .timestampValidBits,
+                m_frames_in_flight)
+                .build();
+    }
+
+    // One pool per recording thread and frame in flight
+    uint32_t record_threads = m_config.record_threads;
+    if (m_config.record_bench) {
+        record_threads = std::max<uint32_t>(record_threads,
+                                            ThreadPool::global().size());
+    }
+    if (record_threads > 1) {
+        for (size_t i = 0; i < m_frames_in_flight; i++) {
+            m_secondary[i] =
+                GraphicsSecondaryCommandsBuilder{
+                    m_device.device, m_qfamily_graphics, record_threads}
+                    .build();
+        }
+    }
+
+    // Every frame in flight gets its own instance buffer, with the matrices
+    // at binding 0, the materials at binding 1 and the meshes at binding 2.
+    // Binding 3 is the GpuMesh table, shared by the frames.
+    m_instance_layout =
+        GraphicsDescriptorLayoutBuilder(m_device.device)
+            .set_registry(&m_pipeline_registry)
+            ->add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_VERTEX_BIT)
+            ->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_VERTEX_BIT)
+            ->add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_VERTEX_BIT)
+            ->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_VERTEX_BIT)
+            ->build();
+
+    m_descriptor_pool =
+        GraphicsDescriptorPoolBuilder(m_device.device)
+            .add_size(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                      4 * m_frames_in_flight)
+            ->set_max_sets(m_frames_in_flight)
+            ->build();
+
+    if (m_config.bindless) {
+        m_bindless = GraphicsBindlessBuilder(m_device.device).build();
+        GraphicsTextureStreamerBuilder streamer_builder(
+            m_device.device, m_allocator, m_bindless, m_qfamily_graphics,
+            m_qfamily_transfer, m_q_transfer);
+        streamer_builder.set_frames_in_flight(m_frames_in_flight);
+        std::string format_names;
+        for (VkFormat format : texture_formats) {
+            streamer_builder.add_format(format);
+            format_names += std::string(" ") + find_block_format(format)->name;
+        }
+        m_streamer = streamer_builder.build();
+        printf("Textures are streamed through the %s queue, baked "
+               "formats:%s\n",
+               m_qfamily_transfer != m_qfamily_graphics ? "transfer"
+                                                        : "graphics",
+               format_names.empty() ? " none" : format_names.c_str());
+    }
+
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
+        m_frames[i].descriptor_set =
+            m_descriptor_pool.allocate(m_instance_layout);
+    }
+
+    if (m_config.gpu_culling) {
+        m_gpu_culling =
+            GraphicsGpuCullingBuilder(m_device.device, m_allocator,
+                                      m_instance_layout, m_frames_in_flight)
+                .set_pipeline_cache(m_pipeline_cache.cache)
+                ->set_registry(&m_pipeline_registry)
+                ->set_cluster_culling(m_config.cluster_culling)
+                ->build();
+    }
+
+    // The pipelines compile on the thread pool while the meshes load
+    auto pipeline_start = std::chrono::steady_clock::now();
+    if (m_config.drawable_count) {
+        create_synthetic_scene();
+    } else {
+        create_grid_scene();
+    }
+    for (auto &pipeline : m_pipeline_batch.wait()) {
+        m_pipelines.push_back(pipeline);
+    }
+    update_pipeline_ids();
+    upload_materials();
+    upload_meshes();
+    m_pipeline_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - pipeline_start)
+                        .count();
+    if (m_config.shuffle) {
+        std::shuffle(m_drawables.begin(), m_drawables.end(),
+                     std::mt19937(1234));
+    }
+    m_transforms.update();
+    update_bounds();
+    if (m_config.gpu_culling) {
+        upload_gpu_scene();
+    }
+
+    // Run twice to compare, the first launch or a new driver starts cold
+    printf("Scene with %zu pipelines created in %.2f ms, %zu threads, %s "
+           "pipeline cache\n",
+           m_pipelines.size(), m_pipeline_ms, ThreadPool::global().size(),
+           m_pipeline_cache.warm ? "warm" : "cold");
+    GraphicsPipelineRegistry::Stats registry = m_pipeline_registry.stats();
+    printf(
+        "Pipeline registry: %zu/%zu pipelines, %zu/%zu layouts, %zu/%zu set "
+        "layouts, %zu/%zu shader modules are unique\n",
+        registry.pipelines, registry.pipeline_requests, registry.layouts,
+        registry.layout_requests, registry.set_layouts,
+        registry.set_layout_requests, registry.shader_modules,
+        registry.shader_module_requests);
+
+    if (m_config.bindless) {
+        printf("Bindless: %zu materials, %u textures\n", m_materials.size(),
+               m_bindless.texture_count());
+    }
+
+    printf("VulkanEngine::init OK\n");
+}
+
+// The default scene, a grid of triangles and a monkey
+void GraphicsEngine::create_grid_scene() {
     // Create the drawables
     Drawable monkey{};
-    const uint32_t triangle_rows = 50;
-    const uint32_t triangle_cols = 50;
+    const uint32_t triangle_rows = m_config.grid_size;
+    const uint32_t triangle_cols = m_config.grid_size;
     std::vector<Drawable> triangles(triangle_rows * triangle_cols);
 
-    // Create the pipeline
-    m_pipelines.push_back(GraphicsPipelineBuilder(m_device.device)
-                              .set_extent(m_window_extent)
-                              ->set_render_pass(m_render.renderpass)
-                              ->add_push_constant_range({
-                                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                                  .offset = 0,
-                                  .size = sizeof(glm::mat4),
-                              })
-                              ->add_shader(VK_SHADER_STAGE_VERTEX_BIT,
-                                           mesh_vert, sizeof(mesh_vert))
-                              ->add_shader(VK_SHADER_STAGE_FRAGMENT_BIT,
-                                           normal_frag, sizeof(normal_frag))
-                              ->build());
-    monkey.material_hdl = m_pipelines.size() - 1;
-
-    m_pipelines.push_back(GraphicsPipelineBuilder(m_device.device)
-                              .set_extent(m_window_extent)
-                              ->set_render_pass(m_render.renderpass)
-                              ->add_push_constant_range({
-                                  .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                                  .offset = 0,
-                                  .size = sizeof(glm::mat4),
-                              })
-                              ->add_shader(VK_SHADER_STAGE_VERTEX_BIT,
-                                           mesh_vert, sizeof(mesh_vert))
-                              ->add_shader(VK_SHADER_STAGE_FRAGMENT_BIT,
-                                           color_frag, sizeof(color_frag))
-                              ->build());
+    // Create the pipeline, with bindless textures the monkey and the
+    // triangles get the textures of the assets projected on them once they
+    // are streamed in
+    Handle triangle_material;
+    if (m_config.bindless) {
+        monkey.material_hdl =
+            add_streamed_material(ASSETS_PATH "lost_empire-RGBA.png", .5f);
+        triangle_material =
+            add_streamed_material(ASSETS_PATH "lost_empire-RGB.png", 1.f);
+    } else {
+        monkey.material_hdl = add_material(normal_frag, sizeof(normal_frag));
+        triangle_material = add_material(color_frag, sizeof(color_frag));
+    }
     for (auto &t : triangles) {
-        t.material_hdl = m_pipelines.size() - 1;
+        t.material_hdl = triangle_material;
     }
 
-    // load mesh
-    m_meshes.push_back(
-        Mesh(m_allocator,
-             std::vector<Vertex>{
-                 Vertex{.position{.5f, 0.f, 0.f}, .color{1.f, 0.f, 0.f}},
-                 Vertex{.position{-.5f, 0.f, 0.f}, .color{0.f, 1.f, 0.f}},
-                 Vertex{.position{0.f, 1.f, 0.f}, .color{0.f, 0.f, 1.f}},
-             }));
-    for (auto &t : triangles) {
-        t.mesh_hdl = m_meshes.size() - 1;
+    // The monkey is quantized, the triangle keeps the float layout: three
+    // vertices are not worth it
+    VertexFormat format = m_config.quantized_vertices
+                              ? VertexFormat::Quantized
+                              : VertexFormat::Float;
+    // A mesh that cannot be loaded or does not fit is left out with its
+    // drawables, the rest of the scene is still drawn
+    auto triangle = Mesh::create(
+        m_geometry, m_upload,
+        std::vector<Vertex>{
+            Vertex{.position{.5f, 0.f, 0.f}, .color{1.f, 0.f, 0.f}},
+            Vertex{.position{-.5f, 0.f, 0.f}, .color{0.f, 1.f, 0.f}},
+            Vertex{.position{0.f, 1.f, 0.f}, .color{0.f, 0.f, 1.f}},
+        },
+        std::vector<uint32_t>{0, 1, 2}, VertexFormat::Float,
+        m_config.cluster_culling);
+    if (triangle) {
+        m_meshes.push_back(std::move(*triangle));
+        for (auto &t : triangles) {
+            t.mesh_hdl = m_meshes.size() - 1;
+        }
+    } else {
+        printf("The triangle mesh does not fit, the grid is left out\n");
     }
 
-    glm::mat4 flip = glm::mat4{1.f};
-    flip[1][1] *= -1;
+    auto monkey_mesh =
+        Mesh::from_obj(m_geometry, m_upload, ASSETS_PATH, "monkey_smooth.obj",
+                       format, m_config.cluster_culling);
+    if (monkey_mesh) {
+        m_meshes.push_back(std::move(*monkey_mesh));
+        monkey.mesh_hdl = m_meshes.size() - 1;
+    } else {
+        printf("The monkey mesh is missing, it is left out\n");
+    }
 
-    m_meshes.push_back(
-        Mesh::from_obj(m_allocator, ASSETS_PATH, "monkey_smooth.obj").value());
-    monkey.mesh_hdl = m_meshes.size() - 1;
+    // Copy all the meshes to the gpu in a single submission
+    m_upload.flush();
 
-    monkey.model = glm::translate(glm::vec3{0.f, -1.5f, 0.f}) * flip;
+    // The negative y scales flip the meshes, whose y goes up
+    monkey.transform_hdl =
+        m_transforms.add(glm::vec3{0.f, -1.5f, 0.f},
+                         glm::quat{1.f, 0.f, 0.f, 0.f}, glm::vec3{1.f, -1.f, 1.f});
 
     float triangle_span_x = 25.f;
     float triangle_span_z = 25.f;
@@ -152,21 +489,267 @@ GraphicsEngine::GraphicsEngine()
         for (size_t j = 0; j < triangle_rows; j++) {
             float z = triangle_span_z / triangle_rows * j - triangle_span_z / 2;
 
-            triangles[i * triangle_rows + j].model =
-                glm::translate(glm::vec3{x, 0, z}) * flip *
-                glm::scale(glm::vec3{.25f});
+            triangles[i * triangle_rows + j].transform_hdl =
+                m_transforms.add(glm::vec3{x, 0.f, z},
+                                 glm::quat{1.f, 0.f, 0.f, 0.f},
+                                 glm::vec3{.25f, -.25f, .25f});
         }
     }
 
-    m_drawables.push_back(monkey);
-    m_drawables.insert(m_drawables.end(), triangles.begin(), triangles.end());
+    if (monkey_mesh) {
+        m_drawables.push_back(monkey);
+    }
+    if (triangle) {
+        m_drawables.insert(m_drawables.end(), triangles.begin(),
+                           triangles.end());
+    }
+}
 
-    printf("VulkanEngine::init OK\n");
+// A cubic grid of m_config.drawable_count spheres, which cycle through the
+// configured meshes and materials
+void GraphicsEngine::create_synthetic_scene() {
+    uint32_t material_count = std::max<uint32_t>(1, m_config.material_count);
+    uint32_t pipeline_count = std::max<uint32_t>(1, m_config.pipeline_count);
+    for (uint32_t i = 0; i < material_count; i++) {
+        // Bindless materials only differ by their parameters, so they share
+        // the pipeline of their state. Otherwise they alternate between two
+        // fragment shaders, which doubles the pipelines of an odd count.
+        GpuMaterial material{
+            .color{1.f},
+            .texture = GraphicsBindless::none,
+            .uv_scale = 1.f,
+        };
+        uint32_t state = i % pipeline_count;
+        if (m_config.bindless) {
+            float hue = (float)i / material_count;
+            material.color = glm::vec4(1.f - hue, .5f + .5f * hue, hue, 1.f);
+            add_material(material_frag, sizeof(material_frag), material,
+                         state);
+        } else if (i % 2) {
+            add_material(color_frag, sizeof(color_frag), material, state);
+        } else {
+            add_material(normal_frag, sizeof(normal_frag), material, state);
+        }
+    }
+
+    // About mesh_triangles triangles each, the meshes only differ by color
+    uint32_t mesh_count = std::max<uint32_t>(1, m_config.mesh_count);
+    uint32_t segments = std::max<uint32_t>(
+        3, (uint32_t)std::sqrt((float)m_config.mesh_triangles));
+    VertexFormat format = m_config.quantized_vertices
+                              ? VertexFormat::Quantized
+                              : VertexFormat::Float;
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        float hue = (float)i / mesh_count;
+        MeshData data = make_sphere(
+            segments, glm::vec3{hue, 1.f - hue, .5f + .5f * (i % 2)});
+        auto mesh = Mesh::create(m_geometry, m_upload, data.vertices,
+                                 data.indices, format,
+                                 m_config.cluster_culling);
+        if (!mesh) {
+            printf("Only %zu of the %u meshes fit, the drawables share them\n",
+                   m_meshes.size(), mesh_count);
+            break;
+        }
+        m_meshes.push_back(std::move(*mesh));
+    }
+    m_upload.flush();
+    mesh_count = (uint32_t)m_meshes.size();
+
+    // Not even one mesh fits, there is nothing to draw
+    size_t count = mesh_count ? m_config.drawable_count : 0;
+    size_t side = 1;
+    while (side * side * side < count) {
+        side++;
+    }
+    float span = 40.f;
+    float spacing = span / side;
+
+    m_drawables.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        size_t x = i % side;
+        size_t y = i / side % side;
+        size_t z = i / (side * side);
+        glm::vec3 position = glm::vec3(x, y, z) * spacing - span / 2.f;
+
+        m_drawables[i] = Drawable{
+            .mesh_hdl = i % mesh_count,
+            .material_hdl = i / mesh_count % material_count,
+            .transform_hdl = m_transforms.add(
+                position, glm::quat{1.f, 0.f, 0.f, 0.f},
+                glm::vec3{spacing * .4f}),
+        };
+    }
+}
+
+// Pipelines that ended up identical get the index of the first of them,
+// which is what the draws are sorted, batched and bound by
+void GraphicsEngine::update_pipeline_ids() {
+    std::unordered_map<VkPipeline, uint32_t> first_pipeline;
+    m_pipeline_ids.resize(m_pipelines.size());
+    for (size_t i = 0; i < m_pipelines.size(); i++) {
+        m_pipeline_ids[i] =
+            first_pipeline.try_emplace(m_pipelines[i].pipeline, i)
+                .first->second;
+    }
+}
+
+// The pipeline of the material of the drawable, for the vertex format of its
+// mesh
+uint32_t GraphicsEngine::pipeline_id(const Drawable &drawable) const {
+    return m_pipeline_ids[drawable.material_hdl * vertex_format_count +
+                          (uint32_t)m_meshes[drawable.mesh_hdl].vertex_format];
+}
+
+// Queues the pipelines of the material on the batch, one per vertex format,
+// they are compiled by the time m_pipeline_batch.wait() returns. The
+// parameters are only read by the bindless shaders.
+// Pipeline states that draw the same image: state 0 is the default, the
+// others alternate the depth test between LESS_OR_EQUAL and LESS and blend
+// the alpha channel, which nothing reads, with one of 64 factor pairs
+static void set_pipeline_state(GraphicsPipelineBuilder *builder,
+                               uint32_t state) {
+    static constexpr VkBlendFactor factors[] = {
+        VK_BLEND_FACTOR_ZERO,
+        VK_BLEND_FACTOR_ONE,
+        VK_BLEND_FACTOR_SRC_ALPHA,
+        VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        VK_BLEND_FACTOR_DST_ALPHA,
+        VK_BLEND_FACTOR_ONE_MINUS_DST_ALPHA,
+        VK_BLEND_FACTOR_SRC_COLOR,
+        VK_BLEND_FACTOR_ONE_MINUS_SRC_COLOR,
+    };
+    constexpr uint32_t factor_count = std::size(factors);
+    if (state % 2) {
+        builder->set_depth_compare_op(VK_COMPARE_OP_LESS);
+    }
+    if (uint32_t blend = state / 2) {
+        blend = (blend - 1) % (factor_count * factor_count);
+        builder->set_alpha_blend(factors[blend % factor_count],
+                                 factors[blend / factor_count]);
+    }
+}
+
+Handle GraphicsEngine::add_material(const uint32_t *fragment,
+                                    size_t fragment_size,
+                                    GpuMaterial material, uint32_t state) {
+    for (uint32_t i = 0; i < vertex_format_count; i++) {
+        VertexFormat format = (VertexFormat)i;
+        bool quantized = format == VertexFormat::Quantized;
+        auto builder =
+            std::make_unique<GraphicsPipelineBuilder>(m_device.device);
+        builder->set_render_pass(m_render.renderpass)
+            ->set_rendering_formats(m_render.color_format,
+                                    m_render.depth_format)
+            ->set_pipeline_cache(m_pipeline_cache.cache)
+            ->set_registry(&m_pipeline_registry)
+            ->set_vertex_format(format)
+            ->add_descriptor_set_layout(m_instance_layout)
+            ->add_shader(VK_SHADER_STAGE_VERTEX_BIT,
+                         quantized ? mesh_quantized_vert : mesh_vert,
+                         quantized ? sizeof(mesh_quantized_vert)
+                                   : sizeof(mesh_vert))
+            ->add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, fragment,
+                         fragment_size);
+        // Every pipeline has the same layout, so the sets stay bound across
+        // pipeline changes
+        if (m_config.bindless) {
+            builder->add_descriptor_set_layout(m_bindless.layout);
+        }
+        set_pipeline_state(builder.get(), state);
+        m_pipeline_batch.add(std::move(builder));
+    }
+
+    Handle handle = m_materials.size();
+    m_materials.push_back(material);
+    return handle;
+}
+
+// Samples the texture once streamed in, until then the material only has
+// its color
+Handle GraphicsEngine::add_streamed_material(const char *path,
+                                             float uv_scale) {
+    Handle material = add_material(material_frag, sizeof(material_frag),
+                                   GpuMaterial{
+                                       .color{1.f},
+                                       .texture = GraphicsBindless::none,
+                                       .uv_scale = uv_scale,
+                                   });
+    // Big enough for the window, the assets are 8k
+    m_streamed_materials.emplace_back(m_streamer.request(path, 2048),
+                                      material);
+    return material;
+}
+
+// The material table is the first bindless buffer, which material.frag
+// reads with the material index of the instance
+void GraphicsEngine::upload_materials() {
+    if (!m_config.bindless) {
+        return;
+    }
+    m_material_buffer = m_upload.create_buffer(
+        m_materials.size() * sizeof(GpuMaterial),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_upload.write(m_material_buffer, 0, m_materials.data(),
+                   m_materials.size() * sizeof(GpuMaterial));
+    m_upload.flush();
+    uint32_t index = m_bindless.add_buffer(m_material_buffer.buffer);
+    assert(index == 0);
+}
+
+// The GpuMesh table of the instance sets, which gives the quantized vertex
+// shader the bounds of each mesh, and the meshlets of every mesh in the same
+// order for the cluster culling
+void GraphicsEngine::upload_meshes() {
+    m_gpu_meshes.resize(m_meshes.size());
+    m_gpu_clusters.clear();
+    size_t vertex_bytes = 0;
+    size_t float_bytes = 0;
+    for (size_t i = 0; i < m_meshes.size(); i++) {
+        const Mesh &mesh = m_meshes[i];
+        m_gpu_meshes[i] = GpuMesh{
+            .index_count = mesh.index_count,
+            .first_index = mesh.first_index,
+            .vertex_offset = mesh.vertex_offset,
+            .first_cluster = (uint32_t)m_gpu_clusters.size(),
+            .aabb_min = glm::vec4(mesh.aabb_min, 0.f),
+            .aabb_extent = glm::vec4(mesh.aabb_max - mesh.aabb_min, 0.f),
+        };
+        for (const Meshlet &meshlet : mesh.meshlets) {
+            m_gpu_clusters.push_back(GpuCluster{
+                .sphere = glm::vec4(meshlet.center, meshlet.radius),
+                .cone = glm::vec4(meshlet.cone_axis, meshlet.cone_cutoff),
+                .first_index = mesh.first_index + meshlet.first_index,
+                .index_count = meshlet.index_count,
+            });
+        }
+        vertex_bytes += (size_t)mesh.vertex_count * mesh.vertex_stride;
+        float_bytes += (size_t)mesh.vertex_count * sizeof(Vertex);
+    }
+
+    // Empty buffers are not allowed, an empty scene keeps one unused element
+    m_mesh_buffer = m_upload.create_buffer(
+        std::max<size_t>(m_gpu_meshes.size(), 1) * sizeof(GpuMesh),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_upload.write(m_mesh_buffer, 0, m_gpu_meshes.data(),
+                   m_gpu_meshes.size() * sizeof(GpuMesh));
+    m_upload.flush();
+
+    printf("Vertices: %.2f MB, %.2f MB as Vertex\n",
+           vertex_bytes / (1024. * 1024.), float_bytes / (1024. * 1024.));
+    if (m_config.cluster_culling) {
+        size_t triangles = 0;
+        for (const Mesh &mesh : m_meshes) {
+            triangles += mesh.index_count / 3;
+        }
+        printf("Meshlets: %zu, %.1f triangles each\n", m_gpu_clusters.size(),
+               (double)triangles / std::max<size_t>(m_gpu_clusters.size(), 1));
+    }
 }
 
 GraphicsEngine::~GraphicsEngine() {
     // Wait for the gpu to finish the pending work
-    for (size_t i = 0; i < FRAME_OVERLAP; i++) {
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
         assert(!vkWaitForFences(m_device.device, 1, &m_commands[i].fence_render,
                                 true, one_second_ns));
     }
@@ -178,122 +761,283 @@ GraphicsEngine::~GraphicsEngine() {
     for (auto p : m_pipelines) {
         p.destroy();
     };
-    for (size_t i = 0; i < FRAME_OVERLAP; i++) {
+    vmaDestroyBuffer(m_allocator, m_mesh_buffer.buffer,
+                     m_mesh_buffer.allocation);
+    if (m_config.bindless) {
+        m_streamer.destroy();
+        vmaDestroyBuffer(m_allocator, m_material_buffer.buffer,
+                         m_material_buffer.allocation);
+        m_bindless.destroy();
+    }
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
+        if (m_frames[i].instance_capacity) {
+            vmaDestroyBuffer(m_allocator, m_frames[i].instance_buffer.buffer,
+                             m_frames[i].instance_buffer.allocation);
+        }
+    }
+    if (m_config.gpu_culling) {
+        m_gpu_culling.destroy();
+    }
+    m_pipeline_registry.destroy();
+    destroy_retired_swapchains(true);
+    m_profiler.destroy();
+    m_pipeline_cache.save();
+    m_pipeline_cache.destroy();
+    m_descriptor_pool.destroy();
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
+        m_secondary[i].destroy();
         m_commands[i].destroy();
     }
     m_render.destroy();
-    m_swapchain.destroy();
+    if (m_config.headless) {
+        m_offscreen.destroy();
+    } else {
+        m_swapchain.destroy();
+    }
+    m_geometry.destroy();
+    m_upload.destroy();
     vmaDestroyAllocator(m_allocator);
     m_device.destroy();
-    vkDestroySurfaceKHR(m_application.instance, m_surface, nullptr);
+    if (!m_config.headless) {
+        vkDestroySurfaceKHR(m_application.instance, m_surface, nullptr);
+    }
     m_application.destroy();
-    SDL_DestroyWindow(m_window);
+    if (!m_config.headless) {
+        SDL_DestroyWindow(m_window);
+    }
 
     printf("VulkanEngine::cleanup OK\n");
 }
 
 void GraphicsEngine::run() {
-    SDL_Event event;
+    if (m_config.record_bench) {
+        run_record_bench();
+        return;
+    }
 
-    while (true) {
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                return;
-            }
+    auto start = std::chrono::steady_clock::now();
+    auto last_print = start;
+    double record_ms = 0.;
+
+    while (!m_config.frame_count || m_frame_count < m_config.frame_count) {
+        if (poll_quit()) {
+            break;
         }
         draw();
+        record_ms += m_stats.record_ms;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_print >= std::chrono::seconds(1)) {
+            print_stats();
+            last_print = now;
+        }
+    }
+
+    // The captures and timestamps of the last frames are read once they are
+    // done
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
+        assert(!vkWaitForFences(m_device.device, 1, &m_commands[i].fence_render,
+                                true, one_second_ns));
+        save_capture(i);
+        m_profiler.collect(i);
+    }
+    if (!m_config.trace_path.empty() &&
+        Profiler::global().write_trace(m_config.trace_path.c_str())) {
+        printf("Trace written to %s\n", m_config.trace_path.c_str());
+    }
+
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    if (m_frame_count) {
+        printf("%zu frames in %.2f s (%.1f fps), record %.3f ms\n",
+               m_frame_count, time.count(), m_frame_count / time.count(),
+               record_ms / m_frame_count);
+        RollingStats::Summary latency = m_latency_ms.summary();
+        printf(
+            "%s, %u frames in flight%s: latency avg %.3f ms, p99 %.3f ms\n",
+            m_config.headless ? "headless"
+                              : present_mode_name(m_swapchain.present_mode),
+            m_frames_in_flight, m_config.low_latency ? ", low latency" : "",
+            latency.avg, latency.p99);
     }
 }
 
+// Waits for the frame before the current one, instead of the one that last
+// used its slot, so that the cpu never gets further ahead of the gpu than
+// the frame being recorded
+void GraphicsEngine::wait_previous_frame() {
+    if (!m_frame_count) {
+        return;
+    }
+    PROFILE_ZONE("latency wait");
+    size_t previous = (m_frame_count - 1) % m_frames_in_flight;
+    assert(!vkWaitForFences(m_device.device, 1,
+                            &m_commands[previous].fence_render, true,
+                            one_second_ns));
+    collect_latency();
+}
+
+// The latency of a frame is only known once its fence is seen signaled, so
+// it is at most one poll late
+void GraphicsEngine::collect_latency() {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
+        if (m_latency_pending[i] &&
+            vkGetFenceStatus(m_device.device, m_commands[i].fence_render) ==
+                VK_SUCCESS) {
+            m_latency_ms.add(std::chrono::duration<float, std::milli>(
+                                 now - m_frame_input[i])
+                                 .count());
+            m_latency_pending[i] = false;
+        }
+    }
+}
+
+// Samples the input of the next frame
+bool GraphicsEngine::poll_quit() {
+    if (m_config.low_latency) {
+        wait_previous_frame();
+    }
+    m_last_input = std::chrono::steady_clock::now();
+    if (m_config.headless) {
+        return false;
+    }
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) {
+            return true;
+        }
+        if (event.type == SDL_WINDOWEVENT &&
+            event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            m_swapchain_dirty = true;
+        }
+    }
+    return false;
+}
+
 void GraphicsEngine::draw() {
+    PROFILE_ZONE("draw");
     GraphicsCommand *cmd = get_current_command();
-    assert(!vkWaitForFences(m_device.device, 1, &cmd->fence_render, true,
-                            one_second_ns));
-    assert(!vkResetFences(m_device.device, 1, &cmd->fence_render));
-    assert(!vkResetCommandBuffer(cmd->cmd_buf, 0));
+    size_t frame = m_frame_count % m_frames_in_flight;
+    {
+        PROFILE_ZONE("wait");
+        collect_latency();
+        assert(!vkWaitForFences(m_device.device, 1, &cmd->fence_render, true,
+                                one_second_ns));
+        collect_latency();
+    }
+    destroy_retired_swapchains(false);
 
-    uint32_t swap_img_idx;
-    assert(!vkAcquireNextImageKHR(m_device.device, m_swapchain.swapchain,
-                                  one_second_ns, cmd->semph_present, nullptr,
-                                  &swap_img_idx));
+    // Nothing is drawn while the window is minimized
+    if (!m_config.headless && m_swapchain_dirty && !recreate_swapchain()) {
+        SDL_Delay(16);
+        return;
+    }
 
-    VkCommandBufferBeginInfo cmd_begin_info{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-    };
-    assert(!vkBeginCommandBuffer(cmd->cmd_buf, &cmd_begin_info));
-
-    VkClearValue clear_values[]{
-        // color
-        VkClearValue{.color{.float32{.0f, 0.f, 0.f, 0.f}}},
-        // depth
-        VkClearValue{
-            .depthStencil{.depth = 1.f},
-        }};
-
-    VkRenderPassBeginInfo renderpass_begin_info{
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = m_render.renderpass,
-        .framebuffer = m_render.framebuffers[swap_img_idx],
-        .renderArea{
-            .extent = m_window_extent,
-        },
-        .clearValueCount = sizeof(clear_values) / sizeof(clear_values[0]),
-        .pClearValues = clear_values,
-    };
-    vkCmdBeginRenderPass(cmd->cmd_buf, &renderpass_begin_info,
-                         VK_SUBPASS_CONTENTS_INLINE);
+    // The timestamps of the frame that last used this slot are done
+    double gpu_ms = m_profiler.collect(frame);
+    if (gpu_ms >= 0.) {
+        m_gpu_ms.add(gpu_ms);
+    }
 
-    // Draw
-    glm::vec3 camera_position{0.f, -2.f, 5.f};
-    glm::mat4 view = glm::inverse(glm::rotate(glm::radians(m_frame_count * .2f),
-                                              glm::vec3{0.f, 1.f, 0.f}) *
-                                  glm::translate(camera_position));
-    glm::mat4 proj =
-        glm::perspective(glm::radians(90.f), 16.f / 9.f, 0.1f, 200.f);
+    auto now = std::chrono::steady_clock::now();
+    if (m_frame_count) {
+        m_frame_ms.add(
+            std::chrono::duration<float, std::milli>(now - m_last_frame)
+                .count());
+    }
+    m_last_frame = now;
 
-    Handle current_mesh = -1;
-    Handle current_material = -1;
-    for (auto d : m_drawables) {
-        if (d.material_hdl != current_material) {
-            current_material = d.material_hdl;
-            vkCmdBindPipeline(cmd->cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              m_pipelines.at(current_material).pipeline);
+    // Offscreen images belong to a frame in flight, so they are free once its
+    // fence is signaled
+    uint32_t image_idx = frame;
+    if (m_config.headless) {
+        save_capture(image_idx);
+    } else {
+        PROFILE_ZONE("acquire");
+        VkResult result = vkAcquireNextImageKHR(
+            m_device.device, m_swapchain.swapchain, one_second_ns,
+            cmd->semph_present, nullptr, &image_idx);
+        // The fence was not reset yet, so the next frame can retry
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            m_swapchain_dirty = true;
+            return;
         }
-        if (d.mesh_hdl != current_mesh) {
-            current_mesh = d.mesh_hdl;
-            VkDeviceSize offset = 0;
-            vkCmdBindVertexBuffers(
-                cmd->cmd_buf, 0, 1,
-                &m_meshes.at(current_mesh).vertex_buffer.buffer, &offset);
+        assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+        // A suboptimal image is still drawn and presented
+        if (result == VK_SUBOPTIMAL_KHR) {
+            m_swapchain_dirty = true;
         }
-
-        glm::mat4 transform = proj * view * d.model;
-        vkCmdPushConstants(
-            cmd->cmd_buf, m_pipelines.at(current_material).layout,
-            VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &transform);
-        vkCmdDraw(cmd->cmd_buf, m_meshes.at(current_mesh).vertices.size(), 1, 0,
-                  0);
     }
+    assert(!vkResetFences(m_device.device, 1, &cmd->fence_render));
+    assert(!vkResetCommandBuffer(cmd->cmd_buf, 0));
 
-    // finalize the render pass and the command buffer
-    vkCmdEndRenderPass(cmd->cmd_buf);
-    assert(!vkEndCommandBuffer(cmd->cmd_buf));
+    auto record_start = std::chrono::steady_clock::now();
+    record_frame(cmd->cmd_buf, image_idx);
+    std::chrono::duration<double, std::milli> record_time =
+        std::chrono::steady_clock::now() - record_start;
 
-    // prepare the submission to the queue.
-    VkPipelineStageFlags wait_stage =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    m_stats.record_ms = record_time.count();
+    m_record_ms.add(m_stats.record_ms);
+    m_stats_total.draw_calls += m_stats.draw_calls;
+    m_stats_total.pipeline_binds += m_stats.pipeline_binds;
+    m_stats_total.buffer_binds += m_stats.buffer_binds;
+    m_stats_total.visible += m_stats.visible;
+    m_stats_total.culled += m_stats.culled;
+    m_stats_total.record_ms += m_stats.record_ms;
+    m_stats_frames++;
+
+    // prepare the submission to the queue, it waits for the swapchain image
+    // and for the texture copies the frame consumes
+    VkSemaphore wait_semaphores[2];
+    VkPipelineStageFlags wait_stages[2];
+    uint64_t wait_values[2];
+    uint32_t wait_count = 0;
+    if (!m_config.headless) {
+        wait_semaphores[wait_count] = cmd->semph_present;
+        wait_stages[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        wait_values[wait_count++] = 0;
+    }
+    if (m_stream_wait) {
+        wait_semaphores[wait_count] = m_streamer.semaphore;
+        wait_stages[wait_count] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        wait_values[wait_count++] = m_stream_wait;
+    }
+    // The values of the binary semaphores are ignored
+    VkTimelineSemaphoreSubmitInfo timeline{
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = wait_count,
+        .pWaitSemaphoreValues = wait_values,
+    };
     VkSubmitInfo submit{
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &cmd->semph_present,
-        .pWaitDstStageMask = &wait_stage,
+        .pNext = m_stream_wait ? &timeline : nullptr,
+        .waitSemaphoreCount = wait_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
         .commandBufferCount = 1,
         .pCommandBuffers = &cmd->cmd_buf,
         .signalSemaphoreCount = 1,
         .pSignalSemaphores = &cmd->semph_render,
     };
-    assert(!vkQueueSubmit(m_q_graphics, 1, &submit, cmd->fence_render));
+    if (m_config.headless) {
+        submit.signalSemaphoreCount = 0;
+    }
+    {
+        PROFILE_ZONE("submit");
+        auto submit_start = std::chrono::steady_clock::now();
+        assert(!vkQueueSubmit(m_q_graphics, 1, &submit, cmd->fence_render));
+        m_submit_ms.add(std::chrono::duration<float, std::milli>(
+                            std::chrono::steady_clock::now() - submit_start)
+                            .count());
+    }
+    m_frame_input[frame] = m_last_input;
+    m_latency_pending[frame] = true;
+
+    if (m_config.headless) {
+        m_frame_count++;
+        return;
+    }
 
     VkPresentInfoKHR present_info{
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -301,13 +1045,696 @@ void GraphicsEngine::draw() {
         .pWaitSemaphores = &cmd->semph_render,
         .swapchainCount = 1,
         .pSwapchains = &m_swapchain.swapchain,
-        .pImageIndices = &swap_img_idx,
+        .pImageIndices = &image_idx,
     };
-    assert(!vkQueuePresentKHR(m_q_graphics, &present_info));
+    {
+        PROFILE_ZONE("present");
+        VkResult result = vkQueuePresentKHR(m_q_graphics, &present_info);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR ||
+            result == VK_SUBOPTIMAL_KHR) {
+            m_swapchain_dirty = true;
+        } else {
+            assert(result == VK_SUCCESS);
+        }
+    }
 
     m_frame_count++;
 }
 
+// Records the whole frame into the primary command buffer of the current
+// frame in flight, which is reset
+void GraphicsEngine::record_frame(VkCommandBuffer cmd_buf, uint32_t image_idx) {
+    PROFILE_ZONE("record");
+    size_t frame = m_frame_count % m_frames_in_flight;
+
+    VkCommandBufferBeginInfo cmd_begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    assert(!vkBeginCommandBuffer(cmd_buf, &cmd_begin_info));
+
+    m_profiler.begin_frame(cmd_buf, frame);
+    uint32_t gpu_frame = m_profiler.begin_zone(cmd_buf, frame, "gpu frame");
+
+    // Draw, the camera only depends on the frame number so that headless
+    // runs are reproducible
+    glm::vec3 camera_position{0.f, -2.f, 5.f};
+    glm::mat4 view = glm::inverse(glm::rotate(glm::radians(m_frame_count * .2f),
+                                              glm::vec3{0.f, 1.f, 0.f}) *
+                                  glm::translate(camera_position));
+    glm::mat4 proj =
+        glm::perspective(glm::radians(90.f),
+                         (float)m_window_extent.width / m_window_extent.height,
+                         0.1f, 200.f);
+
+    glm::mat4 viewproj = proj * view;
+    glm::vec3 camera = glm::inverse(view)[3];
+
+    m_stats = {};
+
+    // Before the render pass, which samples the textures streamed in
+    if (m_config.bindless) {
+        stream_textures(cmd_buf);
+    }
+
+    // The compute dispatch has to be recorded outside of the render pass
+    if (m_config.gpu_culling) {
+        uint32_t gpu_cull = m_profiler.begin_zone(cmd_buf, frame, "gpu cull");
+        if (m_transforms.update()) {
+            update_bounds();
+            update_gpu_scene(cmd_buf, frame);
+        }
+        m_gpu_culling.record_cull(cmd_buf, frame, viewproj, camera);
+        m_profiler.end_zone(cmd_buf, frame, gpu_cull);
+    } else {
+        prepare_draws(viewproj);
+    }
+
+    // A render pass recorded from secondary command buffers can only execute
+    // them, everything is recorded by the threads
+    bool parallel = !m_config.gpu_culling && m_config.record_threads > 1;
+
+    // Timestamps can not be written inside of a render pass that executes
+    // secondary command buffers, so the zone surrounds it
+    uint32_t gpu_pass = m_profiler.begin_zone(cmd_buf, frame, "render pass");
+    m_render.begin(cmd_buf, image_idx, m_window_extent, parallel);
+
+    if (m_config.gpu_culling) {
+        draw_gpu_culled(cmd_buf, viewproj);
+    } else if (parallel) {
+        record_parallel(cmd_buf, image_idx, viewproj);
+    } else {
+        record_draws(cmd_buf, 0, m_queue.size(), viewproj, m_stats);
+    }
+
+    if (!m_config.gpu_culling && m_queue.size()) {
+        FrameData *frame_data = get_current_frame();
+        vmaFlushAllocation(m_allocator, frame_data->instance_buffer.allocation,
+                           0, m_queue.size() * sizeof(glm::mat4));
+        vmaFlushAllocation(
+            m_allocator, frame_data->instance_buffer.allocation,
+            frame_data->instance_capacity * sizeof(glm::mat4),
+            m_queue.size() * sizeof(uint32_t));
+        vmaFlushAllocation(
+            m_allocator, frame_data->instance_buffer.allocation,
+            frame_data->instance_capacity *
+                (sizeof(glm::mat4) + sizeof(uint32_t)),
+            m_queue.size() * sizeof(uint32_t));
+    }
+
+    // finalize the render pass and the command buffer
+    m_render.end(cmd_buf, image_idx);
+    m_profiler.end_zone(cmd_buf, frame, gpu_pass);
+    if (m_config.headless && !m_config.capture_prefix.empty()) {
+        m_offscreen.record_readback(cmd_buf, image_idx);
+        m_pending_capture[image_idx] = m_frame_count + 1;
+    }
+    m_profiler.end_zone(cmd_buf, frame, gpu_frame);
+    assert(!vkEndCommandBuffer(cmd_buf));
+}
+
+// Recreates the swapchain at the size of the window, without waiting for the
+// device: the old swapchain and framebuffers are retired until the frames in
+// flight that use them are done. Returns false while the window is minimized.
+bool GraphicsEngine::recreate_swapchain() {
+    int width, height;
+    SDL_Vulkan_GetDrawableSize(m_window, &width, &height);
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    PROFILE_ZONE("recreate swapchain");
+    auto start = std::chrono::steady_clock::now();
+
+    GraphicsSwapchain swapchain =
+        GraphicsSwapchainBuilder(m_application.device, m_allocator,
+                                 m_device.device, m_surface)
+            .set_extent(VkExtent2D{(uint32_t)width, (uint32_t)height})
+            ->set_present_mode(m_config.present_mode)
+            ->set_image_count(m_config.swapchain_images)
+            ->set_old_swapchain(m_swapchain.swapchain)
+            ->build();
+    // The render pass and the pipelines only depend on the formats
+    assert(swapchain.format.format == m_swapchain.format.format);
+
+    m_retired_swapchains.push_back(RetiredSwapchain{
+        .swapchain = m_swapchain,
+        .framebuffers = m_render.recreate_framebuffers(swapchain),
+        .frame = m_frame_count,
+    });
+    m_swapchain = swapchain;
+    m_window_extent = swapchain.extent;
+    m_swapchain_dirty = false;
+
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now() - start;
+    printf("Swapchain recreated at %ux%u in %.2f ms\n", m_window_extent.width,
+           m_window_extent.height, time.count());
+    return true;
+}
+
+// The frames before `frame` used a retired swapchain, they are done once the
+// fence of frame + m_frames_in_flight - 1 was waited
+void GraphicsEngine::destroy_retired_swapchains(bool all) {
+    std::erase_if(m_retired_swapchains, [&](RetiredSwapchain &retired) {
+        if (!all && m_frame_count + 1 < retired.frame + m_frames_in_flight) {
+            return false;
+        }
+        for (VkFramebuffer framebuffer : retired.framebuffers) {
+            vkDestroyFramebuffer(m_device.device, framebuffer, nullptr);
+        }
+        retired.swapchain.destroy();
+        return true;
+    });
+}
+
+void GraphicsEngine::set_viewport(VkCommandBuffer cmd_buf) {
+    VkViewport viewport{
+        .width = (float)m_window_extent.width,
+        .height = (float)m_window_extent.height,
+        .maxDepth = 1.f,
+    };
+    VkRect2D scissor{.extent = m_window_extent};
+    vkCmdSetViewport(cmd_buf, 0, 1, &viewport);
+    vkCmdSetScissor(cmd_buf, 0, 1, &scissor);
+}
+
 GraphicsCommand *GraphicsEngine::get_current_command() {
-    return &m_commands[m_frame_count % FRAME_OVERLAP];
+    return &m_commands[m_frame_count % m_frames_in_flight];
+}
+
+FrameData *GraphicsEngine::get_current_frame() {
+    return &m_frames[m_frame_count % m_frames_in_flight];
+}
+
+void GraphicsEngine::update_bounds() {
+    m_bounds.resize(m_drawables.size());
+    for (size_t i = 0; i < m_drawables.size(); i++) {
+        const Drawable &d = m_drawables[i];
+        const Mesh &mesh = m_meshes.at(d.mesh_hdl);
+
+        const glm::mat4 &model = m_transforms.world[d.transform_hdl];
+
+        glm::vec4 center = model * glm::vec4(mesh.center, 1.f);
+        float scale = std::max({glm::length(glm::vec3(model[0])),
+                                glm::length(glm::vec3(model[1])),
+                                glm::length(glm::vec3(model[2]))});
+
+        m_bounds.x[i] = center.x;
+        m_bounds.y[i] = center.y;
+        m_bounds.z[i] = center.z;
+        m_bounds.radius[i] = mesh.radius * scale;
+    }
+}
+
+void GraphicsEngine::cull(const glm::mat4 &viewproj) {
+    PROFILE_ZONE("cull");
+    m_visible.resize(m_drawables.size());
+
+    size_t visible = m_drawables.size();
+    if (m_config.culling) {
+        visible = cull_spheres(Frustum::from_matrix(viewproj), m_bounds,
+                               m_visible.data());
+    } else {
+        for (size_t i = 0; i < m_visible.size(); i++) {
+            m_visible[i] = i;
+        }
+    }
+    m_visible.resize(visible);
+
+    m_stats.visible = visible;
+    m_stats.culled = m_drawables.size() - visible;
+}
+
+void GraphicsEngine::prepare_draws(const glm::mat4 &viewproj) {
+    if (m_transforms.update()) {
+        update_bounds();
+    }
+    cull(viewproj);
+
+    // Clip space w is the view depth, so the key orders the draws front to
+    // back within each pipeline and mesh
+    m_queue.clear();
+    for (uint32_t i : m_visible) {
+        const Drawable &d = m_drawables[i];
+        float depth = viewproj[0][3] * m_bounds.x[i] +
+                      viewproj[1][3] * m_bounds.y[i] +
+                      viewproj[2][3] * m_bounds.z[i] + viewproj[3][3];
+        m_queue.push(make_render_key(0, pipeline_id(d), d.mesh_hdl, depth), i);
+    }
+    if (m_config.sort_queue) {
+        PROFILE_ZONE("sort");
+        m_queue.sort(&ThreadPool::global());
+    }
+
+    reserve_instances(get_current_frame(), m_queue.size());
+    m_instance_transforms.resize(m_queue.size());
+}
+
+// Records the queued draws in [begin, end), and writes their matrices,
+// materials and meshes in queue order, so that each draw can address its
+// instances with firstInstance. Called from several threads at once for
+// disjoint ranges.
+void GraphicsEngine::record_draws(VkCommandBuffer cmd_buf, size_t begin,
+                                  size_t end, const glm::mat4 &viewproj,
+                                  GraphicsStats &stats) {
+    FrameData *frame = get_current_frame();
+    for (size_t i = begin; i < end; i++) {
+        const Drawable &d = m_drawables[m_queue.items[i]];
+        m_instance_transforms[i] = d.transform_hdl;
+        frame->materials[i] = d.material_hdl;
+        frame->meshes[i] = d.mesh_hdl;
+    }
+    multiply_transforms(viewproj, m_transforms.world.data(),
+                        m_instance_transforms.data() + begin, end - begin,
+                        frame->instances + begin);
+
+    // Every mesh lives in the same buffers, so they are bound once
+    m_geometry.bind(cmd_buf);
+    stats.buffer_binds++;
+    // Secondary command buffers do not inherit the dynamic state
+    set_viewport(cmd_buf);
+
+    VkDescriptorSet sets[]{frame->descriptor_set, m_bindless.set};
+    uint32_t set_count = m_config.bindless ? 2 : 1;
+    Handle current_pipeline = -1;
+    for (size_t first = begin; first < end;) {
+        const Drawable &d = m_drawables[m_queue.items[first]];
+
+        uint32_t instance_count = 1;
+        while (m_config.instancing && first + instance_count < end) {
+            const Drawable &next =
+                m_drawables[m_queue.items[first + instance_count]];
+            if (next.mesh_hdl != d.mesh_hdl ||
+                pipeline_id(next) != pipeline_id(d)) {
+                break;
+            }
+            instance_count++;
+        }
+
+        // Materials that share a pipeline do not rebind it
+        if (pipeline_id(d) != current_pipeline) {
+            current_pipeline = pipeline_id(d);
+            const GraphicsPipeline &pipeline = m_pipelines.at(current_pipeline);
+            vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              pipeline.pipeline);
+            vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    pipeline.layout, 0, set_count, sets, 0,
+                                    nullptr);
+            stats.pipeline_binds++;
+        }
+
+        const Mesh &mesh = m_meshes.at(d.mesh_hdl);
+        vkCmdDrawIndexed(cmd_buf, mesh.index_count, instance_count,
+                         mesh.first_index, mesh.vertex_offset, first);
+        stats.draw_calls++;
+        first += instance_count;
+    }
+}
+
+// Splits the queue in one contiguous chunk per thread, each recorded into the
+// secondary command buffer of its thread and executed in queue order
+void GraphicsEngine::record_parallel(VkCommandBuffer cmd_buf,
+                                     uint32_t image_idx,
+                                     const glm::mat4 &viewproj) {
+    GraphicsSecondaryCommands &secondary =
+        m_secondary[m_frame_count % m_frames_in_flight];
+    size_t chunks = std::max<size_t>(
+        1, std::min({size_t(m_config.record_threads), secondary.size(),
+                     m_queue.size()}));
+
+    VkCommandBufferInheritanceInfo inheritance;
+    VkCommandBufferInheritanceRenderingInfo rendering;
+    m_render.inheritance(image_idx, inheritance, rendering);
+    VkCommandBufferBeginInfo begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                 VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance,
+    };
+
+    std::vector<GraphicsStats> chunk_stats(chunks);
+    ThreadPool::global().parallel_for(
+        m_queue.size(), chunks, [&](size_t chunk, size_t begin, size_t end) {
+            PROFILE_ZONE("record chunk");
+            // The fence of the frame was waited, nothing uses the pool
+            assert(!vkResetCommandPool(m_device.device,
+                                       secondary.cmd_pools[chunk], 0));
+            VkCommandBuffer chunk_buf = secondary.cmd_bufs[chunk];
+            assert(!vkBeginCommandBuffer(chunk_buf, &begin_info));
+            record_draws(chunk_buf, begin, end, viewproj, chunk_stats[chunk]);
+            assert(!vkEndCommandBuffer(chunk_buf));
+        });
+
+    vkCmdExecuteCommands(cmd_buf, chunks, secondary.cmd_bufs.data());
+    for (auto &stats : chunk_stats) {
+        m_stats.draw_calls += stats.draw_calls;
+        m_stats.pipeline_binds += stats.pipeline_binds;
+        m_stats.buffer_binds += stats.buffer_binds;
+    }
+}
+
+GpuObject GraphicsEngine::gpu_object(uint32_t drawable) const {
+    const Drawable &d = m_drawables[drawable];
+    return GpuObject{
+        .sphere{m_bounds.x[drawable], m_bounds.y[drawable],
+                m_bounds.z[drawable], m_bounds.radius[drawable]},
+        .mesh = (uint32_t)d.mesh_hdl,
+        .batch = pipeline_id(d),
+    };
+}
+
+// The bounds and matrices of the objects that moved since the last frame,
+// copied before the culling. All of them go, like update_bounds() does.
+void GraphicsEngine::update_gpu_scene(VkCommandBuffer cmd_buf, size_t frame) {
+    PROFILE_ZONE("update gpu scene");
+    std::vector<GpuObject> objects(m_gpu_order.size());
+    std::vector<glm::mat4> models(m_gpu_order.size());
+    for (size_t i = 0; i < m_gpu_order.size(); i++) {
+        uint32_t j = m_gpu_order[i];
+        objects[i] = gpu_object(j);
+        models[i] = m_transforms.world[m_drawables[j].transform_hdl];
+    }
+    m_gpu_culling.record_update(cmd_buf, frame, objects, models);
+}
+
+void GraphicsEngine::upload_gpu_scene() {
+    // The draws of a pipeline are written to one region, so the objects are
+    // grouped by pipeline
+    std::vector<uint32_t> &order = m_gpu_order;
+    order.resize(m_drawables.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return pipeline_id(m_drawables[a]) < pipeline_id(m_drawables[b]);
+    });
+
+    std::vector<GpuObject> objects(order.size());
+    std::vector<glm::mat4> models(order.size());
+    std::vector<uint32_t> materials(order.size());
+    std::vector<GpuClusterItem> items;
+    for (size_t i = 0; i < order.size(); i++) {
+        uint32_t j = order[i];
+        const Drawable &d = m_drawables[j];
+        objects[i] = gpu_object(j);
+        models[i] = m_transforms.world[d.transform_hdl];
+        materials[i] = d.material_hdl;
+        if (m_config.cluster_culling) {
+            const GpuMesh &mesh = m_gpu_meshes[d.mesh_hdl];
+            for (size_t k = 0; k < m_meshes[d.mesh_hdl].meshlets.size(); k++) {
+                items.push_back(GpuClusterItem{
+                    .object = (uint32_t)i,
+                    .cluster = mesh.first_cluster + (uint32_t)k,
+                });
+            }
+        }
+    }
+
+    m_gpu_culling.set_scene(m_upload, objects, models, m_gpu_meshes,
+                            materials, m_gpu_clusters, items,
+                            m_pipelines.size());
+    m_upload.flush();
+}
+
+void GraphicsEngine::draw_gpu_culled(VkCommandBuffer cmd_buf,
+                                     const glm::mat4 &viewproj) {
+    size_t frame = m_frame_count % m_frames_in_flight;
+
+    m_geometry.bind(cmd_buf);
+    m_stats.buffer_binds++;
+    set_viewport(cmd_buf);
+
+    // The counts are only known once the frame is done, so the stats show the
+    // culling of the frame that last used this slot
+    if (m_frame_count >= m_frames_in_flight) {
+        m_stats.visible = m_gpu_culling.visible(frame);
+        m_stats.culled = m_gpu_culling.tested() - m_stats.visible;
+    }
+
+    VkDescriptorSet sets[]{m_gpu_culling.frames[frame].instance_set,
+                           m_bindless.set};
+    uint32_t set_count = m_config.bindless ? 2 : 1;
+    for (uint32_t batch = 0; batch < m_pipelines.size(); batch++) {
+        if (!m_gpu_culling.batch_size(batch)) {
+            continue;
+        }
+        const GraphicsPipeline &pipeline = m_pipelines.at(batch);
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeline.pipeline);
+        vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                pipeline.layout, 0, set_count, sets, 0,
+                                nullptr);
+        m_stats.pipeline_binds++;
+
+        m_gpu_culling.record_draw(cmd_buf, frame, batch);
+        m_stats.draw_calls++;
+    }
+}
+
+// Records the texture uploads that finished, and points the materials of
+// the textures that changed to their new bindless slot. The material table
+// is updated by the frame itself, after the frames in flight that read it.
+void GraphicsEngine::stream_textures(VkCommandBuffer cmd_buf) {
+    PROFILE_ZONE("stream textures");
+    m_residency.clear();
+    m_stream_wait = m_streamer.record(cmd_buf, m_residency);
+    if (m_residency.empty()) {
+        return;
+    }
+
+    VkMemoryBarrier read_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &read_barrier,
+                         0, nullptr, 0, nullptr);
+    for (const TextureResidency &residency : m_residency) {
+        for (auto [texture, material] : m_streamed_materials) {
+            if (texture != residency.texture) {
+                continue;
+            }
+            m_materials[material].texture = residency.bindless_index;
+            vkCmdUpdateBuffer(cmd_buf, m_material_buffer.buffer,
+                              material * sizeof(GpuMaterial) +
+                                  offsetof(GpuMaterial, texture),
+                              sizeof(uint32_t), &residency.bindless_index);
+        }
+    }
+    VkMemoryBarrier write_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1,
+                         &write_barrier, 0, nullptr, 0, nullptr);
+}
+
+// Grows the instance buffer of a frame whose fence has already been waited
+void GraphicsEngine::reserve_instances(FrameData *frame, size_t count) {
+    if (count <= frame->instance_capacity) {
+        return;
+    }
+    if (frame->instance_capacity) {
+        vmaDestroyBuffer(m_allocator, frame->instance_buffer.buffer,
+                         frame->instance_buffer.allocation);
+    }
+    // A multiple of 64 instances, so that the materials and meshes that
+    // follow the matrices are aligned for any minStorageBufferOffsetAlignment
+    // (at most 256)
+    frame->instance_capacity =
+        std::max({count, frame->instance_capacity * 2, size_t(1024)});
+    frame->instance_capacity = (frame->instance_capacity + 63) & ~size_t(63);
+    VkDeviceSize materials_offset =
+        frame->instance_capacity * sizeof(glm::mat4);
+    VkDeviceSize meshes_offset =
+        materials_offset + frame->instance_capacity * sizeof(uint32_t);
+
+    VkBufferCreateInfo buffer_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = meshes_offset + frame->instance_capacity * sizeof(uint32_t),
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    };
+    VmaAllocationCreateInfo allocation_info{
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+    };
+    VmaAllocationInfo info;
+    assert(!vmaCreateBuffer(m_allocator, &buffer_info, &allocation_info,
+                            &frame->instance_buffer.buffer,
+                            &frame->instance_buffer.allocation, &info));
+    frame->instances = static_cast<glm::mat4 *>(info.pMappedData);
+    frame->materials = reinterpret_cast<uint32_t *>(frame->instances +
+                                                    frame->instance_capacity);
+    frame->meshes = frame->materials + frame->instance_capacity;
+
+    VkDescriptorBufferInfo descriptor_buffers[]{
+        {
+            .buffer = frame->instance_buffer.buffer,
+            .offset = 0,
+            .range = materials_offset,
+        },
+        {
+            .buffer = frame->instance_buffer.buffer,
+            .offset = materials_offset,
+            .range = meshes_offset - materials_offset,
+        },
+        {
+            .buffer = frame->instance_buffer.buffer,
+            .offset = meshes_offset,
+            .range = VK_WHOLE_SIZE,
+        },
+        {
+            .buffer = m_mesh_buffer.buffer,
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        },
+    };
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = frame->descriptor_set,
+        .dstBinding = 0,
+        .descriptorCount = 4,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = descriptor_buffers,
+    };
+    vkUpdateDescriptorSets(m_device.device, 1, &write, 0, nullptr);
+}
+
+// Draws the same scene with 1 to N recording threads, and prints the
+// average record time of each
+void GraphicsEngine::run_record_bench() {
+    const size_t frames_per_step = 200;
+    size_t max_threads = std::max<size_t>(1, m_secondary[0].size());
+
+    printf("%8s %8s %12s %10s\n", "threads", "draws", "record (ms)",
+           "speedup");
+    double single_thread_ms = 0.;
+    for (size_t threads = 1; threads <= max_threads; threads++) {
+        m_config.record_threads = threads;
+
+        // Each frame in flight has its own buffers, warm them all up
+        for (size_t i = 0; i < m_frames_in_flight; i++) {
+            draw();
+        }
+        m_stats_total = {};
+        m_stats_frames = 0;
+
+        for (size_t i = 0; i < frames_per_step; i++) {
+            if (poll_quit()) {
+                return;
+            }
+            draw();
+        }
+
+        double record_ms = m_stats_total.record_ms / m_stats_frames;
+        if (threads == 1) {
+            single_thread_ms = record_ms;
+        }
+        printf("%8zu %8.0f %12.3f %10.2f\n", threads,
+               (double)m_stats_total.draw_calls / m_stats_frames, record_ms,
+               single_thread_ms / record_ms);
+    }
+    m_stats_total = {};
+    m_stats_frames = 0;
+}
+
+GraphicsBenchResult GraphicsEngine::bench(size_t warmup_frames,
+                                          size_t frames) {
+    for (size_t i = 0; i < warmup_frames; i++) {
+        draw();
+    }
+    m_stats_total = {};
+    m_stats_frames = 0;
+    m_frame_ms.clear();
+    m_record_ms.clear();
+    m_submit_ms.clear();
+    m_gpu_ms.clear();
+    m_latency_ms.clear();
+
+    for (size_t i = 0; i < frames && !poll_quit(); i++) {
+        draw();
+    }
+
+    // The timestamps of the last frames are read once they are done
+    for (size_t i = 0; i < m_frames_in_flight; i++) {
+        assert(!vkWaitForFences(m_device.device, 1, &m_commands[i].fence_render,
+                                true, one_second_ns));
+        double gpu_ms = m_profiler.collect(i);
+        if (gpu_ms >= 0.) {
+            m_gpu_ms.add(gpu_ms);
+        }
+    }
+    collect_latency();
+
+    VmaTotalStatistics memory;
+    vmaCalculateStatistics(m_allocator, &memory);
+
+    size_t measured = std::max<size_t>(1, m_stats_frames);
+    GraphicsBenchResult out{
+        .draw_calls = (double)m_stats_total.draw_calls / measured,
+        .pipeline_binds = (double)m_stats_total.pipeline_binds / measured,
+        .visible = (double)m_stats_total.visible / measured,
+        .gpu_culling = m_config.gpu_culling,
+        .frame_ms = m_frame_ms.summary(),
+        .record_ms = m_record_ms.summary(),
+        .submit_ms = m_submit_ms.summary(),
+        .gpu_ms = m_gpu_ms.summary(),
+        .latency_ms = m_latency_ms.summary(),
+        .allocated_bytes = memory.total.statistics.allocationBytes,
+        .block_bytes = memory.total.statistics.blockBytes,
+    };
+    m_stats_total = {};
+    m_stats_frames = 0;
+    return out;
+}
+
+// Saves the readback of an offscreen image, if it has one that was not saved
+// yet. The fence of its frame has to be waited.
+void GraphicsEngine::save_capture(size_t image) {
+    if (!m_pending_capture[image]) {
+        return;
+    }
+    PROFILE_ZONE("save capture");
+    char path[512];
+    snprintf(path, sizeof(path), "%s%05zu.ppm",
+             m_config.capture_prefix.c_str(), m_pending_capture[image] - 1);
+    if (!m_offscreen.write_ppm(image, path)) {
+        printf("Could not write the capture %s\n", path);
+    }
+    m_pending_capture[image] = 0;
+}
+
+void GraphicsEngine::print_stats() {
+    if (!m_stats_frames) {
+        return;
+    }
+    printf(
+        "%zu fps | %.1f visible, %.1f culled | %.1f draws, %.1f pipeline "
+        "binds, %.1f buffer binds, record %.3f ms\n",
+        m_stats_frames, (double)m_stats_total.visible / m_stats_frames,
+        (double)m_stats_total.culled / m_stats_frames,
+        (double)m_stats_total.draw_calls / m_stats_frames,
+        (double)m_stats_total.pipeline_binds / m_stats_frames,
+        (double)m_stats_total.buffer_binds / m_stats_frames,
+        m_stats_total.record_ms / m_stats_frames);
+
+    // Over the last frames, not only the last second
+    auto print_summary = [](const char *name, const RollingStats &stats) {
+        RollingStats::Summary s = stats.summary();
+        if (s.count) {
+            printf("  %-7s min %7.3f ms, avg %7.3f ms, p99 %7.3f ms\n", name,
+                   s.min, s.avg, s.p99);
+        }
+    };
+    print_summary("frame", m_frame_ms);
+    print_summary("record", m_record_ms);
+    print_summary("submit", m_submit_ms);
+    print_summary("gpu", m_gpu_ms);
+    print_summary("latency", m_latency_ms);
+
+    m_stats_total = {};
+    m_stats_frames = 0;
 }
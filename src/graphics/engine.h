@@ -5,30 +5,172 @@
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan_core.h>
 
+#include <chrono>
+#include <string>
 #include <vector>
 
 #include "application.h"
+#include "bindless.h"
 #include "command.h"
+#include "cull.h"
+#include "descriptor.h"
 #include "device.h"
 #include "drawable.h"
+#include "geometry.h"
+#include "gpucull.h"
+#include "offscreen.h"
 #include "pipeline.h"
+#include "pipelinecache.h"
+#include "profiler.h"
 #include "render.h"
+#include "renderqueue.h"
+#include "streaming.h"
 #include "swapchain.h"
+#include "transform.h"
+#include "upload.h"
 #include "utils.h"
 
-constexpr uint32_t FRAME_OVERLAP = 2;
+// Frames the cpu can record ahead of the gpu, at most
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+struct GraphicsEngineConfig {
+    // Draw the drawables that share mesh and material with a single
+    // instanced draw, instead of one draw each
+    bool instancing = true;
+    // Skip the drawables whose bounding sphere is outside of the frustum
+    bool culling = true;
+    // Cull with a compute shader and draw with one indirect draw per
+    // pipeline, the cpu culling and instancing are not used
+    bool gpu_culling = false;
+    // Sort the draws by state and depth every frame, instead of drawing them
+    // in the order of m_drawables
+    bool sort_queue = true;
+    // Shuffle the drawables once created, to measure the sorting
+    bool shuffle = false;
+    // Threads recording the draws into secondary command buffers, with 1 the
+    // main thread records them inline
+    uint32_t record_threads = 1;
+    // Record the scene with 1 to N threads and print the record times
+    bool record_bench = false;
+    // The scene has grid_size * grid_size triangles, plus a monkey
+    uint32_t grid_size = 50;
+    // Render to offscreen images, without SDL, a surface nor a swapchain
+    bool headless = false;
+    // Frames drawn by run(), 0 draws until the window is closed
+    size_t frame_count = 0;
+    // Saves every headless frame to <capture_prefix><frame>.ppm, when set
+    std::string capture_prefix;
+    // Record the cpu zones and gpu timestamps of every frame
+    bool profile = true;
+    // Writes the buffered zones as a Chrome trace when run() returns, when set
+    std::string trace_path;
+    // When set, the scene is a grid of drawable_count spheres of about
+    // mesh_triangles triangles, spread over mesh_count meshes and
+    // material_count materials, instead of the triangles and the monkey.
+    // The materials cycle through pipeline_count distinct pipeline states,
+    // which draw the same image.
+    size_t drawable_count = 0;
+    uint32_t mesh_count = 1;
+    uint32_t material_count = 1;
+    uint32_t pipeline_count = 1;
+    uint32_t mesh_triangles = 80;
+    // Pipeline cache loaded at startup and saved when quitting, empty keeps
+    // it in memory only
+    std::string pipeline_cache_path = "pipeline.cache";
+    // Preferred present mode, the swapchain falls back to a supported one
+    VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    // Frames recorded ahead of the gpu, 1 to MAX_FRAMES_IN_FLIGHT
+    uint32_t frames_in_flight = 2;
+    // Swapchain images, 0 lets the swapchain pick one more than the minimum
+    uint32_t swapchain_images = 0;
+    // Wait for the previous frame right before sampling the input, so that
+    // the input of a frame is as recent as possible when it is presented
+    bool low_latency = false;
+    // Render with vkCmdBeginRendering instead of a render pass and
+    // framebuffers, when the device supports it
+    bool dynamic_rendering = false;
+    // Bind the textures and material parameters once through a global
+    // descriptor set indexed by the shaders, so that the materials can share
+    // one pipeline, when the device supports descriptor indexing
+    bool bindless = true;
+    // Stream the textures from the files baked by texbake, in the first
+    // block compressed format the device samples, instead of decoding the
+    // PNGs
+    bool compressed_textures = true;
+    // Store the loaded and generated meshes as QuantizedVertex instead of
+    // Vertex
+    bool quantized_vertices = true;
+    // With the gpu culling, split the meshes into meshlets and cull each
+    // against the frustum and its normal cone, one draw per visible meshlet
+    bool cluster_culling = false;
+};
+
+struct GraphicsStats {
+    uint32_t draw_calls;
+    uint32_t pipeline_binds;
+    // Vertex and index buffer binds
+    uint32_t buffer_binds;
+    uint32_t visible;
+    uint32_t culled;
+    double record_ms;
+};
+
+// Per frame averages and timings of GraphicsEngine::bench()
+struct GraphicsBenchResult {
+    double draw_calls;
+    double pipeline_binds;
+    double visible;
+    // Whether the gpu culling path ran, it falls back to the cpu when it is
+    // not supported
+    bool gpu_culling;
+    RollingStats::Summary frame_ms;
+    RollingStats::Summary record_ms;
+    RollingStats::Summary submit_ms;
+    RollingStats::Summary gpu_ms;
+    RollingStats::Summary latency_ms;
+    // Bytes of the live VMA allocations, and of the device memory blocks
+    // that hold them
+    uint64_t allocated_bytes;
+    uint64_t block_bytes;
+};
+
+// Swapchain replaced by a resize, destroyed once the frames before `frame`
+// are done
+struct RetiredSwapchain {
+    GraphicsSwapchain swapchain;
+    std::vector<VkFramebuffer> framebuffers;
+    size_t frame;
+};
+
+// Per frame in flight data, written by the cpu every frame
+struct FrameData {
+    AllocatedBuffer instance_buffer;
+    // viewproj * model of every instance
+    glm::mat4* instances;
+    // Material and mesh of every instance, after the matrices in the same
+    // buffer
+    uint32_t* materials;
+    uint32_t* meshes;
+    size_t instance_capacity;
+    VkDescriptorSet descriptor_set;
+};
 
 class GraphicsEngine {
    public:
     const uint32_t vk_version = VK_API_VERSION_1_3;
 
-    GraphicsEngine();
+    GraphicsEngine(GraphicsEngineConfig config = {});
     ~GraphicsEngine();
     void draw();
     void run();
+    // Draws the warmup frames, then measures the next frames (at most 512)
+    GraphicsBenchResult bench(size_t warmup_frames, size_t frames);
 
    private:
+    GraphicsEngineConfig m_config;
     size_t m_frame_count{0};
+    // config.frames_in_flight, clamped
+    uint32_t m_frames_in_flight;
 
     VkExtent2D m_window_extent{1280, 720};
     struct SDL_Window* m_window{nullptr};
@@ -39,17 +181,135 @@ class GraphicsEngine {
     GraphicsDevice m_device;
     uint32_t m_qfamily_graphics{uint32_t(~0)};
     VkQueue m_q_graphics;
+    // A dedicated transfer queue when the device has one, the graphics queue
+    // otherwise
+    uint32_t m_qfamily_transfer{uint32_t(~0)};
+    VkQueue m_q_transfer;
 
     VmaAllocator m_allocator;
+    GraphicsUpload m_upload;
+    GraphicsGeometry m_geometry;
 
     GraphicsSwapchain m_swapchain;
+    GraphicsOffscreen m_offscreen;
     GraphicsRender m_render;
 
-    GraphicsCommand m_commands[FRAME_OVERLAP];
+    GraphicsCommand m_commands[MAX_FRAMES_IN_FLIGHT];
+    GraphicsSecondaryCommands m_secondary[MAX_FRAMES_IN_FLIGHT];
+    FrameData m_frames[MAX_FRAMES_IN_FLIGHT];
+
+    GraphicsDescriptorPool m_descriptor_pool;
+    VkDescriptorSetLayout m_instance_layout;
+    GraphicsGpuCulling m_gpu_culling;
 
     std::vector<Drawable> m_drawables;
     std::vector<GraphicsPipeline> m_pipelines;
     std::vector<Mesh> m_meshes;
+    // GpuMesh of every mesh, which the quantized vertex shader reads the
+    // bounds from
+    std::vector<GpuMesh> m_gpu_meshes;
+    // Meshlets of every mesh, from GpuMesh::first_cluster on
+    std::vector<GpuCluster> m_gpu_clusters;
+    // Drawable of every gpu culled object, grouped by pipeline
+    std::vector<uint32_t> m_gpu_order;
+    AllocatedBuffer m_mesh_buffer;
+
+    GraphicsBindless m_bindless;
+    // Parameters of every material, indexed by Handle. Uploaded once
+    // the scene is created, as the first buffer of m_bindless
+    std::vector<GpuMaterial> m_materials;
+    AllocatedBuffer m_material_buffer;
+    GraphicsTextureStreamer m_streamer;
+    // Streamed texture and the material that samples it
+    std::vector<std::pair<uint32_t, Handle>> m_streamed_materials;
+    std::vector<TextureResidency> m_residency;
+    // Transfer semaphore value the frame being recorded waits for, 0 if none
+    uint64_t m_stream_wait;
+
+    // World space bounds of the drawables, indexed like m_drawables
+    BoundsSoA m_bounds;
+    // Drawables that survived culling this frame
+    std::vector<uint32_t> m_visible;
+    // The visible drawables in draw order
+    RenderQueue m_queue;
+    Transforms m_transforms;
+    // Transforms of the queued drawables, in queue order
+    std::vector<uint32_t> m_instance_transforms;
+
+    GraphicsStats m_stats;
+    GraphicsStats m_stats_total;
+    size_t m_stats_frames;
+    // Frame number + 1 of the readback waiting in each offscreen image
+    size_t m_pending_capture[MAX_FRAMES_IN_FLIGHT];
+
+    GraphicsProfiler m_profiler;
+    // Milliseconds between two draw() calls, recording, submitting, and on
+    // the gpu
+    RollingStats m_frame_ms;
+    RollingStats m_record_ms;
+    RollingStats m_submit_ms;
+    RollingStats m_gpu_ms;
+    std::chrono::steady_clock::time_point m_last_frame;
+    // Milliseconds between sampling the input of a frame and the end of its
+    // gpu work, observed by polling the fences of the frames in flight
+    RollingStats m_latency_ms;
+    std::chrono::steady_clock::time_point m_last_input;
+    std::chrono::steady_clock::time_point m_frame_input[MAX_FRAMES_IN_FLIGHT];
+    bool m_latency_pending[MAX_FRAMES_IN_FLIGHT];
+
+    GraphicsPipelineCache m_pipeline_cache;
+    // Owns the pipelines of m_pipelines, identical materials share one
+    GraphicsPipelineRegistry m_pipeline_registry;
+    // Pipelines being compiled, they are moved to m_pipelines once done
+    GraphicsPipelineBatch m_pipeline_batch;
+    // Every material has one pipeline per vertex format, m_pipelines holds
+    // the pipelines of material m at m * vertex_format_count + format.
+    // Index of the first of them with the same pipeline, per pipeline.
+    std::vector<uint32_t> m_pipeline_ids;
+
+    // The window was resized, or the swapchain reported it is out of date
+    bool m_swapchain_dirty;
+    std::vector<RetiredSwapchain> m_retired_swapchains;
+    // Time to create the scene, which waits for its pipelines
+    double m_pipeline_ms;
 
     GraphicsCommand* get_current_command();
+    FrameData* get_current_frame();
+    void update_bounds();
+    void create_grid_scene();
+    void create_synthetic_scene();
+    Handle add_material(const uint32_t* fragment, size_t fragment_size,
+                        GpuMaterial material = {
+                            .color{1.f},
+                            .texture = GraphicsBindless::none,
+                            .uv_scale = 1.f,
+                        },
+                        uint32_t state = 0);
+    Handle add_streamed_material(const char* path, float uv_scale);
+    void upload_materials();
+    void upload_meshes();
+    void stream_textures(VkCommandBuffer cmd_buf);
+    void update_pipeline_ids();
+    uint32_t pipeline_id(const Drawable& drawable) const;
+    bool recreate_swapchain();
+    void destroy_retired_swapchains(bool all);
+    void set_viewport(VkCommandBuffer cmd_buf);
+    void record_frame(VkCommandBuffer cmd_buf, uint32_t image_idx);
+    void cull(const glm::mat4& viewproj);
+    void prepare_draws(const glm::mat4& viewproj);
+    void record_draws(VkCommandBuffer cmd_buf, size_t begin, size_t end,
+                      const glm::mat4& viewproj, GraphicsStats& stats);
+    void record_parallel(VkCommandBuffer cmd_buf, uint32_t image_idx,
+                         const glm::mat4& viewproj);
+    GpuObject gpu_object(uint32_t drawable) const;
+    void upload_gpu_scene();
+    void update_gpu_scene(VkCommandBuffer cmd_buf, size_t frame);
+    void draw_gpu_culled(VkCommandBuffer cmd_buf, const glm::mat4& viewproj);
+    void reserve_instances(FrameData* frame, size_t count);
+    void wait_previous_frame();
+    void collect_latency();
+    bool poll_quit();
+    void run_record_bench();
+    void save_capture(size_t image);
+    void print_stats();
 };
@@ -0,0 +1,126 @@
+#include "geometry.h"
+
+#include <cstdio>
+
+RangeAllocator::RangeAllocator(VkDeviceSize capacity)
+    : capacity(capacity), used(0), m_free() {
+    if (capacity) {
+        m_free.emplace(0, capacity);
+    }
+}
+
+std::optional<VkDeviceSize> RangeAllocator::allocate(VkDeviceSize size,
+                                                     VkDeviceSize alignment) {
+    for (auto it = m_free.begin(); it != m_free.end(); it++) {
+        VkDeviceSize begin = it->first;
+        VkDeviceSize end = it->first + it->second;
+        VkDeviceSize offset = (begin + alignment - 1) / alignment * alignment;
+        if (offset + size > end) {
+            continue;
+        }
+
+        // Keep the alignment padding and the tail as free ranges
+        m_free.erase(it);
+        if (offset > begin) {
+            m_free.emplace(begin, offset - begin);
+        }
+        if (offset + size < end) {
+            m_free.emplace(offset + size, end - offset - size);
+        }
+        used += size;
+        return offset;
+    }
+    return std::optional<VkDeviceSize>{};
+}
+
+void RangeAllocator::free(VkDeviceSize offset, VkDeviceSize size) {
+    if (!size) {
+        return;
+    }
+    used -= size;
+
+    auto it = m_free.emplace(offset, size).first;
+
+    auto next = std::next(it);
+    if (next != m_free.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        m_free.erase(next);
+    }
+
+    if (it != m_free.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second == it->first) {
+            prev->second += it->second;
+            m_free.erase(it);
+        }
+    }
+}
+
+GraphicsGeometryBuilder* GraphicsGeometryBuilder::set_vertex_capacity(
+    VkDeviceSize bytes) {
+    m_vertex_capacity = bytes;
+    return this;
+}
+
+GraphicsGeometryBuilder* GraphicsGeometryBuilder::set_index_capacity(
+    VkDeviceSize bytes) {
+    m_index_capacity = bytes;
+    return this;
+}
+
+GraphicsGeometry GraphicsGeometryBuilder::build() {
+    GraphicsGeometry out{};
+    out.m_allocator = m_upload.allocator;
+
+    out.vertex_buffer = m_upload.create_buffer(
+        m_vertex_capacity, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    out.index_buffer = m_upload.create_buffer(m_index_capacity,
+                                              VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    out.vertex_ranges = RangeAllocator(m_vertex_capacity);
+    out.index_ranges = RangeAllocator(m_index_capacity);
+
+    return out;
+}
+
+std::optional<GeometryAllocation> GraphicsGeometry::allocate(
+    VkDeviceSize vertex_size, VkDeviceSize vertex_alignment,
+    VkDeviceSize index_size) {
+    auto vertex_offset = vertex_ranges.allocate(vertex_size, vertex_alignment);
+    if (!vertex_offset) {
+        printf("geometry: out of vertex memory (%llu bytes requested)\n",
+               (unsigned long long)vertex_size);
+        return std::optional<GeometryAllocation>{};
+    }
+
+    auto index_offset = index_ranges.allocate(index_size, sizeof(uint32_t));
+    if (!index_offset) {
+        printf("geometry: out of index memory (%llu bytes requested)\n",
+               (unsigned long long)index_size);
+        vertex_ranges.free(vertex_offset.value(), vertex_size);
+        return std::optional<GeometryAllocation>{};
+    }
+
+    return GeometryAllocation{
+        .vertex_offset = vertex_offset.value(),
+        .vertex_size = vertex_size,
+        .index_offset = index_offset.value(),
+        .index_size = index_size,
+    };
+}
+
+void GraphicsGeometry::free(GeometryAllocation allocation) {
+    vertex_ranges.free(allocation.vertex_offset, allocation.vertex_size);
+    index_ranges.free(allocation.index_offset, allocation.index_size);
+}
+
+void GraphicsGeometry::bind(VkCommandBuffer cmd_buf) {
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd_buf, 0, 1, &vertex_buffer.buffer, &offset);
+    vkCmdBindIndexBuffer(cmd_buf, index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void GraphicsGeometry::destroy() {
+    vmaDestroyBuffer(m_allocator, index_buffer.buffer, index_buffer.allocation);
+    vmaDestroyBuffer(m_allocator, vertex_buffer.buffer,
+                     vertex_buffer.allocation);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <optional>
+
+#include "upload.h"
+#include "utils.h"
+
+// First-fit free list over [0, capacity), adjacent free ranges are merged
+// back together on free()
+class RangeAllocator {
+   public:
+    VkDeviceSize capacity;
+    VkDeviceSize used;
+
+    std::optional<VkDeviceSize> allocate(VkDeviceSize size,
+                                         VkDeviceSize alignment);
+    void free(VkDeviceSize offset, VkDeviceSize size);
+
+    RangeAllocator(VkDeviceSize capacity = 0);
+
+   private:
+    // offset -> size
+    std::map<VkDeviceSize, VkDeviceSize> m_free;
+};
+
+// Byte ranges of a mesh inside the shared geometry buffers
+struct GeometryAllocation {
+    VkDeviceSize vertex_offset;
+    VkDeviceSize vertex_size;
+    VkDeviceSize index_offset;
+    VkDeviceSize index_size;
+};
+
+// One vertex buffer and one index buffer that every mesh is sub-allocated
+// from, so that the whole frame binds its geometry once
+class GraphicsGeometry {
+   public:
+    AllocatedBuffer vertex_buffer;
+    AllocatedBuffer index_buffer;
+    RangeAllocator vertex_ranges;
+    RangeAllocator index_ranges;
+
+    std::optional<GeometryAllocation> allocate(VkDeviceSize vertex_size,
+                                               VkDeviceSize vertex_alignment,
+                                               VkDeviceSize index_size);
+    void free(GeometryAllocation allocation);
+    void bind(VkCommandBuffer cmd_buf);
+    void destroy();
+
+   private:
+    VmaAllocator m_allocator;
+
+    friend class GraphicsGeometryBuilder;
+};
+
+class GraphicsGeometryBuilder {
+   public:
+    GraphicsGeometryBuilder(GraphicsUpload& upload)
+        : m_upload(upload),
+          m_vertex_capacity(128 << 20),
+          m_index_capacity(64 << 20){};
+
+    GraphicsGeometryBuilder* set_vertex_capacity(VkDeviceSize bytes);
+    GraphicsGeometryBuilder* set_index_capacity(VkDeviceSize bytes);
+    GraphicsGeometry build();
+
+   private:
+    GraphicsUpload& m_upload;
+    VkDeviceSize m_vertex_capacity;
+    VkDeviceSize m_index_capacity;
+};
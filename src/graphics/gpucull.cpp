@@ -0,0 +1,482 @@
+#include "gpucull.h"
+
+#include <src/shaders/cluster_cull.comp.h>
+#include <src/shaders/cull.comp.h>
+
+#include <algorithm>
+#include <cstring>
+#include <glm/glm.hpp>
+
+const uint32_t cull_group_size = 64;
+
+// Matches the push constant block of cull.comp
+struct CullPushConstants {
+    glm::mat4 viewproj;
+    uint32_t object_count;
+};
+
+// Matches the push constant block of cluster_cull.comp
+struct ClusterCullPushConstants {
+    glm::mat4 viewproj;
+    glm::vec4 camera;
+    uint32_t item_count;
+};
+
+GraphicsGpuCullingBuilder* GraphicsGpuCullingBuilder::set_pipeline_cache(
+    VkPipelineCache cache) {
+    m_pipeline_cache = cache;
+    return this;
+}
+
+GraphicsGpuCullingBuilder* GraphicsGpuCullingBuilder::set_registry(
+    GraphicsPipelineRegistry* registry) {
+    m_registry = registry;
+    return this;
+}
+
+GraphicsGpuCullingBuilder* GraphicsGpuCullingBuilder::set_cluster_culling(
+    bool enabled) {
+    m_clusters_enabled = enabled;
+    return this;
+}
+
+GraphicsGpuCulling GraphicsGpuCullingBuilder::build() {
+    GraphicsGpuCulling out{};
+    out.m_device = m_device;
+    out.m_allocator = m_allocator;
+    out.m_cluster_culling = m_clusters_enabled;
+    out.m_shared_layout = m_registry != nullptr;
+
+    out.m_cull_layout =
+        GraphicsDescriptorLayoutBuilder(m_device)
+            .set_registry(m_registry)
+            ->add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->add_binding(9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                          VK_SHADER_STAGE_COMPUTE_BIT)
+            ->build();
+
+    // Ten buffers per culling set, plus the four of the instance set of
+    // every frame
+    out.m_descriptor_pool =
+        GraphicsDescriptorPoolBuilder(m_device)
+            .add_size(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 14 * m_frame_count)
+            ->set_max_sets(2 * m_frame_count)
+            ->build();
+
+    out.frames.resize(m_frame_count);
+    for (auto &frame : out.frames) {
+        frame.descriptor_set = out.m_descriptor_pool.allocate(out.m_cull_layout);
+        frame.instance_set = out.m_descriptor_pool.allocate(m_instance_layout);
+    }
+
+    GraphicsComputePipelineBuilder pipeline_builder(m_device);
+    if (m_clusters_enabled) {
+        pipeline_builder.set_shader(cluster_cull_comp,
+                                    sizeof(cluster_cull_comp))
+            ->add_push_constant_range({
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(ClusterCullPushConstants),
+            });
+    } else {
+        pipeline_builder.set_shader(cull_comp, sizeof(cull_comp))
+            ->add_push_constant_range({
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(CullPushConstants),
+            });
+    }
+    out.pipeline = pipeline_builder.add_descriptor_set_layout(out.m_cull_layout)
+                       ->set_pipeline_cache(m_pipeline_cache)
+                       ->build();
+
+    return out;
+}
+
+void GraphicsGpuCulling::set_scene(GraphicsUpload &upload,
+                                   std::span<const GpuObject> objects,
+                                   std::span<const glm::mat4> models,
+                                   std::span<const GpuMesh> meshes,
+                                   std::span<const uint32_t> materials,
+                                   std::span<const GpuCluster> clusters,
+                                   std::span<const GpuClusterItem> items,
+                                   uint32_t batch_count) {
+    assert(objects.size() == models.size());
+    assert(objects.size() == materials.size());
+    destroy_scene();
+    if (!m_cluster_culling) {
+        clusters = {};
+        items = {};
+    }
+
+    m_object_count = objects.size();
+    // Every object, or every cluster, gets a draw slot in its batch
+    m_tested = m_cluster_culling ? items.size() : objects.size();
+    m_batch_first.assign(batch_count, 0);
+    m_batch_size.assign(batch_count, 0);
+    for (size_t i = 0; i < m_tested; i++) {
+        uint32_t batch =
+            objects[m_cluster_culling ? items[i].object : i].batch;
+        if (!m_batch_size[batch]) {
+            m_batch_first[batch] = i;
+        }
+        m_batch_size[batch]++;
+    }
+
+    // Empty buffers are not allowed, an empty scene keeps one unused element
+    size_t object_capacity = std::max<size_t>(objects.size(), 1);
+    size_t mesh_capacity = std::max<size_t>(meshes.size(), 1);
+    size_t batch_capacity = std::max<size_t>(batch_count, 1);
+    size_t draw_capacity = std::max<size_t>(m_tested, 1);
+    size_t cluster_capacity = std::max<size_t>(clusters.size(), 1);
+
+    m_objects = upload.create_buffer(object_capacity * sizeof(GpuObject),
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_objects, 0, objects.data(), objects.size_bytes());
+    m_models = upload.create_buffer(object_capacity * sizeof(glm::mat4),
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_models, 0, models.data(), models.size_bytes());
+    m_meshes = upload.create_buffer(mesh_capacity * sizeof(GpuMesh),
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_meshes, 0, meshes.data(), meshes.size_bytes());
+    m_batches = upload.create_buffer(batch_capacity * sizeof(uint32_t),
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_batches, 0, m_batch_first.data(),
+                 m_batch_first.size() * sizeof(uint32_t));
+    m_materials = upload.create_buffer(object_capacity * sizeof(uint32_t),
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_materials, 0, materials.data(), materials.size_bytes());
+    std::vector<uint32_t> object_meshes(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        object_meshes[i] = objects[i].mesh;
+    }
+    m_object_meshes = upload.create_buffer(object_capacity * sizeof(uint32_t),
+                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_object_meshes, 0, object_meshes.data(),
+                 object_meshes.size() * sizeof(uint32_t));
+    m_clusters = upload.create_buffer(cluster_capacity * sizeof(GpuCluster),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_clusters, 0, clusters.data(), clusters.size_bytes());
+    m_items = upload.create_buffer(draw_capacity * sizeof(GpuClusterItem),
+                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_items, 0, items.data(), items.size_bytes());
+    // The normal cones are tested in model space, against the camera moved
+    // there by the inverse of the object
+    std::vector<glm::mat4> inverse_models;
+    if (m_cluster_culling) {
+        inverse_models.resize(models.size());
+        for (size_t i = 0; i < models.size(); i++) {
+            inverse_models[i] = glm::inverse(models[i]);
+        }
+    }
+    m_inverse_models = upload.create_buffer(
+        std::max<size_t>(inverse_models.size(), 1) * sizeof(glm::mat4),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    upload.write(m_inverse_models, 0, inverse_models.data(),
+                 inverse_models.size() * sizeof(glm::mat4));
+
+    for (auto &frame : frames) {
+        // Only written and read by the gpu
+        VkBufferCreateInfo draws_info{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = draw_capacity * sizeof(VkDrawIndexedIndirectCommand),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        };
+        VmaAllocationCreateInfo draws_allocation{
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+        };
+        assert(!vmaCreateBuffer(m_allocator, &draws_info, &draws_allocation,
+                                &frame.draws.buffer, &frame.draws.allocation,
+                                nullptr));
+
+        // A handful of counters, kept host visible so that the cpu can read
+        // the visible count once the frame is done
+        VkBufferCreateInfo counts_info{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = batch_capacity * sizeof(uint32_t),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        };
+        VmaAllocationCreateInfo counts_allocation{
+            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                     VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            .usage = VMA_MEMORY_USAGE_AUTO,
+        };
+        VmaAllocationInfo info;
+        assert(!vmaCreateBuffer(m_allocator, &counts_info, &counts_allocation,
+                                &frame.counts.buffer, &frame.counts.allocation,
+                                &info));
+        frame.mapped_counts = static_cast<const uint32_t *>(info.pMappedData);
+
+        VkBufferCreateInfo instances_info{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = object_capacity * sizeof(glm::mat4),
+            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        };
+        assert(!vmaCreateBuffer(m_allocator, &instances_info, &draws_allocation,
+                                &frame.instances.buffer,
+                                &frame.instances.allocation, nullptr));
+
+        // Only written by the cpu, once the fence of the frame was waited
+        VkBufferCreateInfo staging_info{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = object_capacity *
+                    (sizeof(GpuObject) + 2 * sizeof(glm::mat4)),
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        };
+        VmaAllocationCreateInfo staging_allocation{
+            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                     VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            .usage = VMA_MEMORY_USAGE_AUTO,
+        };
+        assert(!vmaCreateBuffer(m_allocator, &staging_info,
+                                &staging_allocation, &frame.staging.buffer,
+                                &frame.staging.allocation, &info));
+        frame.mapped_staging = static_cast<char *>(info.pMappedData);
+
+        VkDescriptorBufferInfo buffers[]{
+            {.buffer = m_objects.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_meshes.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_batches.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = frame.draws.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = frame.counts.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_models.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = frame.instances.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_materials.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_object_meshes.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_meshes.buffer, .range = VK_WHOLE_SIZE},
+        };
+        VkDescriptorBufferInfo cluster_buffers[]{
+            {.buffer = m_clusters.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_items.buffer, .range = VK_WHOLE_SIZE},
+            {.buffer = m_inverse_models.buffer, .range = VK_WHOLE_SIZE},
+        };
+        VkWriteDescriptorSet writes[]{
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = frame.descriptor_set,
+                .dstBinding = 0,
+                .descriptorCount = 7,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = buffers,
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = frame.descriptor_set,
+                .dstBinding = 7,
+                .descriptorCount = 3,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = cluster_buffers,
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = frame.instance_set,
+                .dstBinding = 0,
+                .descriptorCount = 4,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &buffers[6],
+            },
+        };
+        vkUpdateDescriptorSets(m_device, 3, writes, 0, nullptr);
+    }
+}
+
+void GraphicsGpuCulling::record_update(VkCommandBuffer cmd_buf, size_t frame,
+                                       std::span<const GpuObject> objects,
+                                       std::span<const glm::mat4> models) {
+    assert(objects.size() == m_object_count);
+    assert(models.size() == m_object_count);
+    if (!m_object_count) {
+        return;
+    }
+    GpuCullFrame &f = frames.at(frame);
+
+    VkBufferCopy regions[3];
+    uint32_t region_count = 0;
+    VkDeviceSize offset = 0;
+    auto stage = [&](const void *data, size_t size) {
+        memcpy(f.mapped_staging + offset, data, size);
+        regions[region_count++] = {.srcOffset = offset, .size = size};
+        offset += size;
+    };
+    stage(objects.data(), objects.size_bytes());
+    stage(models.data(), models.size_bytes());
+    if (m_cluster_culling) {
+        auto *inverses =
+            reinterpret_cast<glm::mat4 *>(f.mapped_staging + offset);
+        for (size_t i = 0; i < models.size(); i++) {
+            inverses[i] = glm::inverse(models[i]);
+        }
+        regions[region_count++] = {.srcOffset = offset,
+                                   .size = models.size_bytes()};
+        offset += models.size_bytes();
+    }
+    vmaFlushAllocation(m_allocator, f.staging.allocation, 0, offset);
+
+    // The culling of the previous frames may still read the buffers
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 0, nullptr);
+    AllocatedBuffer *targets[]{&m_objects, &m_models, &m_inverse_models};
+    for (uint32_t i = 0; i < region_count; i++) {
+        vkCmdCopyBuffer(cmd_buf, f.staging.buffer, targets[i]->buffer, 1,
+                        &regions[i]);
+    }
+    VkMemoryBarrier copy_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &copy_barrier, 0, nullptr, 0, nullptr);
+}
+
+void GraphicsGpuCulling::record_cull(VkCommandBuffer cmd_buf, size_t frame,
+                                     const glm::mat4 &viewproj,
+                                     const glm::vec3 &camera) {
+    GpuCullFrame &f = frames.at(frame);
+
+    vkCmdFillBuffer(cmd_buf, f.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier clear_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &clear_barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline.pipeline);
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline.layout, 0, 1, &f.descriptor_set, 0,
+                            nullptr);
+    if (m_cluster_culling) {
+        ClusterCullPushConstants constants{
+            .viewproj = viewproj,
+            .camera = glm::vec4(camera, 1.f),
+            .item_count = m_tested,
+        };
+        vkCmdPushConstants(cmd_buf, pipeline.layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                           &constants);
+    } else {
+        CullPushConstants constants{
+            .viewproj = viewproj,
+            .object_count = m_tested,
+        };
+        vkCmdPushConstants(cmd_buf, pipeline.layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                           &constants);
+    }
+    vkCmdDispatch(cmd_buf, (m_tested + cull_group_size - 1) / cull_group_size,
+                  1, 1);
+
+    // The counts are also made visible to the host, for visible()
+    VkMemoryBarrier cull_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                         VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                             VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &cull_barrier, 0, nullptr, 0, nullptr);
+}
+
+void GraphicsGpuCulling::record_draw(VkCommandBuffer cmd_buf, size_t frame,
+                                     uint32_t batch) {
+    const GpuCullFrame &f = frames.at(frame);
+    vkCmdDrawIndexedIndirectCount(
+        cmd_buf, f.draws.buffer,
+        m_batch_first.at(batch) * sizeof(VkDrawIndexedIndirectCommand),
+        f.counts.buffer, batch * sizeof(uint32_t), m_batch_size.at(batch),
+        sizeof(VkDrawIndexedIndirectCommand));
+}
+
+uint32_t GraphicsGpuCulling::visible(size_t frame) {
+    const GpuCullFrame &f = frames.at(frame);
+    vmaInvalidateAllocation(m_allocator, f.counts.allocation, 0,
+                            VK_WHOLE_SIZE);
+
+    uint32_t out = 0;
+    for (size_t i = 0; i < m_batch_size.size(); i++) {
+        out += f.mapped_counts[i];
+    }
+    return out;
+}
+
+void GraphicsGpuCulling::destroy_scene() {
+    if (!m_objects.buffer) {
+        return;
+    }
+    for (auto &frame : frames) {
+        vmaDestroyBuffer(m_allocator, frame.draws.buffer,
+                         frame.draws.allocation);
+        vmaDestroyBuffer(m_allocator, frame.counts.buffer,
+                         frame.counts.allocation);
+        vmaDestroyBuffer(m_allocator, frame.instances.buffer,
+                         frame.instances.allocation);
+        vmaDestroyBuffer(m_allocator, frame.staging.buffer,
+                         frame.staging.allocation);
+        frame.draws = {};
+        frame.counts = {};
+        frame.instances = {};
+        frame.staging = {};
+        frame.mapped_counts = nullptr;
+        frame.mapped_staging = nullptr;
+    }
+    vmaDestroyBuffer(m_allocator, m_objects.buffer, m_objects.allocation);
+    vmaDestroyBuffer(m_allocator, m_models.buffer, m_models.allocation);
+    vmaDestroyBuffer(m_allocator, m_meshes.buffer, m_meshes.allocation);
+    vmaDestroyBuffer(m_allocator, m_batches.buffer, m_batches.allocation);
+    vmaDestroyBuffer(m_allocator, m_materials.buffer, m_materials.allocation);
+    vmaDestroyBuffer(m_allocator, m_object_meshes.buffer,
+                     m_object_meshes.allocation);
+    vmaDestroyBuffer(m_allocator, m_clusters.buffer, m_clusters.allocation);
+    vmaDestroyBuffer(m_allocator, m_items.buffer, m_items.allocation);
+    vmaDestroyBuffer(m_allocator, m_inverse_models.buffer,
+                     m_inverse_models.allocation);
+    m_objects = {};
+    m_models = {};
+    m_meshes = {};
+    m_batches = {};
+    m_materials = {};
+    m_object_meshes = {};
+    m_clusters = {};
+    m_items = {};
+    m_inverse_models = {};
+}
+
+void GraphicsGpuCulling::destroy() {
+    destroy_scene();
+    pipeline.destroy();
+    m_descriptor_pool.destroy();
+    if (!m_shared_layout) {
+        vkDestroyDescriptorSetLayout(m_device, m_cull_layout, nullptr);
+    }
+    frames.clear();
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <span>
+#include <vector>
+
+#include "descriptor.h"
+#include "pipeline.h"
+#include "upload.h"
+#include "utils.h"
+
+// Matches Object in cull.comp (std430)
+struct GpuObject {
+    glm::vec4 sphere;
+    uint32_t mesh;
+    uint32_t batch;
+    uint32_t padding[2];
+};
+
+// Matches MeshInfo in cull.comp and mesh_quantized.vert (std430)
+struct GpuMesh {
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    // First GpuCluster of the mesh, when the clusters are culled
+    uint32_t first_cluster;
+    // Decode the quantized positions, w is unused
+    glm::vec4 aabb_min;
+    glm::vec4 aabb_extent;
+};
+
+// Matches Cluster in cluster_cull.comp (std430), made of a Meshlet
+struct GpuCluster {
+    // Model space bounding sphere
+    glm::vec4 sphere;
+    // Axis and cutoff of the normal cone
+    glm::vec4 cone;
+    // Range of the index buffer, first_index included
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t padding[2];
+};
+
+// One cluster of the mesh of an object, the unit the cluster culling tests
+struct GpuClusterItem {
+    uint32_t object;
+    uint32_t cluster;
+};
+
+// Written by the culling dispatch of a frame in flight, read by its draws
+struct GpuCullFrame {
+    AllocatedBuffer draws;
+    AllocatedBuffer counts;
+    const uint32_t *mapped_counts;
+    // viewproj * model of the visible objects, indexed by object
+    AllocatedBuffer instances;
+    // Mapped, holds the objects and models copied by record_update
+    AllocatedBuffer staging;
+    char *mapped_staging;
+    VkDescriptorSet descriptor_set;
+    // Replaces the instance buffers of the vertex shader, the draws address
+    // the matrices, materials and meshes by object index through
+    // firstInstance
+    VkDescriptorSet instance_set;
+};
+
+// Frustum culling on the gpu. A compute dispatch tests every object and
+// appends an indirect draw for the visible ones to the region of its batch,
+// so the cpu records one vkCmdDrawIndexedIndirectCount per batch no matter
+// how many objects there are.
+// With the cluster culling, the dispatch tests every cluster of the visible
+// objects against the frustum and its normal cone instead, and appends one
+// draw per visible cluster.
+class GraphicsGpuCulling {
+   public:
+    GraphicsPipeline pipeline;
+    std::vector<GpuCullFrame> frames;
+
+    // Uploads the scene, the objects of a batch have to be contiguous.
+    // `materials` holds the material index of every object. With the
+    // cluster culling, `items` lists the clusters of every object in object
+    // order, the others ignore `clusters` and `items`.
+    // Goes through `upload`, which has to be flushed before the first frame,
+    // and no frame that uses the previous scene may still be in flight.
+    void set_scene(GraphicsUpload &upload, std::span<const GpuObject> objects,
+                   std::span<const glm::mat4> models,
+                   std::span<const GpuMesh> meshes,
+                   std::span<const uint32_t> materials,
+                   std::span<const GpuCluster> clusters,
+                   std::span<const GpuClusterItem> items,
+                   uint32_t batch_count);
+    // Copies new bounds and model matrices of every object, in the order of
+    // set_scene, before the culling of the frame. Outside of a render pass.
+    void record_update(VkCommandBuffer cmd_buf, size_t frame,
+                       std::span<const GpuObject> objects,
+                       std::span<const glm::mat4> models);
+    // Clears the counts and dispatches the culling, outside of a render pass.
+    // The clusters are tested against the world space camera position.
+    void record_cull(VkCommandBuffer cmd_buf, size_t frame,
+                     const glm::mat4 &viewproj, const glm::vec3 &camera);
+    // Draws the visible objects of a batch, its pipeline has to be bound
+    void record_draw(VkCommandBuffer cmd_buf, size_t frame, uint32_t batch);
+    // Visible objects (or clusters) of the last culling of a frame whose
+    // fence was waited
+    uint32_t visible(size_t frame);
+    // Objects (or clusters) tested by every culling
+    uint32_t tested() const { return m_tested; };
+    uint32_t batch_size(uint32_t batch) { return m_batch_size.at(batch); };
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    VkDescriptorSetLayout m_cull_layout;
+    GraphicsDescriptorPool m_descriptor_pool;
+    bool m_cluster_culling;
+    // The registry owns the set layout
+    bool m_shared_layout;
+
+    uint32_t m_object_count;
+    uint32_t m_tested;
+    AllocatedBuffer m_objects;
+    AllocatedBuffer m_models;
+    AllocatedBuffer m_meshes;
+    AllocatedBuffer m_batches;
+    AllocatedBuffer m_materials;
+    // Mesh of every object, for the vertex shader
+    AllocatedBuffer m_object_meshes;
+    AllocatedBuffer m_clusters;
+    AllocatedBuffer m_items;
+    // Inverse of every model matrix, only filled with the cluster culling
+    AllocatedBuffer m_inverse_models;
+    std::vector<uint32_t> m_batch_first;
+    std::vector<uint32_t> m_batch_size;
+
+    void destroy_scene();
+
+    friend class GraphicsGpuCullingBuilder;
+};
+
+class GraphicsGpuCullingBuilder {
+   public:
+    // `instance_layout` is the set layout of the instance buffers of the
+    // vertex shader, storage buffers with the matrices at binding 0, the
+    // materials at binding 1, the meshes at binding 2 and the GpuMesh table
+    // at binding 3
+    GraphicsGpuCullingBuilder(VkDevice device, VmaAllocator allocator,
+                              VkDescriptorSetLayout instance_layout,
+                              uint32_t frame_count)
+        : m_device(device),
+          m_allocator(allocator),
+          m_instance_layout(instance_layout),
+          m_frame_count(frame_count),
+          m_pipeline_cache(VK_NULL_HANDLE),
+          m_registry(nullptr),
+          m_clusters_enabled(false){};
+
+    GraphicsGpuCullingBuilder* set_pipeline_cache(VkPipelineCache cache);
+    // Takes the culling set layout from the registry
+    GraphicsGpuCullingBuilder* set_registry(GraphicsPipelineRegistry* registry);
+    // Cull and draw the clusters of the objects instead of whole meshes
+    GraphicsGpuCullingBuilder* set_cluster_culling(bool enabled);
+    GraphicsGpuCulling build();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    VkDescriptorSetLayout m_instance_layout;
+    uint32_t m_frame_count;
+    VkPipelineCache m_pipeline_cache;
+    GraphicsPipelineRegistry* m_registry;
+    bool m_clusters_enabled;
+};
@@ -0,0 +1,31 @@
+#include "image.h"
+
+#include <algorithm>
+
+ImageData downsample(const ImageData &image) {
+    ImageData out{
+        .width = std::max(1u, image.width / 2),
+        .height = std::max(1u, image.height / 2),
+    };
+    out.pixels.resize(size_t(out.width) * out.height * 4);
+    for (uint32_t y = 0; y < out.height; y++) {
+        const uint8_t *row0 =
+            image.pixels.data() +
+            size_t(std::min(y * 2, image.height - 1)) * image.width * 4;
+        const uint8_t *row1 =
+            image.pixels.data() +
+            size_t(std::min(y * 2 + 1, image.height - 1)) * image.width * 4;
+        uint8_t *dst = out.pixels.data() + size_t(y) * out.width * 4;
+        for (uint32_t x = 0; x < out.width; x++) {
+            uint32_t x0 = std::min(x * 2, image.width - 1) * 4;
+            uint32_t x1 = std::min(x * 2 + 1, image.width - 1) * 4;
+            for (uint32_t c = 0; c < 4; c++) {
+                dst[x * 4 + c] =
+                    (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                     row1[x1 + c] + 2) >>
+                    2;
+            }
+        }
+    }
+    return out;
+}
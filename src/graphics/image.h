@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// 8 bit RGBA pixels, rows from top to bottom without padding
+struct ImageData {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;
+};
+
+// Halves both sides (down to 1) with a 2x2 box filter, the last row or
+// column of an odd side is repeated
+ImageData downsample(const ImageData &image);
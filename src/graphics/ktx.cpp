@@ -0,0 +1,225 @@
+#include "ktx.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+static const uint8_t ktx_identifier[12]{0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32,
+                                        0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+static const BlockFormat block_formats[]{
+    {VK_FORMAT_BC1_RGB_SRGB_BLOCK, "bc1", 8},
+    {VK_FORMAT_BC3_SRGB_BLOCK, "bc3", 16},
+    {VK_FORMAT_BC7_SRGB_BLOCK, "bc7", 16},
+    {VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, "etc2", 8},
+    {VK_FORMAT_ASTC_4x4_SRGB_BLOCK, "astc", 16},
+};
+
+// Data format descriptor values, from the Khronos Data Format specification
+const uint32_t dfd_model_bc1a = 128;
+const uint32_t dfd_model_bc3 = 130;
+const uint32_t dfd_model_bc7 = 134;
+const uint32_t dfd_model_etc2 = 161;
+const uint32_t dfd_model_astc = 162;
+const uint32_t dfd_primaries_bt709 = 1;
+const uint32_t dfd_transfer_srgb = 2;
+const uint32_t dfd_channel_alpha = 15;
+// The color channel id is 0 in the BC and ASTC models, ETC2 has its own
+const uint32_t dfd_channel_etc2_color = 2;
+// Set on the alpha sample of an sRGB format, which is not sRGB encoded
+const uint32_t dfd_sample_linear = 0x10;
+
+const BlockFormat *find_block_format(VkFormat format) {
+    for (const BlockFormat &block_format : block_formats) {
+        if (block_format.format == format) {
+            return &block_format;
+        }
+    }
+    return nullptr;
+}
+
+size_t block_level_size(const BlockFormat &format, uint32_t width,
+                        uint32_t height) {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * format.block_bytes;
+}
+
+std::string baked_texture_path(const std::string &source,
+                               const BlockFormat &format) {
+    std::filesystem::path path(source);
+    path.replace_extension(std::string(".") + format.name + ".ktx2");
+    return path.string();
+}
+
+// One basic descriptor block: the whole block is a single color sample,
+// except for BC3 which starts with its alpha half
+static std::vector<uint32_t> data_format_descriptor(
+    const BlockFormat &format) {
+    uint32_t model = 0;
+    switch (format.format) {
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            model = dfd_model_bc1a;
+            break;
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+            model = dfd_model_bc3;
+            break;
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            model = dfd_model_bc7;
+            break;
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+            model = dfd_model_etc2;
+            break;
+        default:
+            model = dfd_model_astc;
+            break;
+    }
+
+    struct Sample {
+        uint32_t bit_offset;
+        uint32_t bit_count;
+        uint32_t channel;
+    };
+    std::vector<Sample> samples;
+    if (format.format == VK_FORMAT_BC3_SRGB_BLOCK) {
+        samples.push_back({0, 64, dfd_channel_alpha | dfd_sample_linear});
+        samples.push_back({64, 64, 0});
+    } else if (format.format == VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK) {
+        samples.push_back({0, 64, dfd_channel_etc2_color});
+    } else {
+        samples.push_back({0, format.block_bytes * 8, 0});
+    }
+
+    uint32_t block_size = 24 + 16 * samples.size();
+    std::vector<uint32_t> out{
+        4 + block_size,
+        // Khronos vendor, basic descriptor type
+        0,
+        2 | block_size << 16,
+        model | dfd_primaries_bt709 << 8 | dfd_transfer_srgb << 16,
+        // 4x4x1 texels, stored minus one
+        3 | 3 << 8,
+        format.block_bytes,
+        0,
+    };
+    for (const Sample &sample : samples) {
+        out.push_back(sample.bit_offset | (sample.bit_count - 1) << 16 |
+                      sample.channel << 24);
+        out.push_back(0);
+        out.push_back(0);
+        out.push_back(UINT32_MAX);
+    }
+    return out;
+}
+
+std::span<const uint8_t> KtxFile::level(uint32_t mip) const {
+    const uint8_t *base = static_cast<const uint8_t *>(file.data);
+    const KtxLevel *levels =
+        reinterpret_cast<const KtxLevel *>(base + sizeof(KtxHeader));
+    return std::span<const uint8_t>(base + levels[mip].offset,
+                                    levels[mip].length);
+}
+
+void KtxFile::destroy() {
+    file.destroy();
+    header = nullptr;
+}
+
+std::optional<KtxFile> KtxFile::open(const char *path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return std::optional<KtxFile>{};
+    }
+
+    KtxFile out{
+        .file = file.value(),
+        .header = static_cast<const KtxHeader *>(file->data),
+    };
+
+    bool valid =
+        out.file.size >= sizeof(KtxHeader) &&
+        !memcmp(out.header->identifier, ktx_identifier,
+                sizeof(ktx_identifier)) &&
+        out.header->width && out.header->height && !out.header->depth &&
+        out.header->layer_count <= 1 && out.header->face_count == 1 &&
+        out.header->level_count && !out.header->supercompression &&
+        out.file.size >=
+            sizeof(KtxHeader) + out.header->level_count * sizeof(KtxLevel);
+    const KtxLevel *levels = reinterpret_cast<const KtxLevel *>(
+        static_cast<const uint8_t *>(out.file.data) + sizeof(KtxHeader));
+    for (uint32_t i = 0; valid && i < out.header->level_count; i++) {
+        valid = levels[i].offset <= out.file.size &&
+                levels[i].length <= out.file.size - levels[i].offset;
+    }
+
+    if (!valid) {
+        printf("KtxFile: %s is not a supported KTX2 file\n", path);
+        out.destroy();
+        return std::optional<KtxFile>{};
+    }
+    return out;
+}
+
+bool KtxFile::write(const char *path, const BlockFormat &format,
+                    uint32_t width, uint32_t height,
+                    std::span<const std::vector<uint8_t>> levels) {
+    std::vector<uint32_t> dfd = data_format_descriptor(format);
+    KtxHeader header{
+        .vk_format = uint32_t(format.format),
+        .type_size = 1,
+        .width = width,
+        .height = height,
+        .face_count = 1,
+        .level_count = uint32_t(levels.size()),
+        .dfd_offset =
+            uint32_t(sizeof(KtxHeader) + levels.size() * sizeof(KtxLevel)),
+        .dfd_length = uint32_t(dfd.size() * sizeof(uint32_t)),
+    };
+    memcpy(header.identifier, ktx_identifier, sizeof(ktx_identifier));
+
+    // The smallest level comes first, every level is aligned to a block
+    std::vector<KtxLevel> index(levels.size());
+    uint64_t offset = header.dfd_offset + header.dfd_length;
+    for (size_t i = levels.size(); i-- > 0;) {
+        offset = (offset + format.block_bytes - 1) / format.block_bytes *
+                 format.block_bytes;
+        index[i] = KtxLevel{
+            .offset = offset,
+            .length = levels[i].size(),
+            .uncompressed_length = levels[i].size(),
+        };
+        offset += levels[i].size();
+    }
+
+    // Written to a temporary file first, like the mesh caches
+    const std::string tmp_path = std::string(path) + ".tmp";
+    FILE *out = fopen(tmp_path.c_str(), "wb");
+    if (!out) {
+        printf("KtxFile: cannot write %s\n", tmp_path.c_str());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(index.data(), sizeof(KtxLevel), index.size(), out) ==
+                   index.size();
+    ok = ok &&
+         fwrite(dfd.data(), sizeof(uint32_t), dfd.size(), out) == dfd.size();
+    uint64_t written = header.dfd_offset + header.dfd_length;
+    const uint8_t padding[16]{};
+    for (size_t i = levels.size(); ok && i-- > 0;) {
+        ok = fwrite(padding, 1, index[i].offset - written, out) ==
+             index[i].offset - written;
+        ok = ok && fwrite(levels[i].data(), 1, levels[i].size(), out) ==
+                       levels[i].size();
+        written = index[i].offset + index[i].length;
+    }
+    ok = !fclose(out) && ok;
+
+    std::error_code error;
+    if (ok) {
+        std::filesystem::rename(tmp_path, path, error);
+        ok = !error;
+    }
+    if (!ok) {
+        printf("KtxFile: cannot write %s\n", path);
+        std::filesystem::remove(tmp_path, error);
+    }
+    return ok;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "mmap.h"
+
+// sRGB format of 4x4 blocks the textures can be baked to
+struct BlockFormat {
+    VkFormat format;
+    // Suffix of the baked files, `<stem>.<name>.ktx2`
+    const char *name;
+    uint32_t block_bytes;
+};
+
+// BC1 (opaque), BC3, BC7, ETC2 (opaque) and ASTC 4x4, nullptr for any other
+// format
+const BlockFormat *find_block_format(VkFormat format);
+// Bytes of a level of `width` x `height` texels, partial blocks included
+size_t block_level_size(const BlockFormat &format, uint32_t width,
+                        uint32_t height);
+// Where the texture baked from `source` to `format` is stored: next to it,
+// the extension replaced by `.<name>.ktx2`
+std::string baked_texture_path(const std::string &source,
+                               const BlockFormat &format);
+
+// KTX2 header, the level index follows it
+struct KtxHeader {
+    uint8_t identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression;
+    uint32_t dfd_offset;
+    uint32_t dfd_length;
+    uint32_t kvd_offset;
+    uint32_t kvd_length;
+    uint64_t sgd_offset;
+    uint64_t sgd_length;
+};
+static_assert(sizeof(KtxHeader) == 80);
+
+struct KtxLevel {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t uncompressed_length;
+};
+
+// A 2D texture in a mapped KTX2 file, without supercompression, so that its
+// levels can be copied as they are to the gpu
+class KtxFile {
+   public:
+    MappedFile file;
+    const KtxHeader *header;
+
+    // Level 0 is the largest one
+    std::span<const uint8_t> level(uint32_t mip) const;
+    void destroy();
+
+    static std::optional<KtxFile> open(const char *path);
+    // `levels` holds the blocks of each level, level 0 first, the file stores
+    // them the other way around as the format requires
+    static bool write(const char *path, const BlockFormat &format,
+                      uint32_t width, uint32_t height,
+                      std::span<const std::vector<uint8_t>> levels);
+};
@@ -1,126 +1,268 @@
 #include "mesh.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <glm/glm.hpp>
+#include <string>
+#include <type_traits>
+
+#include "meshcache.h"
+#include "objloader.h"
 #include "utils.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+const uintmax_t parallel_obj_threshold = 8 << 20;
 
-#include <cstring>
-#include <string>
+std::vector<VkVertexInputBindingDescription>
+VertexTraits<QuantizedVertex>::bindings() {
+    return std::vector<VkVertexInputBindingDescription>{
+        VkVertexInputBindingDescription{
+            .binding = 0,
+            .stride = sizeof(QuantizedVertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        }};
+}
 
-Mesh::Mesh(VmaAllocator allocator, std::vector<Vertex> vertices)
-    : vertices(vertices), allocator(allocator) {
-    VkBufferCreateInfo buffer_info{
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = vertices.size() * sizeof(Vertex),
-        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+// Formats every device supports as vertex input
+std::vector<VkVertexInputAttributeDescription>
+VertexTraits<QuantizedVertex>::attributes() {
+    return std::vector<VkVertexInputAttributeDescription>{
+        VkVertexInputAttributeDescription{
+            .location = 0,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16B16A16_UNORM,
+            .offset = offsetof(QuantizedVertex, position),
+        },
+        VkVertexInputAttributeDescription{
+            .location = 1,
+            .binding = 0,
+            .format = VK_FORMAT_R16G16_SNORM,
+            .offset = offsetof(QuantizedVertex, normal),
+        },
+        VkVertexInputAttributeDescription{
+            .location = 2,
+            .binding = 0,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .offset = offsetof(QuantizedVertex, color),
+        },
     };
+}
 
-    VmaAllocationCreateInfo allocation_info{
-        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-        .usage = VMA_MEMORY_USAGE_AUTO,
-    };
+static uint16_t encode_unorm16(float value) {
+    return (uint16_t)std::lround(std::clamp(value, 0.f, 1.f) * 65535.f);
+}
 
-    assert(!vmaCreateBuffer(allocator, &buffer_info, &allocation_info,
-                             &vertex_buffer.buffer, &vertex_buffer.allocation,
-                             nullptr));
-    void* data;
-    vmaMapMemory(allocator, vertex_buffer.allocation, &data);
-    memcpy(data, vertices.data(), vertices.size() * sizeof(Vertex));
-    vmaUnmapMemory(allocator, vertex_buffer.allocation);
+static int16_t encode_snorm16(float value) {
+    return (int16_t)std::lround(std::clamp(value, -1.f, 1.f) * 32767.f);
 }
 
-void Mesh::destroy() {
-    vmaDestroyBuffer(allocator, vertex_buffer.buffer, vertex_buffer.allocation);
+static uint8_t encode_unorm8(float value) {
+    return (uint8_t)std::lround(std::clamp(value, 0.f, 1.f) * 255.f);
 }
 
-std::optional<Mesh> Mesh::from_obj(VmaAllocator allocator,
-                                   const char* directory,
-                                   const char* filename) {
-    tinyobj::ObjReaderConfig reader_config;
-    reader_config.mtl_search_path = directory;
-    reader_config.triangulate = true;
+// The normal is projected on the octahedron |x| + |y| + |z| = 1, whose lower
+// half is folded over the upper one. A zero normal decodes to +z.
+QuantizedVertex VertexTraits<QuantizedVertex>::encode(const Vertex& vertex,
+                                                      glm::vec3 aabb_min,
+                                                      glm::vec3 aabb_max) {
+    QuantizedVertex out{};
+    glm::vec3 extent = aabb_max - aabb_min;
+    for (int i = 0; i < 3; i++) {
+        out.position[i] =
+            extent[i] > 0.f
+                ? encode_unorm16((vertex.position[i] - aabb_min[i]) /
+                                 extent[i])
+                : 0;
+    }
+
+    glm::vec3 n = vertex.normal;
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    float x = sum > 0.f ? n.x / sum : 0.f;
+    float y = sum > 0.f ? n.y / sum : 0.f;
+    if (n.z < 0.f) {
+        float folded_x = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+        float folded_y = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = folded_x;
+        y = folded_y;
+    }
+    out.normal[0] = encode_snorm16(x);
+    out.normal[1] = encode_snorm16(y);
 
-    tinyobj::ObjReader reader;
+    out.color[0] = encode_unorm8(vertex.color.r);
+    out.color[1] = encode_unorm8(vertex.color.g);
+    out.color[2] = encode_unorm8(vertex.color.b);
+    out.color[3] = 255;
+    return out;
+}
 
-    const std::string inputfile = std::string(directory) + filename;
+std::optional<Mesh> Mesh::create(GraphicsGeometry& geometry,
+                                 GraphicsUpload& upload,
+                                 std::span<const Vertex> vertices,
+                                 std::span<const uint32_t> indices,
+                                 VertexFormat format, bool clustered) {
+    Mesh mesh;
+    mesh.vertex_format = format;
+    mesh.vertex_count = (uint32_t)vertices.size();
+    mesh.index_count = (uint32_t)indices.size();
+    mesh.m_geometry = &geometry;
+
+    // The sphere is centered on the box, which is cheap and tight enough
+    // for culling
+    mesh.aabb_min = glm::vec3{0.f};
+    mesh.aabb_max = glm::vec3{0.f};
+    if (!vertices.empty()) {
+        mesh.aabb_min = mesh.aabb_max = vertices[0].position;
+    }
+    for (const Vertex& v : vertices) {
+        mesh.aabb_min = glm::min(mesh.aabb_min, v.position);
+        mesh.aabb_max = glm::max(mesh.aabb_max, v.position);
+    }
+    mesh.center = (mesh.aabb_min + mesh.aabb_max) * .5f;
+    mesh.radius = 0.f;
+    for (const Vertex& v : vertices) {
+        mesh.radius =
+            std::max(mesh.radius, glm::distance(mesh.center, v.position));
+    }
 
-    reader.ParseFromFile(inputfile, reader_config);
+    MeshletData clusters;
+    if (clustered) {
+        clusters = build_meshlets(vertices, indices);
+        mesh.meshlets = std::move(clusters.meshlets);
+        indices = clusters.indices;
+    }
 
-    if (!reader.Error().empty()) {
-        printf("TinyObjReader: %s\n", reader.Error().c_str());
+    bool written = false;
+    switch (format) {
+        case VertexFormat::Float:
+            written = mesh.write<Vertex>(upload, vertices, indices);
+            break;
+        case VertexFormat::Quantized:
+            written = mesh.write<QuantizedVertex>(upload, vertices, indices);
+            break;
+    }
+    if (!written) {
+        printf("Mesh of %zu vertices and %zu indices does not fit in the "
+               "geometry buffers\n",
+               vertices.size(), indices.size());
         return std::optional<Mesh>{};
     }
+    return std::optional<Mesh>(std::move(mesh));
+}
+
+template <typename V>
+bool Mesh::write(GraphicsUpload& upload, std::span<const Vertex> vertices,
+                 std::span<const uint32_t> indices) {
+    vertex_stride = sizeof(V);
+    auto allocation = m_geometry->allocate(vertices.size() * sizeof(V),
+                                           sizeof(V), indices.size_bytes());
+    if (!allocation) {
+        return false;
+    }
+    m_allocation = allocation.value();
+
+    vertex_offset = (int32_t)(m_allocation.vertex_offset / sizeof(V));
+    first_index = (uint32_t)(m_allocation.index_offset / sizeof(uint32_t));
+
+    if constexpr (std::is_same_v<V, Vertex>) {
+        upload.write(m_geometry->vertex_buffer, m_allocation.vertex_offset,
+                     vertices.data(), vertices.size_bytes());
+    } else {
+        std::vector<V> encoded(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            encoded[i] =
+                VertexTraits<V>::encode(vertices[i], aabb_min, aabb_max);
+        }
+        upload.write(m_geometry->vertex_buffer, m_allocation.vertex_offset,
+                     encoded.data(), encoded.size() * sizeof(V));
+    }
+    upload.write(m_geometry->index_buffer, m_allocation.index_offset,
+                 indices.data(), indices.size_bytes());
+    return true;
+}
+
+void Mesh::destroy() { m_geometry->free(m_allocation); }
 
-    if (!reader.Warning().empty()) {
-        printf("TinyObjReader: %s\n", reader.Warning().c_str());
+MeshData make_sphere(uint32_t segments, glm::vec3 color) {
+    segments = std::max(segments, 3u);
+    uint32_t stacks = std::max(segments / 2, 2u);
+    const float pi = 3.14159265358979f;
+
+    MeshData out;
+    out.vertices.reserve((segments + 1) * (stacks + 1));
+    for (uint32_t i = 0; i <= stacks; i++) {
+        float phi = pi * i / stacks;
+        for (uint32_t j = 0; j <= segments; j++) {
+            float theta = 2.f * pi * j / segments;
+            glm::vec3 normal{std::sin(phi) * std::cos(theta), std::cos(phi),
+                             std::sin(phi) * std::sin(theta)};
+            out.vertices.push_back(Vertex{
+                .position = normal,
+                .normal = normal,
+                .color = color,
+            });
+        }
     }
 
-    auto& attrib = reader.GetAttrib();
-    auto& shapes = reader.GetShapes();
-    auto& materials = reader.GetMaterials();
-
-    std::vector<Vertex> vertices{};
-
-    // Loop over shapes
-    for (size_t s = 0; s < shapes.size(); s++) {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-
-            // Loop over vertices in the face.
-            for (size_t v = 0; v < fv; v++) {
-                Vertex vertex{};
-
-                // access to vertex
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                tinyobj::real_t vx =
-                    attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-                tinyobj::real_t vy =
-                    attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-                tinyobj::real_t vz =
-                    attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-
-                vertex.position = glm::vec3{vx, vy, vz};
-
-                // Check if `normal_index` is zero or positive. negative = no
-                // normal data
-                if (idx.normal_index >= 0) {
-                    tinyobj::real_t nx =
-                        attrib.normals[3 * size_t(idx.normal_index) + 0];
-                    tinyobj::real_t ny =
-                        attrib.normals[3 * size_t(idx.normal_index) + 1];
-                    tinyobj::real_t nz =
-                        attrib.normals[3 * size_t(idx.normal_index) + 2];
-
-                    vertex.normal = glm::vec3{nx, ny, nz};
-                }
-
-                // Check if `texcoord_index` is zero or positive. negative = no
-                // texcoord data
-                if (idx.texcoord_index >= 0) {
-                    tinyobj::real_t tx =
-                        attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
-                    tinyobj::real_t ty =
-                        attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
-                }
-
-                // Optional: vertex colors
-                tinyobj::real_t red =
-                    attrib.colors[3 * size_t(idx.vertex_index) + 0];
-                tinyobj::real_t green =
-                    attrib.colors[3 * size_t(idx.vertex_index) + 1];
-                tinyobj::real_t blue =
-                    attrib.colors[3 * size_t(idx.vertex_index) + 2];
-
-                vertex.color = glm::vec3{red, green, blue};
-
-                vertices.push_back(vertex);
-            }
-            index_offset += fv;
+    // The seam and the poles have duplicated vertices, which keeps the
+    // indexing regular
+    out.indices.reserve(segments * stacks * 6);
+    for (uint32_t i = 0; i < stacks; i++) {
+        for (uint32_t j = 0; j < segments; j++) {
+            uint32_t a = i * (segments + 1) + j;
+            uint32_t b = a + segments + 1;
+            out.indices.insert(out.indices.end(),
+                               {a, b, a + 1, a + 1, b, b + 1});
         }
     }
+    return out;
+}
+
+// The cache keeps the loaded vertices, the layout of the mesh is picked
+// when uploading them
+std::optional<Mesh> Mesh::from_obj(GraphicsGeometry& geometry,
+                                   GraphicsUpload& upload,
+                                   const char* directory, const char* filename,
+                                   VertexFormat format, bool clustered) {
+    const std::string path = std::string(directory) + filename;
+    auto start = std::chrono::steady_clock::now();
+
+    auto cache = MeshCache::open(path);
+    if (cache) {
+        auto mesh = create(geometry, upload, cache->vertices(),
+                           cache->indices(), format, clustered);
+        cache->destroy();
+
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        printf("Mesh::from_obj %s: mapped cache in %.3f ms\n", filename,
+               elapsed.count());
+        return mesh;
+    }
 
-    return std::optional<Mesh>(Mesh(allocator, vertices));
+    // Both loaders return the same data, the parallel one only pays off
+    // once there is enough text to split between the workers
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    auto data = !error && size >= parallel_obj_threshold
+                    ? load_obj_parallel(directory, filename)
+                    : load_obj(directory, filename);
+    if (!data) {
+        printf("Mesh::from_obj %s: could not be loaded\n", filename);
+        return std::optional<Mesh>{};
+    }
+    auto mesh = create(geometry, upload, data->vertices, data->indices,
+                       format, clustered);
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("Mesh::from_obj %s: parsed in %.3f ms\n", filename,
+           elapsed.count());
+
+    // Only cached once the mesh is known to be usable
+    if (mesh) {
+        MeshCache::write(path, data->vertices, data->indices);
+    }
+    return mesh;
 }
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <cstring>
+#include <functional>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include <optional>
+#include <span>
 #include <vector>
 
+#include "geometry.h"
+#include "meshlet.h"
+#include "upload.h"
 #include "utils.h"
 
 struct Vertex {
@@ -49,19 +56,146 @@ struct Vertex {
     const static VkPipelineVertexInputStateCreateFlags get_flags() {
         return 0;
     };
+
+    // Vertices are compared bit by bit, so that the equality is consistent
+    // with the hash below (e.g. 0.f and -0.f are different vertices)
+    bool operator==(const Vertex& other) const {
+        return !memcmp(this, &other, sizeof(Vertex));
+    };
+};
+
+static_assert(sizeof(Vertex) == 9 * sizeof(float),
+              "Vertex must not contain padding bytes");
+
+template <>
+struct std::hash<Vertex> {
+    size_t operator()(const Vertex& vertex) const {
+        // FNV-1a over the raw bytes of the vertex
+        const unsigned char* bytes =
+            reinterpret_cast<const unsigned char*>(&vertex);
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(Vertex); i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    };
+};
+
+// Vertex layouts a mesh can be stored with. Each layout has its own
+// pipelines, as the vertex input and the vertex shader differ.
+enum class VertexFormat : uint32_t {
+    // Vertex, as loaded
+    Float,
+    // QuantizedVertex, decoded by mesh_quantized.vert
+    Quantized,
+};
+
+const uint32_t vertex_format_count = 2;
+
+// 16 bytes instead of the 36 of Vertex: the position in 16 bits per axis,
+// relative to the bounds of its mesh, the normal octahedral encoded in two
+// 16 bits values and the color in RGBA8
+struct QuantizedVertex {
+    // The fourth value is padding, three component 16 bits formats are
+    // rarely supported as vertex input
+    uint16_t position[4];
+    int16_t normal[2];
+    uint8_t color[4];
+};
+
+static_assert(sizeof(QuantizedVertex) == 16,
+              "QuantizedVertex must not contain padding bytes");
+
+// Describes a vertex layout to the meshes and the pipelines, specialized
+// for every layout. `encode` converts a loaded vertex, given the bounds of
+// its mesh.
+template <typename V>
+struct VertexTraits;
+
+template <>
+struct VertexTraits<Vertex> {
+    static constexpr VertexFormat format = VertexFormat::Float;
+
+    static std::vector<VkVertexInputBindingDescription> bindings() {
+        return Vertex::get_bindings();
+    };
+    static std::vector<VkVertexInputAttributeDescription> attributes() {
+        return Vertex::get_attributes();
+    };
+    static Vertex encode(const Vertex& vertex, glm::vec3, glm::vec3) {
+        return vertex;
+    };
+};
+
+template <>
+struct VertexTraits<QuantizedVertex> {
+    static constexpr VertexFormat format = VertexFormat::Quantized;
+
+    static std::vector<VkVertexInputBindingDescription> bindings();
+    static std::vector<VkVertexInputAttributeDescription> attributes();
+    static QuantizedVertex encode(const Vertex& vertex, glm::vec3 aabb_min,
+                                  glm::vec3 aabb_max);
+};
+
+// CPU side mesh, as produced by the loaders
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
 };
 
+// Unit sphere with `segments` slices around the y axis and `segments` / 2
+// stacks, about segments * segments triangles
+MeshData make_sphere(uint32_t segments, glm::vec3 color);
+
+// Range of the shared geometry buffers, drawn with
+// vkCmdDrawIndexed(index_count, .., first_index, vertex_offset, ..)
 class Mesh {
    public:
-    Mesh(VmaAllocator allocator, std::vector<Vertex> vertices);
-    std::vector<Vertex> vertices;
-    AllocatedBuffer vertex_buffer;
+    // The data can be drawn from once `upload` has been flushed. The
+    // vertices are stored in `format`, which the pipeline drawing the mesh
+    // has to expect. When clustered, the triangles are split into meshlets
+    // and reordered so that each one is a range of the indices. Empty when
+    // the geometry buffers are full.
+    static std::optional<Mesh> create(GraphicsGeometry& geometry,
+                                      GraphicsUpload& upload,
+                                      std::span<const Vertex> vertices,
+                                      std::span<const uint32_t> indices,
+                                      VertexFormat format = VertexFormat::Float,
+                                      bool clustered = false);
+    VertexFormat vertex_format;
+    // Bytes per vertex in the vertex buffer
+    uint32_t vertex_stride;
+    int32_t vertex_offset;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;
+    // Model space bounds, computed at load time. The quantized positions
+    // are relative to the box.
+    glm::vec3 aabb_min;
+    glm::vec3 aabb_max;
+    glm::vec3 center;
+    float radius;
+    // Empty unless asked for
+    std::vector<Meshlet> meshlets;
     void destroy();
 
-    static std::optional<Mesh> from_obj(VmaAllocator allocator,
-                                        const char* directory,
-                                        const char* filename);
+    // Loads the mesh from its binary cache when it is up to date, otherwise
+    // parses the OBJ file and writes the cache for the next launch. Empty
+    // when the file cannot be read or the geometry buffers are full.
+    static std::optional<Mesh> from_obj(
+        GraphicsGeometry& geometry, GraphicsUpload& upload,
+        const char* directory, const char* filename,
+        VertexFormat format = VertexFormat::Float, bool clustered = false);
 
    private:
-    VmaAllocator allocator;
+    GraphicsGeometry* m_geometry;
+    GeometryAllocation m_allocation;
+
+    Mesh() = default;
+    // Allocates the mesh in the geometry buffers and uploads it in the
+    // layout of V, once the bounds are known. False when it does not fit.
+    template <typename V>
+    bool write(GraphicsUpload& upload, std::span<const Vertex> vertices,
+               std::span<const uint32_t> indices);
 };
@@ -0,0 +1,179 @@
+#include "meshcache.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+static const char mesh_cache_magic[4]{'M', 'S', 'H', 'C'};
+static const uint32_t mesh_cache_version = 1;
+
+static uint64_t fnv1a(const void* data, size_t size) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static std::optional<uint64_t> hash_file(const std::string& path) {
+    auto file = MappedFile::open(path.c_str());
+    if (!file) {
+        return std::optional<uint64_t>{};
+    }
+    uint64_t hash = fnv1a(file->data, file->size);
+    file->destroy();
+    return hash;
+}
+
+// Records the new mtime of a source whose content did not change, so that
+// the next open skips the hash. A failure only costs the hash again.
+static void update_mtime(const std::string& path, int64_t source_mtime) {
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (!file) {
+        return;
+    }
+    if (fseek(file, offsetof(MeshCacheHeader, source_mtime), SEEK_SET) ||
+        fwrite(&source_mtime, sizeof(source_mtime), 1, file) != 1) {
+        printf("MeshCache: cannot update %s\n", path.c_str());
+    }
+    fclose(file);
+}
+
+static int64_t get_mtime(const std::string& path, std::error_code& error) {
+    return std::filesystem::last_write_time(path, error)
+        .time_since_epoch()
+        .count();
+}
+
+std::span<const Vertex> MeshCache::vertices() const {
+    const char* base = reinterpret_cast<const char*>(file.data);
+    return std::span<const Vertex>(
+        reinterpret_cast<const Vertex*>(base + sizeof(MeshCacheHeader)),
+        header->vertex_count);
+}
+
+std::span<const uint32_t> MeshCache::indices() const {
+    const char* base = reinterpret_cast<const char*>(file.data);
+    return std::span<const uint32_t>(
+        reinterpret_cast<const uint32_t*>(
+            base + sizeof(MeshCacheHeader) +
+            header->vertex_count * header->vertex_size),
+        header->index_count);
+}
+
+void MeshCache::destroy() {
+    file.destroy();
+    header = nullptr;
+}
+
+std::string MeshCache::path_for(const std::string& source_path) {
+    return source_path + ".meshcache";
+}
+
+std::optional<MeshCache> MeshCache::open(const std::string& source_path) {
+    std::error_code error;
+    uint64_t source_size = std::filesystem::file_size(source_path, error);
+    if (error) {
+        return std::optional<MeshCache>{};
+    }
+    int64_t source_mtime = get_mtime(source_path, error);
+    if (error) {
+        return std::optional<MeshCache>{};
+    }
+
+    auto file = MappedFile::open(path_for(source_path).c_str());
+    if (!file) {
+        return std::optional<MeshCache>{};
+    }
+
+    MeshCache out{
+        .file = file.value(),
+        .header = reinterpret_cast<const MeshCacheHeader*>(file->data),
+    };
+
+    bool valid =
+        out.file.size >= sizeof(MeshCacheHeader) &&
+        !memcmp(out.header->magic, mesh_cache_magic, sizeof(mesh_cache_magic)) &&
+        out.header->version == mesh_cache_version &&
+        out.header->vertex_size == sizeof(Vertex) &&
+        out.header->index_size == sizeof(uint32_t) &&
+        out.file.size == sizeof(MeshCacheHeader) +
+                             out.header->vertex_count * sizeof(Vertex) +
+                             out.header->index_count * sizeof(uint32_t) &&
+        out.header->source_size == source_size;
+
+    // A different mtime with the same size is common after a checkout or a
+    // copy, so only in that case the source is hashed to settle it
+    if (valid && out.header->source_mtime != source_mtime) {
+        auto source_hash = hash_file(source_path);
+        valid = source_hash && source_hash.value() == out.header->source_hash;
+        if (valid) {
+            update_mtime(path_for(source_path), source_mtime);
+        }
+    }
+
+    if (!valid) {
+        out.destroy();
+        return std::optional<MeshCache>{};
+    }
+
+    return out;
+}
+
+bool MeshCache::write(const std::string& source_path,
+                      std::span<const Vertex> vertices,
+                      std::span<const uint32_t> indices) {
+    std::error_code error;
+    MeshCacheHeader header{
+        .version = mesh_cache_version,
+        .vertex_size = sizeof(Vertex),
+        .index_size = sizeof(uint32_t),
+        .vertex_count = vertices.size(),
+        .index_count = indices.size(),
+    };
+    memcpy(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic));
+
+    header.source_size = std::filesystem::file_size(source_path, error);
+    if (error) {
+        return false;
+    }
+    header.source_mtime = get_mtime(source_path, error);
+    if (error) {
+        return false;
+    }
+    auto source_hash = hash_file(source_path);
+    if (!source_hash) {
+        return false;
+    }
+    header.source_hash = source_hash.value();
+
+    // Write to a temporary file first, so that a crash never leaves a
+    // truncated cache behind
+    const std::string path = path_for(source_path);
+    const std::string tmp_path = path + ".tmp";
+
+    FILE* out = fopen(tmp_path.c_str(), "wb");
+    if (!out) {
+        printf("MeshCache: cannot write %s\n", tmp_path.c_str());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(vertices.data(), sizeof(Vertex), vertices.size(), out) ==
+                   vertices.size();
+    ok = ok && fwrite(indices.data(), sizeof(uint32_t), indices.size(), out) ==
+                   indices.size();
+    ok = !fclose(out) && ok;
+
+    if (ok) {
+        std::filesystem::rename(tmp_path, path, error);
+        ok = !error;
+    }
+    if (!ok) {
+        printf("MeshCache: cannot write %s\n", path.c_str());
+        std::filesystem::remove(tmp_path, error);
+    }
+    return ok;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string>
+
+#include "mesh.h"
+#include "mmap.h"
+
+// On-disk layout of a baked mesh: the header is followed by the vertex blob
+// and then by the index blob, both stored in their in-memory representation
+// so that they can be copied straight from the mapped file to the gpu.
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertex_size;
+    uint32_t index_size;
+    // Used to detect a stale cache without parsing the source again
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t reserved;
+};
+
+class MeshCache {
+   public:
+    MappedFile file;
+    const MeshCacheHeader* header;
+
+    std::span<const Vertex> vertices() const;
+    std::span<const uint32_t> indices() const;
+    void destroy();
+
+    // Maps the cache that belongs to `source_path`, if it exists and is
+    // still up to date with the source file
+    static std::optional<MeshCache> open(const std::string& source_path);
+    static bool write(const std::string& source_path,
+                      std::span<const Vertex> vertices,
+                      std::span<const uint32_t> indices);
+    static std::string path_for(const std::string& source_path);
+};
@@ -0,0 +1,225 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+const uint32_t no_meshlet = UINT32_MAX;
+
+// Triangles that use each vertex, as offsets into one array
+struct VertexTriangles {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+
+    std::span<const uint32_t> of(uint32_t vertex) const {
+        return std::span<const uint32_t>(
+            triangles.data() + offsets[vertex],
+            offsets[vertex + 1] - offsets[vertex]);
+    };
+};
+
+static VertexTriangles vertex_triangles(size_t vertex_count,
+                                        std::span<const uint32_t> indices) {
+    VertexTriangles out;
+    out.offsets.assign(vertex_count + 1, 0);
+    for (uint32_t index : indices) {
+        out.offsets[index + 1]++;
+    }
+    for (size_t i = 0; i < vertex_count; i++) {
+        out.offsets[i + 1] += out.offsets[i];
+    }
+    out.triangles.resize(indices.size());
+    std::vector<uint32_t> cursor(out.offsets.begin(), out.offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        out.triangles[cursor[indices[i]]++] = i / 3;
+    }
+    return out;
+}
+
+// Sphere around the box of the vertices, and the cone of the triangle
+// normals, oriented like the vertex normals so that the winding does not
+// matter
+static void compute_bounds(Meshlet &meshlet, std::span<const Vertex> vertices,
+                           std::span<const uint32_t> indices) {
+    std::span<const uint32_t> range =
+        indices.subspan(meshlet.first_index, meshlet.index_count);
+
+    glm::vec3 aabb_min = vertices[range[0]].position;
+    glm::vec3 aabb_max = aabb_min;
+    for (uint32_t index : range) {
+        aabb_min = glm::min(aabb_min, vertices[index].position);
+        aabb_max = glm::max(aabb_max, vertices[index].position);
+    }
+    meshlet.center = (aabb_min + aabb_max) * .5f;
+    meshlet.radius = 0.f;
+    for (uint32_t index : range) {
+        meshlet.radius = std::max(
+            meshlet.radius,
+            glm::distance(meshlet.center, vertices[index].position));
+    }
+
+    // Triangles without vertex normals (e.g. flat colored ones) may be seen
+    // from both sides, they keep the cluster from being culled
+    std::vector<glm::vec3> normals;
+    bool two_sided = false;
+    for (size_t i = 0; i < range.size(); i += 3) {
+        const Vertex &a = vertices[range[i]];
+        const Vertex &b = vertices[range[i + 1]];
+        const Vertex &c = vertices[range[i + 2]];
+        glm::vec3 normal =
+            glm::cross(b.position - a.position, c.position - a.position);
+        float area = glm::length(normal);
+        if (area == 0.f) {
+            continue;
+        }
+        glm::vec3 vertex_normal = a.normal + b.normal + c.normal;
+        if (glm::dot(vertex_normal, vertex_normal) == 0.f) {
+            two_sided = true;
+            break;
+        }
+        normal /= area;
+        normals.push_back(glm::dot(normal, vertex_normal) < 0.f ? -normal
+                                                                : normal);
+    }
+
+    meshlet.cone_axis = glm::vec3{0.f, 0.f, 1.f};
+    meshlet.cone_cutoff = 1.f;
+    glm::vec3 axis{0.f};
+    for (const glm::vec3 &normal : normals) {
+        axis += normal;
+    }
+    if (two_sided || normals.empty() || glm::dot(axis, axis) == 0.f) {
+        return;
+    }
+    axis = glm::normalize(axis);
+    float min_dot = 1.f;
+    for (const glm::vec3 &normal : normals) {
+        min_dot = std::min(min_dot, glm::dot(normal, axis));
+    }
+
+    // The normals are within acos(min_dot) of the axis, so every triangle
+    // faces away from the directions within 90 degrees minus that of the
+    // axis: cos(90 - acos(min_dot)) = sqrt(1 - min_dot^2). A cone wider than
+    // a half space never culls.
+    meshlet.cone_axis = axis;
+    if (min_dot > 0.f) {
+        meshlet.cone_cutoff = std::sqrt(1.f - min_dot * min_dot);
+    }
+}
+
+MeshletData build_meshlets(std::span<const Vertex> vertices,
+                           std::span<const uint32_t> indices) {
+    MeshletData out;
+    out.indices.reserve(indices.size());
+    const uint32_t triangle_count = indices.size() / 3;
+    if (!triangle_count) {
+        return out;
+    }
+
+    VertexTriangles adjacency = vertex_triangles(vertices.size(), indices);
+    std::vector<bool> emitted(triangle_count, false);
+    // Meshlet that last used the vertex
+    std::vector<uint32_t> vertex_meshlet(vertices.size(), no_meshlet);
+    // Triangles next to the meshlet, most recent last, each once
+    std::vector<uint32_t> frontier;
+    std::vector<uint32_t> triangle_meshlet(triangle_count, no_meshlet);
+    uint32_t next_seed = 0;
+    std::vector<glm::vec3> triangle_centers(triangle_count);
+    for (uint32_t i = 0; i < triangle_count; i++) {
+        triangle_centers[i] = (vertices[indices[i * 3]].position +
+                               vertices[indices[i * 3 + 1]].position +
+                               vertices[indices[i * 3 + 2]].position) *
+                              (1.f / 3.f);
+    }
+
+    Meshlet meshlet{};
+    uint32_t triangles = 0;
+    auto new_vertices = [&](uint32_t triangle) {
+        uint32_t a = indices[triangle * 3];
+        uint32_t b = indices[triangle * 3 + 1];
+        uint32_t c = indices[triangle * 3 + 2];
+        uint32_t id = out.meshlets.size();
+        return (vertex_meshlet[a] != id) + (vertex_meshlet[b] != id && b != a) +
+               (vertex_meshlet[c] != id && c != a && c != b);
+    };
+    glm::vec3 vertex_sum{0.f};
+    auto finish = [&]() {
+        compute_bounds(meshlet, vertices, out.indices);
+        out.meshlets.push_back(meshlet);
+        meshlet = Meshlet{.first_index = (uint32_t)out.indices.size()};
+        triangles = 0;
+        vertex_sum = glm::vec3{0.f};
+        frontier.clear();
+    };
+
+    for (uint32_t emitted_count = 0; emitted_count < triangle_count;
+         emitted_count++) {
+        // The triangle next to the meshlet that adds the fewest vertices,
+        // the closest to its centroid on ties so that it stays compact, else
+        // the next one in index order. The emitted triangles leave the
+        // frontier on the way.
+        uint32_t best = no_meshlet;
+        uint32_t best_new = 4;
+        float best_distance = 0.f;
+        glm::vec3 centroid =
+            vertex_sum / (float)std::max(meshlet.vertex_count, 1u);
+        size_t kept = 0;
+        for (size_t i = 0; i < frontier.size(); i++) {
+            uint32_t triangle = frontier[i];
+            if (emitted[triangle]) {
+                continue;
+            }
+            frontier[kept++] = triangle;
+            uint32_t added = new_vertices(triangle);
+            if (added > best_new) {
+                continue;
+            }
+            glm::vec3 offset = triangle_centers[triangle] - centroid;
+            float distance = glm::dot(offset, offset);
+            if (added < best_new || distance < best_distance) {
+                best = triangle;
+                best_new = added;
+                best_distance = distance;
+            }
+        }
+        frontier.resize(kept);
+        if (best == no_meshlet) {
+            while (emitted[next_seed]) {
+                next_seed++;
+            }
+            best = next_seed;
+            best_new = new_vertices(best);
+        }
+
+        if (triangles == meshlet_max_triangles ||
+            meshlet.vertex_count + best_new > meshlet_max_vertices) {
+            finish();
+            best_new = new_vertices(best);
+        }
+
+        uint32_t id = out.meshlets.size();
+        for (int i = 0; i < 3; i++) {
+            uint32_t vertex = indices[best * 3 + i];
+            out.indices.push_back(vertex);
+            if (vertex_meshlet[vertex] != id) {
+                vertex_meshlet[vertex] = id;
+                vertex_sum += vertices[vertex].position;
+                for (uint32_t triangle : adjacency.of(vertex)) {
+                    if (!emitted[triangle] &&
+                        triangle_meshlet[triangle] != id) {
+                        triangle_meshlet[triangle] = id;
+                        frontier.push_back(triangle);
+                    }
+                }
+            }
+        }
+        meshlet.vertex_count += best_new;
+        meshlet.index_count += 3;
+        emitted[best] = true;
+        triangles++;
+    }
+    finish();
+    return out;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <span>
+#include <vector>
+
+// mesh.h includes this header, the meshes keep their meshlets
+struct Vertex;
+
+const uint32_t meshlet_max_vertices = 64;
+const uint32_t meshlet_max_triangles = 124;
+
+// Cluster of neighbour triangles of a mesh, culled on its own
+struct Meshlet {
+    // Range of the mesh indices, relative to its first index
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t vertex_count;
+    // Model space bounding sphere
+    glm::vec3 center;
+    float radius;
+    // Normal cone: every triangle faces away from a point p when
+    // dot(center - p, cone_axis) >= cone_cutoff * |center - p| + radius.
+    // A cutoff of 1 never culls.
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+};
+
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    // The indices reordered so that every meshlet is a contiguous range
+    std::vector<uint32_t> indices;
+};
+
+// Splits the triangles into meshlets of at most meshlet_max_vertices
+// vertices and meshlet_max_triangles triangles, each grown from a seed
+// triangle through the neighbours that add the fewest vertices
+MeshletData build_meshlets(std::span<const Vertex> vertices,
+                           std::span<const uint32_t> indices);
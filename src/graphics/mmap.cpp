@@ -0,0 +1,88 @@
+#include "mmap.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+std::optional<MappedFile> MappedFile::open(const char *path) {
+    MappedFile out{};
+
+    out.m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (out.m_file == INVALID_HANDLE_VALUE) {
+        return std::optional<MappedFile>{};
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(out.m_file, &size) || !size.QuadPart) {
+        CloseHandle(out.m_file);
+        return std::optional<MappedFile>{};
+    }
+    out.size = (size_t)size.QuadPart;
+
+    out.m_mapping =
+        CreateFileMappingA(out.m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!out.m_mapping) {
+        CloseHandle(out.m_file);
+        return std::optional<MappedFile>{};
+    }
+
+    out.data = MapViewOfFile(out.m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!out.data) {
+        CloseHandle(out.m_mapping);
+        CloseHandle(out.m_file);
+        return std::optional<MappedFile>{};
+    }
+
+    return out;
+}
+
+void MappedFile::destroy() {
+    UnmapViewOfFile(data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+    data = nullptr;
+    size = 0;
+}
+#else
+std::optional<MappedFile> MappedFile::open(const char *path) {
+    MappedFile out{};
+
+    out.m_fd = ::open(path, O_RDONLY);
+    if (out.m_fd < 0) {
+        return std::optional<MappedFile>{};
+    }
+
+    struct stat st;
+    if (fstat(out.m_fd, &st) || !st.st_size) {
+        close(out.m_fd);
+        return std::optional<MappedFile>{};
+    }
+    out.size = (size_t)st.st_size;
+
+    void *data = mmap(nullptr, out.size, PROT_READ, MAP_PRIVATE, out.m_fd, 0);
+    if (data == MAP_FAILED) {
+        printf("mmap failed (%s)\n", path);
+        close(out.m_fd);
+        return std::optional<MappedFile>{};
+    }
+    out.data = data;
+
+    return out;
+}
+
+void MappedFile::destroy() {
+    munmap(const_cast<void *>(data), size);
+    close(m_fd);
+    data = nullptr;
+    size = 0;
+}
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Read-only view of a whole file, backed by the OS page cache
+class MappedFile {
+   public:
+    const void *data;
+    size_t size;
+
+    void destroy();
+
+    static std::optional<MappedFile> open(const char *path);
+
+   private:
+#ifdef _WIN32
+    void *m_file;
+    void *m_mapping;
+#else
+    int m_fd;
+#endif
+};
@@ -0,0 +1,597 @@
+#include "objloader.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include "mmap.h"
+#include "threadpool.h"
+
+std::optional<MeshData> load_obj(const char* directory, const char* filename) {
+    tinyobj::ObjReaderConfig reader_config;
+    reader_config.mtl_search_path = directory;
+    reader_config.triangulate = true;
+
+    tinyobj::ObjReader reader;
+
+    const std::string inputfile = std::string(directory) + filename;
+
+    reader.ParseFromFile(inputfile, reader_config);
+
+    if (!reader.Error().empty()) {
+        printf("TinyObjReader: %s\n", reader.Error().c_str());
+        return std::optional<MeshData>{};
+    }
+
+    if (!reader.Warning().empty()) {
+        printf("TinyObjReader: %s\n", reader.Warning().c_str());
+    }
+
+    auto& attrib = reader.GetAttrib();
+    auto& shapes = reader.GetShapes();
+    auto& materials = reader.GetMaterials();
+
+    std::vector<Vertex> vertices{};
+    std::vector<uint32_t> indices{};
+
+    // Face corners that share position, normal and color are emitted only
+    // once, and referenced through the index buffer
+    std::unordered_map<Vertex, uint32_t> unique_vertices{};
+
+    // Loop over shapes
+    for (size_t s = 0; s < shapes.size(); s++) {
+        // Loop over faces(polygon)
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+            size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
+
+            // Loop over vertices in the face.
+            for (size_t v = 0; v < fv; v++) {
+                Vertex vertex{};
+
+                // access to vertex
+                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+                tinyobj::real_t vx =
+                    attrib.vertices[3 * size_t(idx.vertex_index) + 0];
+                tinyobj::real_t vy =
+                    attrib.vertices[3 * size_t(idx.vertex_index) + 1];
+                tinyobj::real_t vz =
+                    attrib.vertices[3 * size_t(idx.vertex_index) + 2];
+
+                vertex.position = glm::vec3{vx, vy, vz};
+
+                // Check if `normal_index` is zero or positive. negative = no
+                // normal data
+                if (idx.normal_index >= 0) {
+                    tinyobj::real_t nx =
+                        attrib.normals[3 * size_t(idx.normal_index) + 0];
+                    tinyobj::real_t ny =
+                        attrib.normals[3 * size_t(idx.normal_index) + 1];
+                    tinyobj::real_t nz =
+                        attrib.normals[3 * size_t(idx.normal_index) + 2];
+
+                    vertex.normal = glm::vec3{nx, ny, nz};
+                }
+
+                // Check if `texcoord_index` is zero or positive. negative = no
+                // texcoord data
+                if (idx.texcoord_index >= 0) {
+                    tinyobj::real_t tx =
+                        attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
+                    tinyobj::real_t ty =
+                        attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
+                }
+
+                // Optional: vertex colors
+                tinyobj::real_t red =
+                    attrib.colors[3 * size_t(idx.vertex_index) + 0];
+                tinyobj::real_t green =
+                    attrib.colors[3 * size_t(idx.vertex_index) + 1];
+                tinyobj::real_t blue =
+                    attrib.colors[3 * size_t(idx.vertex_index) + 2];
+
+                vertex.color = glm::vec3{red, green, blue};
+
+                auto [it, inserted] = unique_vertices.try_emplace(
+                    vertex, (uint32_t)vertices.size());
+                if (inserted) {
+                    vertices.push_back(vertex);
+                }
+                indices.push_back(it->second);
+            }
+            index_offset += fv;
+        }
+    }
+
+    return std::optional<MeshData>(MeshData{
+        .vertices = std::move(vertices),
+        .indices = std::move(indices),
+    });
+}
+
+namespace {
+
+// Chunks smaller than this are not worth a task
+const size_t obj_min_chunk_size = 1 << 20;
+
+// Mirror of tinyobjloader's tryParseDouble, so that both loaders produce
+// bit-identical floats. Unlike strtod it does not depend on the C locale.
+bool parse_double(const char* s, const char* s_end, double* result) {
+    if (s >= s_end) {
+        return false;
+    }
+
+    double mantissa = 0.0;
+    int exponent = 0;
+    char sign = '+';
+    char exp_sign = '+';
+    const char* curr = s;
+    int read = 0;
+    bool leading_decimal_dots = false;
+
+    if (*curr == '+' || *curr == '-') {
+        sign = *curr;
+        curr++;
+        if (curr != s_end && *curr == '.') {
+            leading_decimal_dots = true;
+        }
+    } else if (*curr == '.') {
+        leading_decimal_dots = true;
+    } else if (*curr < '0' || *curr > '9') {
+        return false;
+    }
+
+    // Integer part
+    if (!leading_decimal_dots) {
+        while (curr != s_end && *curr >= '0' && *curr <= '9') {
+            mantissa *= 10;
+            mantissa += static_cast<int>(*curr - '0');
+            curr++;
+            read++;
+        }
+        if (!read) {
+            return false;
+        }
+    }
+
+    // Decimal part
+    if (curr != s_end && *curr == '.') {
+        static const double pow_lut[]{
+            1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+        };
+        const int lut_entries = sizeof(pow_lut) / sizeof(pow_lut[0]);
+
+        curr++;
+        read = 1;
+        while (curr != s_end && *curr >= '0' && *curr <= '9') {
+            mantissa += static_cast<int>(*curr - '0') *
+                        (read < lut_entries ? pow_lut[read]
+                                            : std::pow(10.0, -read));
+            read++;
+            curr++;
+        }
+    } else if (curr == s_end || (*curr != 'e' && *curr != 'E')) {
+        goto assemble;
+    }
+
+    // Exponent part
+    if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
+        curr++;
+        if (curr != s_end && (*curr == '+' || *curr == '-')) {
+            exp_sign = *curr;
+            curr++;
+        } else if (curr == s_end || *curr < '0' || *curr > '9') {
+            return false;
+        }
+
+        read = 0;
+        while (curr != s_end && *curr >= '0' && *curr <= '9') {
+            if (exponent > 2147483647 / 10) {
+                return false;
+            }
+            exponent *= 10;
+            exponent += static_cast<int>(*curr - '0');
+            curr++;
+            read++;
+        }
+        exponent *= (exp_sign == '+' ? 1 : -1);
+        if (!read) {
+            return false;
+        }
+    }
+
+assemble:
+    *result = (sign == '+' ? 1 : -1) *
+              (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent),
+                                     exponent)
+                        : mantissa);
+    return true;
+}
+
+bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+// Parses the next whitespace separated real of the line, the same way
+// tinyobjloader does
+bool parse_real(const char*& token, const char* line_end, float* out) {
+    while (token < line_end && is_blank(*token)) {
+        token++;
+    }
+    const char* end = token;
+    while (end < line_end && !is_blank(*end) && *end != '\r') {
+        end++;
+    }
+    double value;
+    bool ok = parse_double(token, end, &value);
+    if (ok) {
+        *out = static_cast<float>(value);
+    }
+    token = end;
+    return ok;
+}
+
+// atoi() over a non null terminated buffer
+int parse_int(const char*& token, const char* line_end) {
+    int sign = 1;
+    if (token < line_end && (*token == '+' || *token == '-')) {
+        sign = *token == '-' ? -1 : 1;
+        token++;
+    }
+    int value = 0;
+    while (token < line_end && *token >= '0' && *token <= '9') {
+        value = value * 10 + (*token - '0');
+        token++;
+    }
+    return sign * value;
+}
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<float> positions;
+    std::vector<float> colors;
+    std::vector<float> normals;
+
+    // (position, normal) pairs of every face corner, a missing normal is -1
+    std::vector<int64_t> corners;
+    std::vector<uint8_t> face_sizes;
+    // Entries of `corners` that come from negative indices, and are relative
+    // to the first position/normal of the chunk until its offsets are known
+    std::vector<size_t> relative_corners;
+
+    size_t position_base;
+    size_t normal_base;
+
+    // Deduplicated within the chunk only
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    size_t index_base;
+
+    bool failed;
+};
+
+// One face corner, either "v", "v/vt", "v//vn" or "v/vt/vn"
+bool parse_corner(ObjChunk& chunk, const char*& token, const char* line_end) {
+    int64_t corner[2]{0, -1};
+    int64_t counts[2]{(int64_t)chunk.positions.size() / 3,
+                      (int64_t)chunk.normals.size() / 3};
+
+    auto fix_index = [&](int idx, size_t slot) {
+        if (idx > 0) {
+            corner[slot] = idx - 1;
+        } else if (idx < 0) {
+            corner[slot] = counts[slot] + idx;
+            chunk.relative_corners.push_back(chunk.corners.size() + slot);
+        }
+        return idx != 0;
+    };
+
+    auto skip = [&]() {
+        while (token < line_end && *token != '/' && !is_blank(*token) &&
+               *token != '\r') {
+            token++;
+        }
+    };
+
+    if (!fix_index(parse_int(token, line_end), 0)) {
+        return false;
+    }
+    skip();
+
+    if (token < line_end && *token == '/') {
+        token++;
+        if (token < line_end && *token == '/') {
+            // v//vn
+            token++;
+            if (!fix_index(parse_int(token, line_end), 1)) {
+                return false;
+            }
+            skip();
+        } else {
+            // v/vt or v/vt/vn, the texcoords are not used by the meshes
+            if (!parse_int(token, line_end)) {
+                return false;
+            }
+            skip();
+            if (token < line_end && *token == '/') {
+                token++;
+                if (!fix_index(parse_int(token, line_end), 1)) {
+                    return false;
+                }
+                skip();
+            }
+        }
+    }
+
+    chunk.corners.push_back(corner[0]);
+    chunk.corners.push_back(corner[1]);
+    return true;
+}
+
+void parse_chunk(ObjChunk& chunk) {
+    const char* line = chunk.begin;
+    while (line < chunk.end && !chunk.failed) {
+        const char* line_end = static_cast<const char*>(
+            memchr(line, '\n', chunk.end - line));
+        if (!line_end) {
+            line_end = chunk.end;
+        }
+
+        const char* token = line;
+        while (token < line_end && is_blank(*token)) {
+            token++;
+        }
+
+        if (line_end - token >= 2 && token[0] == 'v' && is_blank(token[1])) {
+            // Position, optionally followed by a color
+            token += 2;
+            float xyz[3]{};
+            for (float& f : xyz) {
+                parse_real(token, line_end, &f);
+            }
+            float rgb[3]{1.f, 1.f, 1.f};
+            size_t color_components = 0;
+            for (float& f : rgb) {
+                color_components += parse_real(token, line_end, &f);
+            }
+            if (color_components && color_components != 3) {
+                // "v x y z w", tinyobjloader has its own take on it
+                chunk.failed = true;
+            } else if (!color_components) {
+                rgb[0] = rgb[1] = rgb[2] = 1.f;
+            }
+            chunk.positions.insert(chunk.positions.end(), xyz, xyz + 3);
+            chunk.colors.insert(chunk.colors.end(), rgb, rgb + 3);
+        } else if (line_end - token >= 3 && token[0] == 'v' &&
+                   token[1] == 'n' && is_blank(token[2])) {
+            token += 3;
+            float xyz[3]{};
+            for (float& f : xyz) {
+                parse_real(token, line_end, &f);
+            }
+            chunk.normals.insert(chunk.normals.end(), xyz, xyz + 3);
+        } else if (line_end - token >= 2 && token[0] == 'f' &&
+                   is_blank(token[1])) {
+            token += 2;
+            size_t corners = 0;
+            while (true) {
+                while (token < line_end &&
+                       (is_blank(*token) || *token == '\r')) {
+                    token++;
+                }
+                if (token >= line_end) {
+                    break;
+                }
+                if (!parse_corner(chunk, token, line_end)) {
+                    chunk.failed = true;
+                    break;
+                }
+                corners++;
+            }
+            if (corners < 3 || corners > 4) {
+                chunk.failed = true;
+            }
+            chunk.face_sizes.push_back((uint8_t)corners);
+        }
+
+        line = line_end + 1;
+    }
+}
+
+}  // namespace
+
+std::optional<MeshData> load_obj_parallel(const char* directory,
+                                          const char* filename) {
+    const std::string inputfile = std::string(directory) + filename;
+    auto file = MappedFile::open(inputfile.c_str());
+    if (!file) {
+        return load_obj(directory, filename);
+    }
+
+    ThreadPool& pool = ThreadPool::global();
+    const char* data = static_cast<const char*>(file->data);
+    const char* data_end = data + file->size;
+
+    // Split the file in line aligned chunks
+    size_t chunk_count = std::clamp<size_t>(file->size / obj_min_chunk_size,
+                                            1, pool.size() * 4);
+    std::vector<ObjChunk> chunks(chunk_count);
+    const char* cursor = data;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const char* end = data + file->size * (i + 1) / chunk_count;
+        if (end < cursor) {
+            end = cursor;
+        }
+        const char* newline =
+            static_cast<const char*>(memchr(end, '\n', data_end - end));
+        end = (i + 1 == chunk_count || !newline) ? data_end : newline + 1;
+
+        chunks[i].begin = cursor;
+        chunks[i].end = end;
+        cursor = end;
+    }
+
+    pool.parallel_for(chunk_count, chunk_count,
+                      [&](size_t i, size_t, size_t) { parse_chunk(chunks[i]); });
+
+    // Offsets of every chunk in the global attribute arrays
+    size_t position_count = 0;
+    size_t normal_count = 0;
+    bool failed = false;
+    for (auto& chunk : chunks) {
+        chunk.position_base = position_count;
+        chunk.normal_base = normal_count;
+        position_count += chunk.positions.size() / 3;
+        normal_count += chunk.normals.size() / 3;
+        failed |= chunk.failed;
+    }
+
+    if (failed) {
+        file->destroy();
+        return load_obj(directory, filename);
+    }
+
+    std::vector<float> positions(position_count * 3);
+    std::vector<float> colors(position_count * 3);
+    std::vector<float> normals(normal_count * 3);
+
+    pool.parallel_for(chunk_count, chunk_count, [&](size_t i, size_t, size_t) {
+        ObjChunk& chunk = chunks[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(),
+                  positions.begin() + chunk.position_base * 3);
+        std::copy(chunk.colors.begin(), chunk.colors.end(),
+                  colors.begin() + chunk.position_base * 3);
+        std::copy(chunk.normals.begin(), chunk.normals.end(),
+                  normals.begin() + chunk.normal_base * 3);
+
+        for (size_t c : chunk.relative_corners) {
+            chunk.corners[c] +=
+                c % 2 ? chunk.normal_base : chunk.position_base;
+            // A relative normal must not turn into the "no normal" marker
+            chunk.failed |= chunk.corners[c] < 0;
+        }
+        for (size_t c = 0; c < chunk.corners.size(); c += 2) {
+            chunk.failed |= chunk.corners[c] < 0 ||
+                            chunk.corners[c] >= (int64_t)position_count ||
+                            chunk.corners[c + 1] < -1 ||
+                            chunk.corners[c + 1] >= (int64_t)normal_count;
+        }
+    });
+
+    for (auto& chunk : chunks) {
+        failed |= chunk.failed;
+    }
+    if (failed) {
+        file->destroy();
+        return load_obj(directory, filename);
+    }
+
+    // Triangulate, build the vertices and deduplicate them within each chunk
+    pool.parallel_for(chunk_count, chunk_count, [&](size_t i, size_t, size_t) {
+        ObjChunk& chunk = chunks[i];
+
+        std::unordered_map<Vertex, uint32_t> unique_vertices{};
+        auto emit = [&](size_t corner) {
+            int64_t v = chunk.corners[corner * 2];
+            int64_t vn = chunk.corners[corner * 2 + 1];
+
+            Vertex vertex{};
+            vertex.position = glm::vec3{positions[3 * v + 0],
+                                        positions[3 * v + 1],
+                                        positions[3 * v + 2]};
+            if (vn >= 0) {
+                vertex.normal = glm::vec3{normals[3 * vn + 0],
+                                          normals[3 * vn + 1],
+                                          normals[3 * vn + 2]};
+            }
+            vertex.color = glm::vec3{colors[3 * v + 0], colors[3 * v + 1],
+                                     colors[3 * v + 2]};
+
+            auto [it, inserted] = unique_vertices.try_emplace(
+                vertex, (uint32_t)chunk.vertices.size());
+            if (inserted) {
+                chunk.vertices.push_back(vertex);
+            }
+            chunk.indices.push_back(it->second);
+        };
+
+        size_t corner = 0;
+        for (uint8_t face_size : chunk.face_sizes) {
+            if (face_size == 3) {
+                emit(corner);
+                emit(corner + 1);
+                emit(corner + 2);
+            } else {
+                // Split the quad along its shorter diagonal, as
+                // tinyobjloader does
+                const float* p[4];
+                for (size_t k = 0; k < 4; k++) {
+                    p[k] = &positions[3 * chunk.corners[(corner + k) * 2]];
+                }
+                float e02[3]{p[2][0] - p[0][0], p[2][1] - p[0][1],
+                             p[2][2] - p[0][2]};
+                float e13[3]{p[3][0] - p[1][0], p[3][1] - p[1][1],
+                             p[3][2] - p[1][2]};
+                float sqr02 = e02[0] * e02[0] + e02[1] * e02[1] + e02[2] * e02[2];
+                float sqr13 = e13[0] * e13[0] + e13[1] * e13[1] + e13[2] * e13[2];
+
+                if (sqr02 < sqr13) {
+                    emit(corner);
+                    emit(corner + 1);
+                    emit(corner + 2);
+                    emit(corner);
+                    emit(corner + 2);
+                    emit(corner + 3);
+                } else {
+                    emit(corner);
+                    emit(corner + 1);
+                    emit(corner + 3);
+                    emit(corner + 1);
+                    emit(corner + 2);
+                    emit(corner + 3);
+                }
+            }
+            corner += face_size;
+        }
+    });
+
+    file->destroy();
+
+    MeshData out{};
+    size_t index_count = 0;
+    for (auto& chunk : chunks) {
+        chunk.index_base = index_count;
+        index_count += chunk.indices.size();
+    }
+    out.indices.resize(index_count);
+
+    // Merging the chunks in file order keeps the first-seen order of the
+    // vertices, so the result matches the serial loader exactly
+    std::vector<std::vector<uint32_t>> remaps(chunk_count);
+    std::unordered_map<Vertex, uint32_t> unique_vertices{};
+    for (size_t i = 0; i < chunk_count; i++) {
+        remaps[i].resize(chunks[i].vertices.size());
+        for (size_t v = 0; v < chunks[i].vertices.size(); v++) {
+            auto [it, inserted] = unique_vertices.try_emplace(
+                chunks[i].vertices[v], (uint32_t)out.vertices.size());
+            if (inserted) {
+                out.vertices.push_back(chunks[i].vertices[v]);
+            }
+            remaps[i][v] = it->second;
+        }
+    }
+
+    pool.parallel_for(chunk_count, chunk_count, [&](size_t i, size_t, size_t) {
+        ObjChunk& chunk = chunks[i];
+        for (size_t k = 0; k < chunk.indices.size(); k++) {
+            out.indices[chunk.index_base + k] = remaps[i][chunk.indices[k]];
+        }
+    });
+
+    return std::optional<MeshData>(std::move(out));
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <optional>
+
+#include "mesh.h"
+
+// Parses a wavefront OBJ file with tinyobjloader, triangulating faces and
+// deduplicating vertices.
+std::optional<MeshData> load_obj(const char* directory, const char* filename);
+
+// Same results as load_obj, but the file is mapped, split in line aligned
+// chunks and parsed on the global thread pool. Files using features the
+// parallel parser does not handle (n-gons with more than four corners,
+// vertices with a w component) fall back to load_obj.
+std::optional<MeshData> load_obj_parallel(const char* directory,
+                                          const char* filename);
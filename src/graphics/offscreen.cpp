@@ -0,0 +1,211 @@
+#include "offscreen.h"
+
+#include <cstdio>
+
+GraphicsOffscreenBuilder *GraphicsOffscreenBuilder::set_extent(
+    VkExtent2D extent) {
+    m_extent = extent;
+    return this;
+}
+
+GraphicsOffscreenBuilder *GraphicsOffscreenBuilder::set_image_count(
+    uint32_t count) {
+    m_image_count = count;
+    return this;
+}
+
+GraphicsOffscreenBuilder *GraphicsOffscreenBuilder::set_readback(
+    bool readback) {
+    m_readback = readback;
+    return this;
+}
+
+GraphicsOffscreen GraphicsOffscreenBuilder::build() {
+    GraphicsOffscreen out{};
+    out.m_device = m_device;
+    out.m_allocator = m_allocator;
+    out.extent = m_extent;
+    // Byte order of the PPM once the alpha is dropped
+    out.format = VK_FORMAT_R8G8B8A8_UNORM;
+    out.depth_format = VK_FORMAT_D32_SFLOAT;
+
+    out.images.resize(m_image_count);
+    out.views.resize(m_image_count);
+    out.m_allocations.resize(m_image_count);
+    out.depth_images.resize(m_image_count);
+    out.depth_views.resize(m_image_count);
+    out.m_depth_allocations.resize(m_image_count);
+
+    VmaAllocationCreateInfo image_alloc_info{
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+
+    for (uint32_t i = 0; i < m_image_count; i++) {
+        VkImageCreateInfo color_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = out.format,
+            .extent =
+                VkExtent3D{
+                    .width = m_extent.width,
+                    .height = m_extent.height,
+                    .depth = 1,
+                },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        };
+        assert(!vmaCreateImage(m_allocator, &color_info, &image_alloc_info,
+                               &out.images[i], &out.m_allocations[i],
+                               nullptr));
+
+        VkImageViewCreateInfo view_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = out.images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = out.format,
+            .subresourceRange{
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .levelCount = 1,
+                .layerCount = 1,
+            },
+        };
+        assert(
+            !vkCreateImageView(m_device, &view_info, nullptr, &out.views[i]));
+
+        VkImageCreateInfo depth_info = color_info;
+        depth_info.format = out.depth_format;
+        depth_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        assert(!create_transient_image(m_allocator, depth_info,
+                                       &out.depth_images[i],
+                                       &out.m_depth_allocations[i]));
+
+        VkImageViewCreateInfo depth_view_info = view_info;
+        depth_view_info.image = out.depth_images[i];
+        depth_view_info.format = out.depth_format;
+        depth_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        assert(!vkCreateImageView(m_device, &depth_view_info, nullptr,
+                                  &out.depth_views[i]));
+    }
+
+    if (!m_readback) {
+        return out;
+    }
+
+    out.readback_buffers.resize(m_image_count);
+    out.readback_data.resize(m_image_count);
+    for (uint32_t i = 0; i < m_image_count; i++) {
+        VkBufferCreateInfo buffer_info{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = (VkDeviceSize)m_extent.width * m_extent.height * 4,
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        };
+        VmaAllocationCreateInfo buffer_alloc_info{
+            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                     VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            .usage = VMA_MEMORY_USAGE_AUTO,
+        };
+        VmaAllocationInfo info;
+        assert(!vmaCreateBuffer(m_allocator, &buffer_info, &buffer_alloc_info,
+                                &out.readback_buffers[i].buffer,
+                                &out.readback_buffers[i].allocation, &info));
+        out.readback_data[i] = static_cast<const uint8_t *>(info.pMappedData);
+    }
+
+    return out;
+}
+
+void GraphicsOffscreen::record_readback(VkCommandBuffer cmd_buf,
+                                        size_t index) {
+    // The render pass leaves the image in TRANSFER_SRC_OPTIMAL
+    VkImageMemoryBarrier to_transfer{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = images.at(index),
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .layerCount = 1,
+        },
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &to_transfer);
+
+    VkBufferImageCopy region{
+        .imageSubresource{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .layerCount = 1,
+        },
+        .imageExtent{
+            .width = extent.width,
+            .height = extent.height,
+            .depth = 1,
+        },
+    };
+    vkCmdCopyImageToBuffer(cmd_buf, images.at(index),
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readback_buffers.at(index).buffer, 1, &region);
+
+    VkMemoryBarrier to_host{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &to_host, 0,
+                         nullptr, 0, nullptr);
+}
+
+bool GraphicsOffscreen::write_ppm(size_t index, const char *path) {
+    vmaInvalidateAllocation(m_allocator, readback_buffers.at(index).allocation,
+                            0, VK_WHOLE_SIZE);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("failed to open %s\n", path);
+        return false;
+    }
+    bool ok = fprintf(file, "P6\n%u %u\n255\n", extent.width,
+                      extent.height) > 0;
+
+    const uint8_t *pixels = readback_data.at(index);
+    std::vector<uint8_t> row(extent.width * 3);
+    for (uint32_t y = 0; y < extent.height; y++) {
+        for (uint32_t x = 0; x < extent.width; x++) {
+            const uint8_t *pixel = pixels + ((size_t)y * extent.width + x) * 4;
+            row[x * 3 + 0] = pixel[0];
+            row[x * 3 + 1] = pixel[1];
+            row[x * 3 + 2] = pixel[2];
+        }
+        ok = ok && fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return !fclose(file) && ok;
+}
+
+void GraphicsOffscreen::destroy() {
+    for (auto &buffer : readback_buffers) {
+        vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+    }
+    readback_buffers.clear();
+    readback_data.clear();
+
+    for (size_t i = 0; i < images.size(); i++) {
+        vkDestroyImageView(m_device, depth_views[i], nullptr);
+        vmaDestroyImage(m_allocator, depth_images[i], m_depth_allocations[i]);
+        vkDestroyImageView(m_device, views[i], nullptr);
+        vmaDestroyImage(m_allocator, images[i], m_allocations[i]);
+    }
+    images.clear();
+    views.clear();
+    depth_images.clear();
+    depth_views.clear();
+}
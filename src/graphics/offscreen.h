@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "utils.h"
+
+// Color and depth images rendered to instead of a swapchain, one pair per
+// frame in flight. The color images can be copied to persistently mapped
+// buffers and saved once their frame is done.
+class GraphicsOffscreen {
+   public:
+    VkFormat format;
+    std::vector<VkImage> images;
+    std::vector<VkImageView> views;
+    VkFormat depth_format;
+    std::vector<VkImage> depth_images;
+    std::vector<VkImageView> depth_views;
+    VkExtent2D extent;
+    // Empty unless readback was enabled
+    std::vector<AllocatedBuffer> readback_buffers;
+    std::vector<const uint8_t *> readback_data;
+
+    // Copies the color image to its readback buffer, after the render pass
+    void record_readback(VkCommandBuffer cmd_buf, size_t index);
+    // Saves the last readback of an image as a binary PPM, once its frame is
+    // done
+    bool write_ppm(size_t index, const char *path);
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    std::vector<VmaAllocation> m_allocations;
+    std::vector<VmaAllocation> m_depth_allocations;
+
+    friend class GraphicsOffscreenBuilder;
+};
+
+class GraphicsOffscreenBuilder {
+   public:
+    GraphicsOffscreenBuilder(VmaAllocator allocator, VkDevice device)
+        : m_device(device),
+          m_allocator(allocator),
+          m_extent(),
+          m_image_count(2),
+          m_readback(false){};
+
+    GraphicsOffscreenBuilder *set_extent(VkExtent2D extent);
+    GraphicsOffscreenBuilder *set_image_count(uint32_t count);
+    GraphicsOffscreenBuilder *set_readback(bool readback);
+    GraphicsOffscreen build();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    VkExtent2D m_extent;
+    uint32_t m_image_count;
+    bool m_readback;
+};
@@ -3,80 +3,298 @@
 #include <vulkan/vulkan.h>
 
 #include <cstdio>
+#include <cstring>
+#include <utility>
 
+// The module is only created by build(), so that it runs on the thread that
+// compiles the pipeline
 GraphicsPipelineBuilder* GraphicsPipelineBuilder::add_shader(
     VkShaderStageFlagBits stage, const uint32_t buffer[], size_t size) {
-    VkShaderModule module;
-    VkShaderModuleCreateInfo createInfo{
+    shader_modules.push_back(VkShaderModuleCreateInfo{
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
         .codeSize = size,
         .pCode = buffer,
-    };
-    assert(!vkCreateShaderModule(device, &createInfo, nullptr, &module));
+    });
     VkPipelineShaderStageCreateInfo info{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = stage,
-        .module = module,
         .pName = "main",
     };
     shader_stages.push_back(info);
     return this;
 }
 
-GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_extent(
-    VkExtent2D extent) {
-    viewport.width = extent.width;
-    viewport.height = extent.height;
-    scissor.extent = extent;
-    return this;
-}
-
 GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_render_pass(
     VkRenderPass render_pass) {
     this->render_pass = render_pass;
     return this;
 }
 
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_rendering_formats(
+    VkFormat color, VkFormat depth) {
+    color_format = color;
+    rendering_info.depthAttachmentFormat = depth;
+    return this;
+}
+
 GraphicsPipelineBuilder* GraphicsPipelineBuilder::add_push_constant_range(
     VkPushConstantRange range) {
     push_constant_ranges.push_back(range);
     return this;
 }
 
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::add_descriptor_set_layout(
+    VkDescriptorSetLayout layout) {
+    descriptor_set_layouts.push_back(layout);
+    return this;
+}
+
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_pipeline_cache(
+    VkPipelineCache cache) {
+    pipeline_cache = cache;
+    return this;
+}
+
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_vertex_format(
+    VertexFormat format) {
+    switch (format) {
+        case VertexFormat::Float:
+            return set_vertex_layout<Vertex>();
+        case VertexFormat::Quantized:
+            return set_vertex_layout<QuantizedVertex>();
+    }
+    return this;
+}
+
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_depth_compare_op(
+    VkCompareOp op) {
+    depthstencil_info.depthCompareOp = op;
+    return this;
+}
+
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_alpha_blend(
+    VkBlendFactor src, VkBlendFactor dst) {
+    colorblend_attachment.blendEnable = VK_TRUE;
+    colorblend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorblend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorblend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorblend_attachment.srcAlphaBlendFactor = src;
+    colorblend_attachment.dstAlphaBlendFactor = dst;
+    colorblend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    return this;
+}
+
+GraphicsPipelineBuilder* GraphicsPipelineBuilder::set_registry(
+    GraphicsPipelineRegistry* registry) {
+    this->registry = registry;
+    return this;
+}
+
 GraphicsPipeline GraphicsPipelineBuilder::build() {
     GraphicsPipeline destination{};
     destination.device = device;
+    destination.shared = registry != nullptr;
 
-    auto bindings = Vertex::get_bindings();
-    auto attributes = Vertex::get_attributes();
+    for (size_t i = 0; i < shader_stages.size(); i++) {
+        if (registry) {
+            shader_stages[i].module = registry->shader_module(shader_modules[i]);
+        } else {
+            assert(!vkCreateShaderModule(device, &shader_modules[i], nullptr,
+                                         &shader_stages[i].module));
+        }
+    }
 
-    vertexinput_info.vertexBindingDescriptionCount = bindings.size();
-    vertexinput_info.pVertexBindingDescriptions = bindings.data();
-    vertexinput_info.vertexAttributeDescriptionCount = attributes.size();
-    vertexinput_info.pVertexAttributeDescriptions = attributes.data();
+    vertexinput_info.vertexBindingDescriptionCount = vertex_bindings.size();
+    vertexinput_info.pVertexBindingDescriptions = vertex_bindings.data();
+    vertexinput_info.vertexAttributeDescriptionCount =
+        vertex_attributes.size();
+    vertexinput_info.pVertexAttributeDescriptions = vertex_attributes.data();
 
     layout_info.pushConstantRangeCount = push_constant_ranges.size();
     layout_info.pPushConstantRanges = push_constant_ranges.data();
+    layout_info.setLayoutCount = descriptor_set_layouts.size();
+    layout_info.pSetLayouts = descriptor_set_layouts.data();
 
-    assert(!vkCreatePipelineLayout(device, &layout_info, nullptr,
-                                    &destination.layout));
+    if (registry) {
+        destination.layout = registry->pipeline_layout(layout_info);
+    } else {
+        assert(!vkCreatePipelineLayout(device, &layout_info, nullptr,
+                                        &destination.layout));
+    }
 
     pipeline_info.stageCount = shader_stages.size();
     pipeline_info.pStages = shader_stages.data();
     pipeline_info.layout = destination.layout;
     pipeline_info.renderPass = render_pass;
-    assert(!vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
-                                       &pipeline_info, nullptr,
-                                       &destination.pipeline));
+    pipeline_info.pNext = nullptr;
+    if (!render_pass) {
+        rendering_info.colorAttachmentCount = 1;
+        rendering_info.pColorAttachmentFormats = &color_format;
+        pipeline_info.pNext = &rendering_info;
+    }
+
+    auto create = [&]() {
+        VkPipeline pipeline;
+        assert(!vkCreateGraphicsPipelines(device, pipeline_cache, 1,
+                                           &pipeline_info, nullptr,
+                                           &pipeline));
+        return pipeline;
+    };
+    if (registry) {
+        destination.pipeline = registry->pipeline(state_key(), create);
+    } else {
+        destination.pipeline = create();
+        for (auto stage : shader_stages) {
+            vkDestroyShaderModule(device, stage.module, nullptr);
+        }
+    }
+
+    return destination;
+}
+
+// Every state the pipeline is created from, build() has filled the counts and
+// pointers of pipeline_info. Most of it is fixed by the constructor, but it
+// is part of the key so that new setters can not forget it.
+StateKey GraphicsPipelineBuilder::state_key() const {
+    StateKey key;
+    key.add(pipeline_info.layout)
+        .add(pipeline_info.renderPass)
+        .add(pipeline_info.subpass);
+    if (!pipeline_info.renderPass) {
+        key.add(color_format).add(rendering_info.depthAttachmentFormat);
+    }
+    for (const auto& stage : shader_stages) {
+        key.add(stage.stage).add(stage.module);
+        key.add_bytes(stage.pName, strlen(stage.pName) + 1);
+    }
+    key.add(pipeline_info.stageCount);
 
-    for (auto stage : shader_stages) {
-        vkDestroyShaderModule(device, stage.module, nullptr);
+    for (uint32_t i = 0; i < vertexinput_info.vertexBindingDescriptionCount;
+         i++) {
+        const auto& binding = vertexinput_info.pVertexBindingDescriptions[i];
+        key.add(binding.binding).add(binding.stride).add(binding.inputRate);
     }
+    for (uint32_t i = 0; i < vertexinput_info.vertexAttributeDescriptionCount;
+         i++) {
+        const auto& attribute =
+            vertexinput_info.pVertexAttributeDescriptions[i];
+        key.add(attribute.location)
+            .add(attribute.binding)
+            .add(attribute.format)
+            .add(attribute.offset);
+    }
+
+    key.add(inputassembly_info.topology)
+        .add(inputassembly_info.primitiveRestartEnable);
+    key.add(viewport_info.viewportCount).add(viewport_info.scissorCount);
+    for (VkDynamicState state : dynamic_states) {
+        key.add(state);
+    }
+    key.add(rasterization_info.depthClampEnable)
+        .add(rasterization_info.rasterizerDiscardEnable)
+        .add(rasterization_info.polygonMode)
+        .add(rasterization_info.cullMode)
+        .add(rasterization_info.frontFace)
+        .add(rasterization_info.depthBiasEnable)
+        .add(rasterization_info.lineWidth);
+    key.add(multisample_info.rasterizationSamples)
+        .add(multisample_info.sampleShadingEnable)
+        .add(multisample_info.minSampleShading);
+    key.add(depthstencil_info.depthTestEnable)
+        .add(depthstencil_info.depthWriteEnable)
+        .add(depthstencil_info.depthCompareOp)
+        .add(depthstencil_info.depthBoundsTestEnable)
+        .add(depthstencil_info.minDepthBounds)
+        .add(depthstencil_info.maxDepthBounds)
+        .add(depthstencil_info.stencilTestEnable);
+    key.add(colorblend_attachment.blendEnable)
+        .add(colorblend_attachment.srcColorBlendFactor)
+        .add(colorblend_attachment.dstColorBlendFactor)
+        .add(colorblend_attachment.colorBlendOp)
+        .add(colorblend_attachment.srcAlphaBlendFactor)
+        .add(colorblend_attachment.dstAlphaBlendFactor)
+        .add(colorblend_attachment.alphaBlendOp)
+        .add(colorblend_attachment.colorWriteMask);
+    key.add(colorblend_info.logicOpEnable).add(colorblend_info.logicOp);
+    return key;
+}
+
+GraphicsComputePipelineBuilder* GraphicsComputePipelineBuilder::set_shader(
+    const uint32_t buffer[], size_t size) {
+    VkShaderModuleCreateInfo createInfo{
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = size,
+        .pCode = buffer,
+    };
+    assert(!vkCreateShaderModule(device, &createInfo, nullptr, &shader_module));
+    return this;
+}
+
+GraphicsComputePipelineBuilder*
+GraphicsComputePipelineBuilder::add_push_constant_range(
+    VkPushConstantRange range) {
+    push_constant_ranges.push_back(range);
+    return this;
+}
+
+GraphicsComputePipelineBuilder*
+GraphicsComputePipelineBuilder::add_descriptor_set_layout(
+    VkDescriptorSetLayout layout) {
+    descriptor_set_layouts.push_back(layout);
+    return this;
+}
+
+GraphicsComputePipelineBuilder*
+GraphicsComputePipelineBuilder::set_pipeline_cache(VkPipelineCache cache) {
+    pipeline_cache = cache;
+    return this;
+}
+
+GraphicsPipeline GraphicsComputePipelineBuilder::build() {
+    GraphicsPipeline destination{};
+    destination.device = device;
+
+    layout_info.pushConstantRangeCount = push_constant_ranges.size();
+    layout_info.pPushConstantRanges = push_constant_ranges.data();
+    layout_info.setLayoutCount = descriptor_set_layouts.size();
+    layout_info.pSetLayouts = descriptor_set_layouts.data();
+
+    assert(!vkCreatePipelineLayout(device, &layout_info, nullptr,
+                                   &destination.layout));
+
+    pipeline_info.stage.module = shader_module;
+    pipeline_info.layout = destination.layout;
+    assert(!vkCreateComputePipelines(device, pipeline_cache, 1, &pipeline_info,
+                                     nullptr, &destination.pipeline));
+
+    vkDestroyShaderModule(device, shader_module, nullptr);
 
     return destination;
 }
 
+std::shared_future<GraphicsPipeline> GraphicsPipelineBatch::add(
+    std::unique_ptr<GraphicsPipelineBuilder> builder) {
+    std::shared_ptr<GraphicsPipelineBuilder> shared = std::move(builder);
+    std::shared_future<GraphicsPipeline> pipeline =
+        m_pool->submit([shared]() { return shared->build(); }).share();
+    m_pipelines.push_back(pipeline);
+    return pipeline;
+}
+
+std::vector<GraphicsPipeline> GraphicsPipelineBatch::wait() {
+    std::vector<GraphicsPipeline> out;
+    out.reserve(m_pipelines.size());
+    for (auto& pipeline : m_pipelines) {
+        out.push_back(pipeline.get());
+    }
+    m_pipelines.clear();
+    return out;
+}
+
 void GraphicsPipeline::destroy() {
+    if (shared) {
+        return;
+    }
     vkDestroyPipeline(device, pipeline, nullptr);
     vkDestroyPipelineLayout(device, layout, nullptr);
 }
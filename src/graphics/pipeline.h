@@ -3,9 +3,13 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
+#include <future>
+#include <memory>
 #include <vector>
 
 #include "mesh.h"
+#include "pipelineregistry.h"
+#include "threadpool.h"
 #include "utils.h"
 
 class GraphicsPipeline {
@@ -13,6 +17,8 @@ class GraphicsPipeline {
     VkDevice device;
     VkPipelineLayout layout;
     VkPipeline pipeline;
+    // Owned by a GraphicsPipelineRegistry, destroy() leaves it alone
+    bool shared;
 
     void destroy();
 };
@@ -21,19 +27,48 @@ class GraphicsPipelineBuilder {
    public:
     GraphicsPipelineBuilder* add_shader(VkShaderStageFlagBits stage,
                                         const uint32_t buffer[], size_t size);
-    GraphicsPipelineBuilder* set_extent(VkExtent2D extent);
     GraphicsPipelineBuilder* set_render_pass(VkRenderPass render_pass);
+    // Attachment formats of dynamic rendering, used when there is no render
+    // pass
+    GraphicsPipelineBuilder* set_rendering_formats(VkFormat color,
+                                                   VkFormat depth);
     GraphicsPipelineBuilder* add_push_constant_range(VkPushConstantRange range);
+    GraphicsPipelineBuilder* add_descriptor_set_layout(
+        VkDescriptorSetLayout layout);
+    GraphicsPipelineBuilder* set_pipeline_cache(VkPipelineCache cache);
+    // Vertex input of the meshes the pipeline draws, Vertex by default
+    template <typename V>
+    GraphicsPipelineBuilder* set_vertex_layout() {
+        vertex_bindings = VertexTraits<V>::bindings();
+        vertex_attributes = VertexTraits<V>::attributes();
+        return this;
+    }
+    GraphicsPipelineBuilder* set_vertex_format(VertexFormat format);
+    // LESS_OR_EQUAL by default
+    GraphicsPipelineBuilder* set_depth_compare_op(VkCompareOp op);
+    // Blends the alpha channel with these factors, the color is written as is
+    GraphicsPipelineBuilder* set_alpha_blend(VkBlendFactor src,
+                                             VkBlendFactor dst);
+    // Takes the shader modules, the layout and the pipeline from the
+    // registry, so that identical states share them
+    GraphicsPipelineBuilder* set_registry(GraphicsPipelineRegistry* registry);
     GraphicsPipeline build();
 
     GraphicsPipelineBuilder(VkDevice device)
         : device(device),
-          scissor(),
           render_pass(),
+          color_format(VK_FORMAT_UNDEFINED),
+          pipeline_cache(VK_NULL_HANDLE),
+          registry(nullptr),
           shader_stages(),
+          shader_modules(),
           push_constant_ranges(),
+          descriptor_set_layouts(),
+          vertex_bindings(VertexTraits<Vertex>::bindings()),
+          vertex_attributes(VertexTraits<Vertex>::attributes()),
 
-          viewport(VkViewport{.maxDepth = 1.f}),
+          dynamic_states({VK_DYNAMIC_STATE_VIEWPORT,
+                          VK_DYNAMIC_STATE_SCISSOR}),
 
           vertexinput_info(VkPipelineVertexInputStateCreateInfo{
               .sType =
@@ -56,12 +91,17 @@ class GraphicsPipelineBuilder {
               .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
               .minSampleShading = 1.0f}),
 
+          // The viewport and scissor are dynamic, so that the pipelines
+          // survive a resize
           viewport_info(VkPipelineViewportStateCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
               .viewportCount = 1,
-              .pViewports = &viewport,
-              .scissorCount = 1,
-              .pScissors = &scissor}),
+              .scissorCount = 1}),
+
+          dynamic_info(VkPipelineDynamicStateCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+              .dynamicStateCount = (uint32_t)dynamic_states.size(),
+              .pDynamicStates = dynamic_states.data()}),
 
           colorblend_attachment(VkPipelineColorBlendAttachmentState{
               .colorWriteMask =
@@ -90,6 +130,9 @@ class GraphicsPipelineBuilder {
           layout_info(VkPipelineLayoutCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO}),
 
+          rendering_info(VkPipelineRenderingCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO}),
+
           pipeline_info(VkGraphicsPipelineCreateInfo{
               .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
               .pVertexInputState = &vertexinput_info,
@@ -98,26 +141,101 @@ class GraphicsPipelineBuilder {
               .pRasterizationState = &rasterization_info,
               .pMultisampleState = &multisample_info,
               .pDepthStencilState = &depthstencil_info,
-              .pColorBlendState = &colorblend_info}) {}
+              .pColorBlendState = &colorblend_info,
+              .pDynamicState = &dynamic_info}) {}
 
    private:
-    VkRect2D scissor;
     VkRenderPass render_pass;
+    VkFormat color_format;
+    VkPipelineCache pipeline_cache;
+    GraphicsPipelineRegistry* registry;
     VkDevice device;
 
     std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
+    // Indexed like shader_stages
+    std::vector<VkShaderModuleCreateInfo> shader_modules;
     std::vector<VkPushConstantRange> push_constant_ranges;
+    std::vector<VkDescriptorSetLayout> descriptor_set_layouts;
+    std::vector<VkVertexInputBindingDescription> vertex_bindings;
+    std::vector<VkVertexInputAttributeDescription> vertex_attributes;
 
-    VkViewport viewport;
+    std::vector<VkDynamicState> dynamic_states;
 
     VkPipelineInputAssemblyStateCreateInfo inputassembly_info;
     VkPipelineVertexInputStateCreateInfo vertexinput_info;
     VkPipelineRasterizationStateCreateInfo rasterization_info;
     VkPipelineMultisampleStateCreateInfo multisample_info;
     VkPipelineViewportStateCreateInfo viewport_info;
+    VkPipelineDynamicStateCreateInfo dynamic_info;
     VkPipelineColorBlendAttachmentState colorblend_attachment;
     VkPipelineColorBlendStateCreateInfo colorblend_info;
     VkPipelineDepthStencilStateCreateInfo depthstencil_info;
     VkPipelineLayoutCreateInfo layout_info;
+    VkPipelineRenderingCreateInfo rendering_info;
     VkGraphicsPipelineCreateInfo pipeline_info;
+
+    StateKey state_key() const;
+};
+
+// Compiles graphics pipelines on a thread pool, each worker creating its
+// shader modules and calling vkCreateGraphicsPipelines for one pipeline at a
+// time. The builders can share a pipeline cache, which the driver
+// synchronizes internally.
+class GraphicsPipelineBatch {
+   public:
+    GraphicsPipelineBatch(ThreadPool& pool) : m_pool(&pool), m_pipelines(){};
+
+    // The builder points into itself, so it is added by pointer and kept
+    // alive until its pipeline is compiled. The future resolves at that point.
+    std::shared_future<GraphicsPipeline> add(
+        std::unique_ptr<GraphicsPipelineBuilder> builder);
+    // Waits for the pipelines added since the last call, in the order they
+    // were added
+    std::vector<GraphicsPipeline> wait();
+    size_t size() const { return m_pipelines.size(); };
+
+   private:
+    ThreadPool* m_pool;
+    std::vector<std::shared_future<GraphicsPipeline>> m_pipelines;
+};
+
+class GraphicsComputePipelineBuilder {
+   public:
+    GraphicsComputePipelineBuilder* set_shader(const uint32_t buffer[],
+                                               size_t size);
+    GraphicsComputePipelineBuilder* add_push_constant_range(
+        VkPushConstantRange range);
+    GraphicsComputePipelineBuilder* add_descriptor_set_layout(
+        VkDescriptorSetLayout layout);
+    GraphicsComputePipelineBuilder* set_pipeline_cache(VkPipelineCache cache);
+    GraphicsPipeline build();
+
+    GraphicsComputePipelineBuilder(VkDevice device)
+        : device(device),
+          shader_module(),
+          pipeline_cache(VK_NULL_HANDLE),
+          push_constant_ranges(),
+          descriptor_set_layouts(),
+
+          layout_info(VkPipelineLayoutCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO}),
+
+          pipeline_info(VkComputePipelineCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+              .stage = VkPipelineShaderStageCreateInfo{
+                  .sType =
+                      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                  .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                  .pName = "main"}}) {}
+
+   private:
+    VkDevice device;
+    VkShaderModule shader_module;
+    VkPipelineCache pipeline_cache;
+
+    std::vector<VkPushConstantRange> push_constant_ranges;
+    std::vector<VkDescriptorSetLayout> descriptor_set_layouts;
+
+    VkPipelineLayoutCreateInfo layout_info;
+    VkComputePipelineCreateInfo pipeline_info;
 };
@@ -0,0 +1,146 @@
+#include "pipelinecache.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+static const char pipeline_cache_magic[4]{'P', 'S', 'O', 'C'};
+static const uint32_t pipeline_cache_version = 1;
+
+static uint64_t fnv1a(const void* data, size_t size) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Returns the driver data of the file, if it is intact and was created by
+// the same driver and device
+static std::optional<std::vector<char>> load_cache_data(
+    const std::string& path, const VkPhysicalDeviceProperties& properties) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        return std::optional<std::vector<char>>{};
+    }
+
+    PipelineCacheFileHeader header{};
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+              !memcmp(header.magic, pipeline_cache_magic,
+                      sizeof(pipeline_cache_magic)) &&
+              header.version == pipeline_cache_version &&
+              header.data_size >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+              header.data_size < (1ull << 32);
+
+    std::vector<char> data;
+    if (ok) {
+        data.resize(header.data_size);
+        ok = fread(data.data(), 1, data.size(), in) == data.size() &&
+             fnv1a(data.data(), data.size()) == header.data_hash;
+    }
+    fclose(in);
+    if (!ok) {
+        printf("Pipeline cache %s is invalid, ignoring it\n", path.c_str());
+        return std::optional<std::vector<char>>{};
+    }
+
+    // Drivers are expected to reject foreign data, but not all of them do
+    VkPipelineCacheHeaderVersionOne driver_header;
+    memcpy(&driver_header, data.data(), sizeof(driver_header));
+    if (driver_header.headerSize < sizeof(driver_header) ||
+        driver_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        driver_header.vendorID != properties.vendorID ||
+        driver_header.deviceID != properties.deviceID ||
+        memcmp(driver_header.pipelineCacheUUID, properties.pipelineCacheUUID,
+               VK_UUID_SIZE)) {
+        printf("Pipeline cache %s belongs to another driver, ignoring it\n",
+               path.c_str());
+        return std::optional<std::vector<char>>{};
+    }
+    return data;
+}
+
+bool GraphicsPipelineCache::save() {
+    if (m_path.empty()) {
+        return false;
+    }
+
+    size_t size = 0;
+    assert(!vkGetPipelineCacheData(m_device, cache, &size, nullptr));
+    std::vector<char> data(size);
+    assert(!vkGetPipelineCacheData(m_device, cache, &size, data.data()));
+    data.resize(size);
+
+    PipelineCacheFileHeader header{
+        .version = pipeline_cache_version,
+        .data_size = data.size(),
+        .data_hash = fnv1a(data.data(), data.size()),
+    };
+    memcpy(header.magic, pipeline_cache_magic, sizeof(pipeline_cache_magic));
+
+    std::error_code error;
+    const std::string tmp_path = m_path + ".tmp";
+    FILE* out = fopen(tmp_path.c_str(), "wb");
+    if (!out) {
+        printf("Pipeline cache: cannot write %s\n", tmp_path.c_str());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(data.data(), 1, data.size(), out) == data.size();
+    ok = !fclose(out) && ok;
+
+    if (ok) {
+        std::filesystem::rename(tmp_path, m_path, error);
+        ok = !error;
+    }
+    if (!ok) {
+        printf("Pipeline cache: cannot write %s\n", m_path.c_str());
+        std::filesystem::remove(tmp_path, error);
+    }
+    return ok;
+}
+
+void GraphicsPipelineCache::destroy() {
+    vkDestroyPipelineCache(m_device, cache, nullptr);
+}
+
+GraphicsPipelineCacheBuilder* GraphicsPipelineCacheBuilder::set_path(
+    std::string path) {
+    m_path = path;
+    return this;
+}
+
+GraphicsPipelineCache GraphicsPipelineCacheBuilder::build() {
+    GraphicsPipelineCache out{};
+    out.m_device = m_device;
+    out.m_path = m_path;
+
+    std::optional<std::vector<char>> data;
+    if (!m_path.empty()) {
+        data = load_cache_data(m_path, m_properties);
+    }
+
+    VkPipelineCacheCreateInfo cache_info{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    };
+    if (data) {
+        cache_info.initialDataSize = data->size();
+        cache_info.pInitialData = data->data();
+    }
+    out.warm = data.has_value();
+
+    // The data passed the checks above, but the driver has the last word
+    if (vkCreatePipelineCache(m_device, &cache_info, nullptr, &out.cache)) {
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = nullptr;
+        out.warm = false;
+        assert(!vkCreatePipelineCache(m_device, &cache_info, nullptr,
+                                      &out.cache));
+    }
+    return out;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+// On-disk layout of a saved pipeline cache: the header is followed by the
+// data returned by vkGetPipelineCacheData, which starts with the
+// VkPipelineCacheHeaderVersionOne of the driver.
+struct PipelineCacheFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t data_size;
+    // Detects truncated or corrupted files before the driver parses them
+    uint64_t data_hash;
+};
+
+class GraphicsPipelineCache {
+   public:
+    VkPipelineCache cache;
+    // Whether the cache was created from data saved by a previous launch
+    bool warm;
+
+    // Writes the cache next to its final path first, then renames it, so that
+    // a crash never leaves a truncated cache behind
+    bool save();
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    std::string m_path;
+
+    friend class GraphicsPipelineCacheBuilder;
+};
+
+class GraphicsPipelineCacheBuilder {
+   public:
+    // The properties identify the driver and device the saved data was
+    // created by, data from another one is discarded
+    GraphicsPipelineCacheBuilder(VkDevice device,
+                                 const VkPhysicalDeviceProperties& properties)
+        : m_device(device), m_properties(properties), m_path(){};
+
+    // File the cache is loaded from and saved to, without one the cache only
+    // lives as long as the process
+    GraphicsPipelineCacheBuilder* set_path(std::string path);
+    GraphicsPipelineCache build();
+
+   private:
+    VkDevice m_device;
+    VkPhysicalDeviceProperties m_properties;
+    std::string m_path;
+};
@@ -0,0 +1,135 @@
+#include "pipelineregistry.h"
+
+#include <cassert>
+
+VkShaderModule GraphicsPipelineRegistry::shader_module(
+    const VkShaderModuleCreateInfo& info) {
+    std::string key(reinterpret_cast<const char*>(info.pCode), info.codeSize);
+
+    std::lock_guard<std::mutex> lock(*m_mutex);
+    m_stats.shader_module_requests++;
+    auto [it, inserted] = m_shader_modules.try_emplace(std::move(key));
+    if (inserted) {
+        assert(!vkCreateShaderModule(m_device, &info, nullptr, &it->second));
+        m_stats.shader_modules++;
+    }
+    return it->second;
+}
+
+VkDescriptorSetLayout GraphicsPipelineRegistry::descriptor_set_layout(
+    const VkDescriptorSetLayoutCreateInfo& info) {
+    StateKey key;
+    key.add(info.flags).add(info.bindingCount);
+    for (uint32_t i = 0; i < info.bindingCount; i++) {
+        const VkDescriptorSetLayoutBinding& binding = info.pBindings[i];
+        key.add(binding.binding)
+            .add(binding.descriptorType)
+            .add(binding.descriptorCount)
+            .add(binding.stageFlags);
+        bool samplers = binding.pImmutableSamplers != nullptr;
+        key.add(samplers);
+        for (uint32_t j = 0; samplers && j < binding.descriptorCount; j++) {
+            key.add(binding.pImmutableSamplers[j]);
+        }
+    }
+    using BindingFlags = VkDescriptorSetLayoutBindingFlagsCreateInfo;
+    auto next = static_cast<const VkBaseInStructure*>(info.pNext);
+    for (; next; next = next->pNext) {
+        if (next->sType ==
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO) {
+            auto flags = reinterpret_cast<const BindingFlags*>(next);
+            for (uint32_t i = 0; i < flags->bindingCount; i++) {
+                key.add(flags->pBindingFlags[i]);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(*m_mutex);
+    m_stats.set_layout_requests++;
+    auto [it, inserted] = m_set_layouts.try_emplace(std::move(key.bytes));
+    if (inserted) {
+        assert(!vkCreateDescriptorSetLayout(m_device, &info, nullptr,
+                                            &it->second));
+        m_stats.set_layouts++;
+    }
+    return it->second;
+}
+
+VkPipelineLayout GraphicsPipelineRegistry::pipeline_layout(
+    const VkPipelineLayoutCreateInfo& info) {
+    StateKey key;
+    key.add(info.flags);
+    for (uint32_t i = 0; i < info.setLayoutCount; i++) {
+        key.add(info.pSetLayouts[i]);
+    }
+    key.add(info.setLayoutCount);
+    for (uint32_t i = 0; i < info.pushConstantRangeCount; i++) {
+        const VkPushConstantRange& range = info.pPushConstantRanges[i];
+        key.add(range.stageFlags).add(range.offset).add(range.size);
+    }
+
+    std::lock_guard<std::mutex> lock(*m_mutex);
+    m_stats.layout_requests++;
+    auto [it, inserted] = m_layouts.try_emplace(std::move(key.bytes));
+    if (inserted) {
+        assert(!vkCreatePipelineLayout(m_device, &info, nullptr, &it->second));
+        m_stats.layouts++;
+    }
+    return it->second;
+}
+
+VkPipeline GraphicsPipelineRegistry::pipeline(
+    const StateKey& key, const std::function<VkPipeline()>& create) {
+    std::promise<VkPipeline> promise;
+    std::shared_future<VkPipeline> existing;
+    {
+        std::lock_guard<std::mutex> lock(*m_mutex);
+        m_stats.pipeline_requests++;
+        auto [it, inserted] = m_pipelines.try_emplace(key.bytes);
+        if (inserted) {
+            it->second = promise.get_future().share();
+            m_stats.pipelines++;
+        } else {
+            existing = it->second;
+        }
+    }
+    if (existing.valid()) {
+        return existing.get();
+    }
+
+    // Compiled without the lock, the other keys keep compiling meanwhile
+    VkPipeline pipeline = create();
+    promise.set_value(pipeline);
+    return pipeline;
+}
+
+GraphicsPipelineRegistry::Stats GraphicsPipelineRegistry::stats() {
+    std::lock_guard<std::mutex> lock(*m_mutex);
+    return m_stats;
+}
+
+void GraphicsPipelineRegistry::destroy() {
+    for (auto& [key, pipeline] : m_pipelines) {
+        vkDestroyPipeline(m_device, pipeline.get(), nullptr);
+    }
+    for (auto& [key, layout] : m_layouts) {
+        vkDestroyPipelineLayout(m_device, layout, nullptr);
+    }
+    for (auto& [key, module] : m_shader_modules) {
+        vkDestroyShaderModule(m_device, module, nullptr);
+    }
+    for (auto& [key, set_layout] : m_set_layouts) {
+        vkDestroyDescriptorSetLayout(m_device, set_layout, nullptr);
+    }
+    m_pipelines.clear();
+    m_layouts.clear();
+    m_set_layouts.clear();
+    m_shader_modules.clear();
+}
+
+GraphicsPipelineRegistry GraphicsPipelineRegistryBuilder::build() {
+    GraphicsPipelineRegistry out{};
+    out.m_device = m_device;
+    out.m_mutex = std::make_unique<std::mutex>();
+    return out;
+}
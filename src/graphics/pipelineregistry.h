@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+// Bytes of the state an object is created from. The registry compares whole
+// keys, a hash collision only costs a comparison.
+class StateKey {
+   public:
+    std::string bytes;
+
+    // Only scalars and handles, structs could bring uninitialized padding
+    template <typename T>
+    StateKey& add(const T& value) {
+        static_assert(std::is_scalar_v<T>, "StateKey only hashes scalars");
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        return *this;
+    };
+    StateKey& add_bytes(const void* data, size_t size) {
+        bytes.append(reinterpret_cast<const char*>(data), size);
+        return *this;
+    };
+};
+
+// Content addressed shader modules, descriptor set layouts, pipeline layouts
+// and graphics pipelines: requesting the same state twice returns the same
+// object. Safe to use from the pipeline compilation workers. Everything it
+// returns is destroyed by destroy().
+class GraphicsPipelineRegistry {
+   public:
+    struct Stats {
+        size_t shader_module_requests;
+        size_t shader_modules;
+        size_t set_layout_requests;
+        size_t set_layouts;
+        size_t layout_requests;
+        size_t layouts;
+        size_t pipeline_requests;
+        size_t pipelines;
+    };
+
+    VkShaderModule shader_module(const VkShaderModuleCreateInfo& info);
+    // Keyed by the bindings, their flags (the only extension looked at in
+    // pNext) and their immutable sampler handles
+    VkDescriptorSetLayout descriptor_set_layout(
+        const VkDescriptorSetLayoutCreateInfo& info);
+    // The set layouts are keyed by handle, the ones that come from
+    // descriptor_set_layout() are unique by content
+    VkPipelineLayout pipeline_layout(const VkPipelineLayoutCreateInfo& info);
+    // `create` only runs for the first request of a key, concurrent requests
+    // of that key wait for it
+    VkPipeline pipeline(const StateKey& key,
+                        const std::function<VkPipeline()>& create);
+    Stats stats();
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    std::unique_ptr<std::mutex> m_mutex;
+    std::unordered_map<std::string, VkShaderModule> m_shader_modules;
+    std::unordered_map<std::string, VkDescriptorSetLayout> m_set_layouts;
+    std::unordered_map<std::string, VkPipelineLayout> m_layouts;
+    std::unordered_map<std::string, std::shared_future<VkPipeline>>
+        m_pipelines;
+    Stats m_stats;
+
+    friend class GraphicsPipelineRegistryBuilder;
+};
+
+class GraphicsPipelineRegistryBuilder {
+   public:
+    GraphicsPipelineRegistryBuilder(VkDevice device) : m_device(device){};
+
+    GraphicsPipelineRegistry build();
+
+   private:
+    VkDevice m_device;
+};
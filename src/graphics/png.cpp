@@ -0,0 +1,442 @@
+#include "png.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mmap.h"
+
+namespace {
+
+// Reads the deflate stream LSB first
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    uint32_t bits;
+    uint32_t bit_count;
+    bool overrun;
+
+    uint32_t read(uint32_t count) {
+        while (bit_count < count) {
+            if (position == size) {
+                overrun = true;
+                return 0;
+            }
+            bits |= uint32_t(data[position++]) << bit_count;
+            bit_count += 8;
+        }
+        uint32_t out = bits & ((1u << count) - 1);
+        bits >>= count;
+        bit_count -= count;
+        return out;
+    }
+};
+
+// Canonical Huffman code, decoded one bit at a time: symbols are sorted by
+// code length, the codes of a length are consecutive
+struct Huffman {
+    uint16_t count[16];
+    uint16_t symbol[288];
+
+    // False for an over-subscribed set of lengths
+    bool build(const uint8_t* lengths, uint32_t n) {
+        memset(count, 0, sizeof(count));
+        for (uint32_t i = 0; i < n; i++) {
+            count[lengths[i]]++;
+        }
+        int left = 1;
+        for (int length = 1; length < 16; length++) {
+            left = (left << 1) - count[length];
+            if (left < 0) {
+                return false;
+            }
+        }
+        uint16_t offsets[16];
+        offsets[1] = 0;
+        for (int length = 1; length < 15; length++) {
+            offsets[length + 1] = offsets[length] + count[length];
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (lengths[i]) {
+                symbol[offsets[lengths[i]]++] = i;
+            }
+        }
+        return true;
+    }
+
+    // -1 when the stream is damaged
+    int decode(BitReader& reader) const {
+        int code = 0, first = 0, index = 0;
+        for (int length = 1; length < 16; length++) {
+            code |= reader.read(1);
+            int n = count[length];
+            if (code - first < n) {
+                return symbol[index + code - first];
+            }
+            index += n;
+            first = (first + n) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+// Base value and extra bits of the length and distance symbols
+const uint16_t length_base[]{3,  4,  5,  6,  7,  8,  9,  10,  11,  13,
+                             15, 17, 19, 23, 27, 31, 35, 43,  51,  59,
+                             67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t length_extra[]{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                             2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t distance_base[]{
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+const uint8_t distance_extra[]{0, 0, 0, 0, 1, 1, 2, 2,  3,  3,
+                               4, 4, 5, 5, 6, 6, 7, 7,  8,  8,
+                               9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+bool inflate_codes(BitReader& reader, const Huffman& lengths,
+                   const Huffman& distances, std::vector<uint8_t>& out) {
+    while (true) {
+        int symbol = lengths.decode(reader);
+        if (symbol < 0 || reader.overrun) {
+            return false;
+        }
+        if (symbol < 256) {
+            out.push_back(symbol);
+            continue;
+        }
+        if (symbol == 256) {
+            return true;
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        size_t length =
+            length_base[symbol] + reader.read(length_extra[symbol]);
+        int distance_symbol = distances.decode(reader);
+        if (distance_symbol < 0 || distance_symbol >= 30) {
+            return false;
+        }
+        size_t distance = distance_base[distance_symbol] +
+                          reader.read(distance_extra[distance_symbol]);
+        if (distance > out.size() || reader.overrun) {
+            return false;
+        }
+        // The source overlaps the bytes being written when the distance is
+        // shorter than the length, it then repeats with that period
+        size_t to = out.size();
+        out.resize(to + length);
+        uint8_t* data = out.data();
+        while (length) {
+            size_t n = std::min(length, distance);
+            memcpy(data + to, data + to - distance, n);
+            to += n;
+            length -= n;
+            distance += n;
+        }
+    }
+}
+
+// zlib stream (RFC 1950) holding deflate blocks (RFC 1951). The adler32
+// checksum is not verified, the PNG chunks have their own CRC.
+bool inflate_zlib(std::span<const uint8_t> in, std::vector<uint8_t>& out) {
+    if (in.size() < 2 || (in[0] & 0x0f) != 8 ||
+        ((in[0] << 8) | in[1]) % 31 || (in[1] & 0x20)) {
+        return false;
+    }
+    BitReader reader{in.data(), in.size(), 2, 0, 0, false};
+
+    Huffman fixed_lengths, fixed_distances;
+    {
+        uint8_t lengths[288];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        fixed_lengths.build(lengths, 288);
+        memset(lengths, 5, 30);
+        fixed_distances.build(lengths, 30);
+    }
+
+    bool last = false;
+    while (!last) {
+        last = reader.read(1);
+        uint32_t type = reader.read(2);
+        if (type == 0) {
+            // Stored, starts on a byte boundary
+            reader.bits = 0;
+            reader.bit_count = 0;
+            if (reader.position + 4 > reader.size) {
+                return false;
+            }
+            const uint8_t* p = reader.data + reader.position;
+            uint32_t length = p[0] | (p[1] << 8);
+            uint32_t inverse = p[2] | (p[3] << 8);
+            reader.position += 4;
+            if ((length ^ 0xffff) != inverse ||
+                reader.position + length > reader.size) {
+                return false;
+            }
+            out.insert(out.end(), reader.data + reader.position,
+                       reader.data + reader.position + length);
+            reader.position += length;
+        } else if (type == 1) {
+            if (!inflate_codes(reader, fixed_lengths, fixed_distances, out)) {
+                return false;
+            }
+        } else if (type == 2) {
+            uint32_t length_count = reader.read(5) + 257;
+            uint32_t distance_count = reader.read(5) + 1;
+            uint32_t code_count = reader.read(4) + 4;
+            if (length_count > 286 || distance_count > 30) {
+                return false;
+            }
+
+            const uint8_t order[19]{16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                    11, 4,  12, 3, 13, 2, 14, 1, 15};
+            uint8_t code_lengths[19]{};
+            for (uint32_t i = 0; i < code_count; i++) {
+                code_lengths[order[i]] = reader.read(3);
+            }
+            Huffman codes;
+            if (!codes.build(code_lengths, 19)) {
+                return false;
+            }
+
+            uint8_t lengths[286 + 30]{};
+            uint32_t n = 0;
+            while (n < length_count + distance_count) {
+                int symbol = codes.decode(reader);
+                if (symbol < 0 || reader.overrun) {
+                    return false;
+                }
+                if (symbol < 16) {
+                    lengths[n++] = symbol;
+                    continue;
+                }
+                uint8_t value = 0;
+                uint32_t repeat;
+                if (symbol == 16) {
+                    if (!n) {
+                        return false;
+                    }
+                    value = lengths[n - 1];
+                    repeat = 3 + reader.read(2);
+                } else if (symbol == 17) {
+                    repeat = 3 + reader.read(3);
+                } else {
+                    repeat = 11 + reader.read(7);
+                }
+                if (n + repeat > length_count + distance_count) {
+                    return false;
+                }
+                memset(lengths + n, value, repeat);
+                n += repeat;
+            }
+
+            Huffman dynamic_lengths, dynamic_distances;
+            if (!dynamic_lengths.build(lengths, length_count) ||
+                !dynamic_distances.build(lengths + length_count,
+                                         distance_count) ||
+                !inflate_codes(reader, dynamic_lengths, dynamic_distances,
+                               out)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        if (reader.overrun) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t read_be32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+           (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int p = int(a) + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+}  // namespace
+
+std::optional<ImageData> decode_png(std::span<const uint8_t> file) {
+    const uint8_t signature[8]{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (file.size() < 8 || memcmp(file.data(), signature, 8)) {
+        printf("not a PNG file\n");
+        return std::nullopt;
+    }
+
+    uint32_t width = 0, height = 0;
+    uint8_t color_type = 0;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> palette_alpha;
+    std::vector<uint8_t> compressed;
+    size_t position = 8;
+    while (position + 12 <= file.size()) {
+        const uint8_t* chunk = file.data() + position;
+        uint32_t length = read_be32(chunk);
+        if (length > file.size() - position - 12) {
+            printf("truncated PNG chunk\n");
+            return std::nullopt;
+        }
+        const uint8_t* data = chunk + 8;
+        if (!memcmp(chunk + 4, "IHDR", 4) && length >= 13) {
+            width = read_be32(data);
+            height = read_be32(data + 4);
+            color_type = data[9];
+            uint8_t bit_depth = data[8];
+            uint8_t interlace = data[12];
+            if (bit_depth != 8 || interlace ||
+                (color_type != 0 && color_type != 2 && color_type != 3 &&
+                 color_type != 4 && color_type != 6)) {
+                printf(
+                    "unsupported PNG (bit depth %u, color type %u, interlace "
+                    "%u)\n",
+                    bit_depth, color_type, interlace);
+                return std::nullopt;
+            }
+        } else if (!memcmp(chunk + 4, "PLTE", 4)) {
+            palette.assign(data, data + length);
+        } else if (!memcmp(chunk + 4, "tRNS", 4)) {
+            palette_alpha.assign(data, data + length);
+        } else if (!memcmp(chunk + 4, "IDAT", 4)) {
+            compressed.insert(compressed.end(), data, data + length);
+        } else if (!memcmp(chunk + 4, "IEND", 4)) {
+            break;
+        }
+        position += length + 12;
+    }
+    if (!width || !height || compressed.empty()) {
+        printf("PNG without image data\n");
+        return std::nullopt;
+    }
+
+    const uint32_t channels[]{1, 0, 3, 1, 2, 0, 4};
+    size_t pixel_size = channels[color_type];
+    size_t stride = width * pixel_size;
+
+    // Every row starts with its filter type
+    std::vector<uint8_t> filtered;
+    filtered.reserve((stride + 1) * height);
+    if (!inflate_zlib(compressed, filtered) ||
+        filtered.size() < (stride + 1) * height) {
+        printf("damaged PNG image data\n");
+        return std::nullopt;
+    }
+
+    ImageData out{.width = width, .height = height};
+    out.pixels.resize(size_t(width) * height * 4);
+
+    // RGBA rows are unfiltered in place, the others in two row buffers and
+    // then expanded
+    std::vector<uint8_t> row_buffers(pixel_size == 4 ? 0 : stride * 2);
+    std::vector<uint8_t> zero_row(stride);
+    const uint8_t* up = zero_row.data();
+    for (size_t y = 0; y < height; y++) {
+        uint8_t filter = filtered[y * (stride + 1)];
+        const uint8_t* in = filtered.data() + y * (stride + 1) + 1;
+        uint8_t* row = pixel_size == 4
+                           ? out.pixels.data() + y * stride
+                           : row_buffers.data() + (y & 1) * stride;
+        // The first pixel has no left neighbour
+        switch (filter) {
+            case 0:
+                memcpy(row, in, stride);
+                break;
+            case 1:
+                memcpy(row, in, pixel_size);
+                for (size_t x = pixel_size; x < stride; x++) {
+                    row[x] = in[x] + row[x - pixel_size];
+                }
+                break;
+            case 2:
+                for (size_t x = 0; x < stride; x++) {
+                    row[x] = in[x] + up[x];
+                }
+                break;
+            case 3:
+                for (size_t x = 0; x < pixel_size; x++) {
+                    row[x] = in[x] + (up[x] >> 1);
+                }
+                for (size_t x = pixel_size; x < stride; x++) {
+                    row[x] = in[x] + ((row[x - pixel_size] + up[x]) >> 1);
+                }
+                break;
+            case 4:
+                for (size_t x = 0; x < pixel_size; x++) {
+                    row[x] = in[x] + up[x];
+                }
+                for (size_t x = pixel_size; x < stride; x++) {
+                    row[x] = in[x] + paeth(row[x - pixel_size], up[x],
+                                           up[x - pixel_size]);
+                }
+                break;
+            default:
+                printf("unknown PNG filter %u\n", filter);
+                return std::nullopt;
+        }
+        up = row;
+
+        uint8_t* dst = out.pixels.data() + y * width * 4;
+        switch (color_type) {
+            case 0:
+                for (size_t x = 0; x < width; x++) {
+                    dst[x * 4 + 0] = dst[x * 4 + 1] = dst[x * 4 + 2] = row[x];
+                    dst[x * 4 + 3] = 255;
+                }
+                break;
+            case 2:
+                for (size_t x = 0; x < width; x++) {
+                    memcpy(dst + x * 4, row + x * 3, 3);
+                    dst[x * 4 + 3] = 255;
+                }
+                break;
+            case 3:
+                for (size_t x = 0; x < width; x++) {
+                    size_t entry = row[x];
+                    if (entry * 3 + 3 > palette.size()) {
+                        printf("PNG palette index out of range\n");
+                        return std::nullopt;
+                    }
+                    memcpy(dst + x * 4, palette.data() + entry * 3, 3);
+                    dst[x * 4 + 3] = entry < palette_alpha.size()
+                                         ? palette_alpha[entry]
+                                         : 255;
+                }
+                break;
+            case 4:
+                for (size_t x = 0; x < width; x++) {
+                    dst[x * 4 + 0] = dst[x * 4 + 1] = dst[x * 4 + 2] =
+                        row[x * 2];
+                    dst[x * 4 + 3] = row[x * 2 + 1];
+                }
+                break;
+        }
+    }
+    return out;
+}
+
+std::optional<ImageData> load_png(const char* path) {
+    std::optional<MappedFile> file = MappedFile::open(path);
+    if (!file) {
+        printf("could not open %s\n", path);
+        return std::nullopt;
+    }
+    std::optional<ImageData> out = decode_png(std::span<const uint8_t>(
+        static_cast<const uint8_t*>(file->data), file->size));
+    file->destroy();
+    return out;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include "image.h"
+
+// Decodes a non interlaced PNG with 8 bit channels (gray, gray and alpha,
+// RGB, RGBA or palette) to RGBA. Other variants are reported and rejected.
+std::optional<ImageData> load_png(const char* path);
+std::optional<ImageData> decode_png(std::span<const uint8_t> file);
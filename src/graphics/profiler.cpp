@@ -0,0 +1,274 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+static uint64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void ProfileRing::push(const ProfileZone& zone) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    zones[h % capacity] = zone;
+    head.store(h + 1, std::memory_order_release);
+}
+
+std::vector<ProfileZone> ProfileRing::snapshot() const {
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+
+    std::vector<ProfileZone> out;
+    out.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++) {
+        out.push_back(zones[i % capacity]);
+    }
+
+    // The owner may have kept pushing while copying, drop the zones it could
+    // have overwritten
+    uint64_t after = head.load(std::memory_order_acquire);
+    uint64_t overwritten =
+        after > capacity ? std::min(after - capacity, end) : 0;
+    if (overwritten > begin) {
+        out.erase(out.begin(), out.begin() + (overwritten - begin));
+    }
+    return out;
+}
+
+void RollingStats::add(float sample) {
+    m_samples[m_count % m_samples.size()] = sample;
+    m_count++;
+}
+
+RollingStats::Summary RollingStats::summary() const {
+    size_t count = std::min(m_count, m_samples.size());
+    if (count == 0) {
+        return {};
+    }
+
+    std::array<float, 512> sorted;
+    std::copy(m_samples.begin(), m_samples.begin() + count, sorted.begin());
+    std::sort(sorted.begin(), sorted.begin() + count);
+
+    float sum = 0.f;
+    for (size_t i = 0; i < count; i++) {
+        sum += sorted[i];
+    }
+
+    return Summary{
+        .min = sorted[0],
+        .avg = sum / count,
+        .p99 = sorted[std::min(count - 1, count * 99 / 100)],
+        .count = count,
+    };
+}
+
+Profiler& Profiler::global() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+    : m_enabled(true),
+      m_start_ns(steady_ns()),
+      m_rings_mutex(),
+      m_rings(),
+      m_gpu_ring(std::make_unique<ProfileRing>()) {
+    m_gpu_ring->head = 0;
+    m_gpu_ring->thread_id = 0;
+    m_gpu_ring->thread_name = "gpu";
+}
+
+uint64_t Profiler::now_ns() const { return steady_ns() - m_start_ns; }
+
+ProfileRing& Profiler::thread_ring() {
+    // The lock is only taken the first time a thread records a zone
+    thread_local ProfileRing* ring = nullptr;
+    if (!ring) {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        m_rings.push_back(std::make_unique<ProfileRing>());
+        ring = m_rings.back().get();
+        ring->head = 0;
+        ring->thread_id = m_rings.size();
+        ring->thread_name = ring->thread_id == 1 ? "main" : "worker";
+    }
+    return *ring;
+}
+
+void Profiler::add_gpu_zone(const ProfileZone& zone) {
+    if (enabled()) {
+        m_gpu_ring->push(zone);
+    }
+}
+
+static void write_events(FILE* file, const ProfileRing& ring, bool& first) {
+    fprintf(file,
+            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+            "\"args\":{\"name\":\"%s %u\"}}",
+            first ? "" : ",", ring.thread_id, ring.thread_name,
+            ring.thread_id);
+    first = false;
+
+    for (const ProfileZone& zone : ring.snapshot()) {
+        fprintf(file,
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                zone.name, ring.thread_id, zone.begin_ns / 1000.0,
+                (zone.end_ns - zone.begin_ns) / 1000.0);
+    }
+}
+
+bool Profiler::write_trace(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Could not write trace %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[");
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        for (auto& ring : m_rings) {
+            write_events(file, *ring, first);
+        }
+    }
+    write_events(file, *m_gpu_ring, first);
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+ProfileScope::~ProfileScope() {
+    Profiler& profiler = Profiler::global();
+    if (m_begin_ns && profiler.enabled()) {
+        profiler.thread_ring().push(ProfileZone{
+            .name = m_name,
+            .begin_ns = m_begin_ns,
+            .end_ns = profiler.now_ns(),
+        });
+    }
+}
+
+void GraphicsProfiler::begin_frame(VkCommandBuffer cmd_buf, size_t frame) {
+    if (!enabled()) {
+        return;
+    }
+    m_frames[frame].names.clear();
+    m_frames[frame].cpu_begin_ns = Profiler::global().now_ns();
+    vkCmdResetQueryPool(cmd_buf, m_pools[frame], 0, m_max_zones * 2);
+}
+
+uint32_t GraphicsProfiler::begin_zone(VkCommandBuffer cmd_buf, size_t frame,
+                                      const char* name) {
+    if (!enabled()) {
+        return 0;
+    }
+    Frame& data = m_frames[frame];
+    assert(data.names.size() < m_max_zones);
+
+    uint32_t zone = data.names.size();
+    data.names.push_back(name);
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        m_pools[frame], zone * 2);
+    return zone;
+}
+
+void GraphicsProfiler::end_zone(VkCommandBuffer cmd_buf, size_t frame,
+                                uint32_t zone) {
+    if (!enabled()) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        m_pools[frame], zone * 2 + 1);
+}
+
+double GraphicsProfiler::collect(size_t frame) {
+    if (!enabled() || m_frames[frame].names.empty()) {
+        return -1.0;
+    }
+    Frame& data = m_frames[frame];
+
+    // The fence of the frame was waited, so the results are available
+    // without VK_QUERY_RESULT_WAIT_BIT
+    std::vector<uint64_t> ticks(data.names.size() * 2);
+    VkResult result = vkGetQueryPoolResults(
+        m_device, m_pools[frame], 0, ticks.size(),
+        ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        data.names.clear();
+        return -1.0;
+    }
+
+    auto elapsed_ns = [&](uint64_t from, uint64_t to) {
+        return ((to - from) & m_valid_mask) * m_ns_per_tick;
+    };
+
+    // The gpu clock has its own origin, the zones are placed on the cpu
+    // timeline starting when the frame began recording
+    uint64_t origin = ticks[0];
+    for (size_t i = 0; i < data.names.size(); i++) {
+        uint64_t begin = data.cpu_begin_ns +
+                         (uint64_t)elapsed_ns(origin, ticks[i * 2]);
+        uint64_t end = data.cpu_begin_ns +
+                       (uint64_t)elapsed_ns(origin, ticks[i * 2 + 1]);
+        Profiler::global().add_gpu_zone(ProfileZone{
+            .name = data.names[i],
+            .begin_ns = begin,
+            .end_ns = std::max(begin, end),
+        });
+    }
+
+    double first_ms = elapsed_ns(ticks[0], ticks[1]) / 1e6;
+    data.names.clear();
+    return first_ms;
+}
+
+void GraphicsProfiler::destroy() {
+    for (VkQueryPool pool : m_pools) {
+        vkDestroyQueryPool(m_device, pool, nullptr);
+    }
+    m_pools.clear();
+    m_frames.clear();
+}
+
+GraphicsProfilerBuilder* GraphicsProfilerBuilder::set_max_zones(
+    uint32_t count) {
+    m_max_zones = count;
+    return this;
+}
+
+GraphicsProfiler GraphicsProfilerBuilder::build() {
+    GraphicsProfiler out{};
+    out.m_device = m_device;
+    out.m_max_zones = m_max_zones;
+    out.m_ns_per_tick = m_timestamp_period;
+    out.m_valid_mask =
+        m_valid_bits >= 64 ? ~0ull : (1ull << m_valid_bits) - 1;
+
+    if (m_valid_bits == 0) {
+        printf("The queue has no timestamps, gpu profiling is disabled\n");
+        return out;
+    }
+
+    VkQueryPoolCreateInfo pool_info{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = m_max_zones * 2,
+    };
+
+    out.m_pools.resize(m_frame_count);
+    out.m_frames.resize(m_frame_count);
+    for (uint32_t i = 0; i < m_frame_count; i++) {
+        assert(!vkCreateQueryPool(m_device, &pool_info, nullptr,
+                                  &out.m_pools[i]));
+    }
+
+    return out;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct ProfileZone {
+    // Must outlive the profiler, in practice a string literal
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+// Zones of a single thread. Only that thread writes, and publishes each zone
+// by bumping `head`, so neither side takes a lock. Old zones are overwritten.
+struct ProfileRing {
+    static const size_t capacity = 1 << 14;
+
+    std::array<ProfileZone, capacity> zones;
+    std::atomic<uint64_t> head;
+    uint32_t thread_id;
+    const char* thread_name;
+
+    void push(const ProfileZone& zone);
+    // The zones that were not overwritten, oldest first
+    std::vector<ProfileZone> snapshot() const;
+};
+
+// Keeps the last samples of a series (e.g. frame times) for min/avg/p99
+class RollingStats {
+   public:
+    struct Summary {
+        float min;
+        float avg;
+        float p99;
+        size_t count;
+    };
+
+    void add(float sample);
+    void clear() { m_count = 0; };
+    Summary summary() const;
+
+   private:
+    std::array<float, 512> m_samples{};
+    size_t m_count{0};
+};
+
+// Process wide collector of the cpu zones, and of the gpu zones once they
+// have been read back
+class Profiler {
+   public:
+    static Profiler& global();
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); };
+    void set_enabled(bool enabled) { m_enabled = enabled; };
+
+    // Nanoseconds since the profiler was created
+    uint64_t now_ns() const;
+    // Ring of the calling thread, registered on first use
+    ProfileRing& thread_ring();
+    void add_gpu_zone(const ProfileZone& zone);
+
+    // Writes every zone that is still buffered as Chrome trace events
+    // (chrome://tracing, ui.perfetto.dev)
+    bool write_trace(const char* path);
+
+   private:
+    Profiler();
+
+    std::atomic<bool> m_enabled;
+    uint64_t m_start_ns;
+    std::mutex m_rings_mutex;
+    std::vector<std::unique_ptr<ProfileRing>> m_rings;
+    std::unique_ptr<ProfileRing> m_gpu_ring;
+};
+
+// Records the lifetime of the scope as a zone of the calling thread
+class ProfileScope {
+   public:
+    ProfileScope(const char* name)
+        : m_name(name),
+          m_begin_ns(Profiler::global().enabled() ? Profiler::global().now_ns()
+                                                  : 0){};
+    ~ProfileScope();
+
+   private:
+    const char* m_name;
+    uint64_t m_begin_ns;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+// Gpu timestamps of the frames in flight, one query pool each. The zones of
+// a frame are read back once its fence was waited, and handed to
+// Profiler::global().
+class GraphicsProfiler {
+   public:
+    // Resets the queries of the frame, outside of a render pass
+    void begin_frame(VkCommandBuffer cmd_buf, size_t frame);
+    // Returns the zone to end, outside of render passes recorded from
+    // secondary command buffers
+    uint32_t begin_zone(VkCommandBuffer cmd_buf, size_t frame,
+                        const char* name);
+    void end_zone(VkCommandBuffer cmd_buf, size_t frame, uint32_t zone);
+    // Reads back the zones of a frame whose fence was waited, returns the
+    // duration of its first zone in milliseconds, or a negative value
+    double collect(size_t frame);
+    bool enabled() const { return !m_pools.empty(); };
+    void destroy();
+
+   private:
+    struct Frame {
+        std::vector<const char*> names;
+        // Cpu time of begin_frame(), the gpu zones are placed relative to it
+        uint64_t cpu_begin_ns;
+    };
+
+    VkDevice m_device;
+    std::vector<VkQueryPool> m_pools;
+    std::vector<Frame> m_frames;
+    uint32_t m_max_zones;
+    double m_ns_per_tick;
+    uint64_t m_valid_mask;
+
+    friend class GraphicsProfilerBuilder;
+};
+
+class GraphicsProfilerBuilder {
+   public:
+    // `timestamp_period` from the device limits, `valid_bits` from the queue
+    // family the frames are submitted to. Without valid bits the profiler is
+    // built disabled.
+    GraphicsProfilerBuilder(VkDevice device, float timestamp_period,
+                            uint32_t valid_bits, uint32_t frame_count)
+        : m_device(device),
+          m_timestamp_period(timestamp_period),
+          m_valid_bits(valid_bits),
+          m_frame_count(frame_count),
+          m_max_zones(16){};
+
+    GraphicsProfilerBuilder* set_max_zones(uint32_t count);
+    GraphicsProfiler build();
+
+   private:
+    VkDevice m_device;
+    float m_timestamp_period;
+    uint32_t m_valid_bits;
+    uint32_t m_frame_count;
+    uint32_t m_max_zones;
+};
@@ -1,32 +1,254 @@
 #include "render.h"
 
+#include <utility>
+
 #include "utils.h"
 
 void GraphicsRender::destroy() {
-    vkDestroyRenderPass(m_device, renderpass, nullptr);
+    if (renderpass) {
+        vkDestroyRenderPass(m_device, renderpass, nullptr);
+    }
     for (auto framebuffer : framebuffers) {
         vkDestroyFramebuffer(m_device, framebuffer, nullptr);
     }
 }
 
+void GraphicsRender::begin(VkCommandBuffer cmd_buf, uint32_t image,
+                           VkExtent2D extent, bool secondary) {
+    VkClearValue clear_values[]{
+        // color
+        VkClearValue{.color{.float32{.0f, 0.f, 0.f, 0.f}}},
+        // depth
+        VkClearValue{
+            .depthStencil{.depth = 1.f},
+        }};
+
+    if (renderpass) {
+        VkRenderPassBeginInfo renderpass_begin_info{
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = renderpass,
+            .framebuffer = framebuffers[image],
+            .renderArea{
+                .extent = extent,
+            },
+            .clearValueCount = sizeof(clear_values) / sizeof(clear_values[0]),
+            .pClearValues = clear_values,
+        };
+        vkCmdBeginRenderPass(cmd_buf, &renderpass_begin_info,
+                             secondary
+                                 ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                 : VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    // The previous content is discarded, the depth barrier also waits for
+    // the previous frame, which may share the depth image
+    VkImageMemoryBarrier barriers[]{
+        VkImageMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = m_images[image][0],
+            .subresourceRange{
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .levelCount = 1,
+                .layerCount = 1,
+            },
+        },
+        VkImageMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = m_images[image][1],
+            .subresourceRange{
+                .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                .levelCount = 1,
+                .layerCount = 1,
+            },
+        },
+    };
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    VkRenderingAttachmentInfo color{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = m_views[image][0],
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = clear_values[0],
+    };
+    // The depth is never read after the frame, so it is not stored
+    VkRenderingAttachmentInfo depth{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = m_views[image][1],
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .clearValue = clear_values[1],
+    };
+    VkRenderingInfo rendering_info{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .flags = secondary
+                     ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT
+                     : VkRenderingFlags(0),
+        .renderArea{
+            .extent = extent,
+        },
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color,
+        .pDepthAttachment = &depth,
+    };
+    vkCmdBeginRendering(cmd_buf, &rendering_info);
+}
+
+void GraphicsRender::end(VkCommandBuffer cmd_buf, uint32_t image) {
+    if (renderpass) {
+        vkCmdEndRenderPass(cmd_buf);
+        return;
+    }
+    vkCmdEndRendering(cmd_buf);
+
+    // Same final layout as the render pass
+    bool present = m_color_final_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkImageMemoryBarrier to_final{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = present ? VkAccessFlags(0)
+                                 : VkAccessFlags(VK_ACCESS_TRANSFER_READ_BIT),
+        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .newLayout = m_color_final_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = m_images[image][0],
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .layerCount = 1,
+        },
+    };
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+                                 : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &to_final);
+}
+
+void GraphicsRender::inheritance(
+    uint32_t image, VkCommandBufferInheritanceInfo& info,
+    VkCommandBufferInheritanceRenderingInfo& rendering) const {
+    info = VkCommandBufferInheritanceInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    };
+    if (renderpass) {
+        info.renderPass = renderpass;
+        info.subpass = 0;
+        info.framebuffer = framebuffers[image];
+        return;
+    }
+    rendering = VkCommandBufferInheritanceRenderingInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &color_format,
+        .depthAttachmentFormat = depth_format,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+    info.pNext = &rendering;
+}
+
+std::vector<VkFramebuffer> GraphicsRender::recreate_framebuffers(
+    const GraphicsSwapchain& swapchain) {
+    m_images.clear();
+    m_views.clear();
+    for (size_t i = 0; i < swapchain.images.size(); i++) {
+        m_images.push_back({swapchain.images[i], swapchain.depth_image});
+        m_views.push_back({swapchain.views[i], swapchain.depth_view});
+    }
+
+    std::vector<VkFramebuffer> old = std::move(framebuffers);
+    framebuffers.clear();
+    if (!renderpass) {
+        return old;
+    }
+
+    framebuffers.resize(swapchain.views.size());
+    for (size_t i = 0; i < swapchain.views.size(); i++) {
+        VkFramebufferCreateInfo framebuffer_info{
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = renderpass,
+            .attachmentCount = 2,
+            .pAttachments = m_views[i].data(),
+            .width = swapchain.extent.width,
+            .height = swapchain.extent.height,
+            .layers = 1,
+        };
+        assert(!vkCreateFramebuffer(m_device, &framebuffer_info, nullptr,
+                                    &framebuffers[i]));
+    }
+    return old;
+}
+
 GraphicsRenderBuilder::GraphicsRenderBuilder(GraphicsSwapchain swapchain,
                                              VkDevice device)
+    : GraphicsRenderBuilder(device, swapchain.format.format,
+                            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                            swapchain.depth_format, swapchain.extent) {
+    for (size_t i = 0; i < swapchain.images.size(); i++) {
+        m_images.push_back({swapchain.images[i], swapchain.depth_image});
+        m_framebuffer_views.push_back(
+            {swapchain.views[i], swapchain.depth_view});
+    }
+}
+
+GraphicsRenderBuilder::GraphicsRenderBuilder(GraphicsOffscreen offscreen,
+                                             VkDevice device)
+    : GraphicsRenderBuilder(device, offscreen.format,
+                            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                            offscreen.depth_format, offscreen.extent) {
+    for (size_t i = 0; i < offscreen.images.size(); i++) {
+        m_images.push_back({offscreen.images[i], offscreen.depth_images[i]});
+        m_framebuffer_views.push_back(
+            {offscreen.views[i], offscreen.depth_views[i]});
+    }
+}
+
+GraphicsRenderBuilder::GraphicsRenderBuilder(VkDevice device,
+                                             VkFormat color_format,
+                                             VkImageLayout color_final_layout,
+                                             VkFormat depth_format,
+                                             VkExtent2D extent)
     : attachments({
           VkAttachmentDescription{
-              .format = swapchain.format.format,
+              .format = color_format,
               .samples = VK_SAMPLE_COUNT_1_BIT,
               .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
               .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
               .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
               .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
               .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-              .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+              .finalLayout = color_final_layout,
           },
+          // The depth is never read after the frame, so it is not stored
           VkAttachmentDescription{
-              .format = swapchain.depth_format,
+              .format = depth_format,
               .samples = VK_SAMPLE_COUNT_1_BIT,
               .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-              .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+              .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
               .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
               .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
               .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
@@ -86,30 +308,45 @@ GraphicsRenderBuilder::GraphicsRenderBuilder(GraphicsSwapchain swapchain,
       framebuffer_info(VkFramebufferCreateInfo{
           .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
           .pNext = nullptr,
-          .width = swapchain.extent.width,
-          .height = swapchain.extent.height,
+          .width = extent.width,
+          .height = extent.height,
           .layers = 1,
       }),
 
-      m_swapchain(swapchain),
+      m_images(),
+      m_framebuffer_views(),
 
-      m_device(device) {}
+      m_device(device),
+      m_color_final_layout(color_final_layout),
+      m_dynamic(false) {}
+
+GraphicsRenderBuilder* GraphicsRenderBuilder::set_dynamic_rendering(
+    bool dynamic) {
+    m_dynamic = dynamic;
+    return this;
+}
 
 GraphicsRender GraphicsRenderBuilder::build() {
     GraphicsRender out{};
     out.m_device = m_device;
+    out.m_color_final_layout = m_color_final_layout;
+    out.m_images = m_images;
+    out.m_views = m_framebuffer_views;
+    out.color_format = attachments[0].format;
+    out.depth_format = attachments[1].format;
+
+    if (m_dynamic) {
+        return out;
+    }
 
     assert(!vkCreateRenderPass(m_device, &render_pass_info, nullptr,
                                &out.renderpass));
     framebuffer_info.renderPass = out.renderpass;
 
-    out.framebuffers.resize(m_swapchain.images.size());
-    for (size_t i = 0; i < m_swapchain.images.size(); i++) {
-        VkImageView attachments[]{m_swapchain.views[i], m_swapchain.depth_view};
-
-        framebuffer_info.attachmentCount =
-            sizeof(attachments) / sizeof(attachments[0]);
-        framebuffer_info.pAttachments = attachments;
+    out.framebuffers.resize(m_framebuffer_views.size());
+    for (size_t i = 0; i < m_framebuffer_views.size(); i++) {
+        framebuffer_info.attachmentCount = m_framebuffer_views[i].size();
+        framebuffer_info.pAttachments = m_framebuffer_views[i].data();
 
         assert(!vkCreateFramebuffer(m_device, &framebuffer_info, nullptr,
                                     &out.framebuffers[i]));
@@ -2,19 +2,47 @@
 
 #include <vulkan/vulkan.h>
 
+#include <array>
 #include <vector>
 
+#include "offscreen.h"
 #include "swapchain.h"
 
+// Renders to the color and depth images of a swapchain or an offscreen
+// target, either with a render pass and a framebuffer per image, or with
+// dynamic rendering, which needs neither.
 class GraphicsRender {
    public:
+    // Null with dynamic rendering
     VkRenderPass renderpass;
+    // Empty with dynamic rendering
     std::vector<VkFramebuffer> framebuffers;
+    VkFormat color_format;
+    VkFormat depth_format;
 
+    // Clears the target image and starts rendering to it, the draws are
+    // either recorded inline or executed from secondary command buffers
+    void begin(VkCommandBuffer cmd_buf, uint32_t image, VkExtent2D extent,
+               bool secondary);
+    void end(VkCommandBuffer cmd_buf, uint32_t image);
+    // What the secondary command buffers executed between begin() and end()
+    // inherit, `rendering` is chained to `inheritance` when it is needed
+    void inheritance(uint32_t image, VkCommandBufferInheritanceInfo& info,
+                     VkCommandBufferInheritanceRenderingInfo& rendering) const;
+    // Creates the framebuffers of a recreated swapchain with the same
+    // formats. The old ones are returned, to be destroyed once no frame in
+    // flight uses them.
+    std::vector<VkFramebuffer> recreate_framebuffers(
+        const GraphicsSwapchain& swapchain);
     void destroy();
 
    private:
     VkDevice m_device;
+    VkImageLayout m_color_final_layout;
+    // Color and depth of every target, for the layout transitions of dynamic
+    // rendering
+    std::vector<std::array<VkImage, 2>> m_images;
+    std::vector<std::array<VkImageView, 2>> m_views;
 
     friend class GraphicsRenderBuilder;
 };
@@ -22,6 +50,11 @@ class GraphicsRender {
 class GraphicsRenderBuilder {
    public:
     GraphicsRenderBuilder(GraphicsSwapchain swapchain, VkDevice device);
+    // The color images are left ready to be copied
+    GraphicsRenderBuilder(GraphicsOffscreen offscreen, VkDevice device);
+    // Vulkan 1.3 dynamic rendering instead of a render pass, the device
+    // needs the dynamicRendering feature
+    GraphicsRenderBuilder* set_dynamic_rendering(bool dynamic);
     GraphicsRender build();
 
     std::vector<VkAttachmentDescription> attachments;
@@ -32,6 +65,14 @@ class GraphicsRenderBuilder {
     VkFramebufferCreateInfo framebuffer_info;
 
    private:
-    GraphicsSwapchain m_swapchain;
+    // Color and depth of every target
+    std::vector<std::array<VkImage, 2>> m_images;
+    std::vector<std::array<VkImageView, 2>> m_framebuffer_views;
     VkDevice m_device;
+    VkImageLayout m_color_final_layout;
+    bool m_dynamic;
+
+    GraphicsRenderBuilder(VkDevice device, VkFormat color_format,
+                          VkImageLayout color_final_layout,
+                          VkFormat depth_format, VkExtent2D extent);
 };
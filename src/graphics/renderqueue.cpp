@@ -0,0 +1,125 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+
+const uint32_t pass_bits = 4;
+const uint32_t pipeline_bits = 16;
+const uint32_t mesh_bits = 20;
+const uint32_t depth_bits = 24;
+
+const uint32_t depth_shift = 0;
+const uint32_t mesh_shift = depth_shift + depth_bits;
+const uint32_t pipeline_shift = mesh_shift + mesh_bits;
+const uint32_t pass_shift = pipeline_shift + pipeline_bits;
+
+const size_t radix_bits = 8;
+const size_t radix_size = 1 << radix_bits;
+const size_t radix_passes = 64 / radix_bits;
+// Below this many keys per worker the threads cost more than they save
+const size_t parallel_sort_min_chunk = 1 << 14;
+
+uint64_t make_render_key(uint32_t pass, uint32_t pipeline, uint32_t mesh,
+                         float depth) {
+    assert(pass < (1u << pass_bits));
+    assert(pipeline < (1u << pipeline_bits));
+    assert(mesh < (1u << mesh_bits));
+
+    // The bits of a positive float grow with its value, so its top bits are a
+    // quantization that keeps more precision close to the camera
+    uint32_t depth_key = std::bit_cast<uint32_t>(std::max(depth, 0.f)) >>
+                         (32 - depth_bits);
+
+    return (uint64_t)pass << pass_shift |
+           (uint64_t)pipeline << pipeline_shift |
+           (uint64_t)mesh << mesh_shift | (uint64_t)depth_key << depth_shift;
+}
+
+uint32_t render_key_pipeline(uint64_t key) {
+    return (key >> pipeline_shift) & ((1u << pipeline_bits) - 1);
+}
+
+uint32_t render_key_mesh(uint64_t key) {
+    return (key >> mesh_shift) & ((1u << mesh_bits) - 1);
+}
+
+void RenderQueue::clear() {
+    keys.clear();
+    items.clear();
+}
+
+void RenderQueue::push(uint64_t key, uint32_t item) {
+    keys.push_back(key);
+    items.push_back(item);
+}
+
+void RenderQueue::sort(ThreadPool* pool) {
+    size_t count = keys.size();
+    if (count < 2) {
+        return;
+    }
+
+    size_t chunks = 1;
+    if (pool) {
+        chunks = std::clamp(count / parallel_sort_min_chunk, size_t(1),
+                            pool->size());
+    }
+    auto for_chunks = [&](auto&& task) {
+        if (chunks == 1) {
+            task(0, 0, count);
+        } else {
+            pool->parallel_for(count, chunks, task);
+        }
+    };
+
+    // A digit that is the same in every key would only copy the queue
+    uint64_t differing = 0;
+    for (size_t i = 1; i < count; i++) {
+        differing |= keys[i] ^ keys[0];
+    }
+
+    m_key_scratch.resize(count);
+    m_item_scratch.resize(count);
+
+    std::vector<std::array<size_t, radix_size>> offsets(chunks);
+    for (size_t pass = 0; pass < radix_passes; pass++) {
+        size_t shift = pass * radix_bits;
+        if (!((differing >> shift) & (radix_size - 1))) {
+            continue;
+        }
+
+        for_chunks([&](size_t chunk, size_t begin, size_t end) {
+            auto& histogram = offsets[chunk];
+            histogram.fill(0);
+            for (size_t i = begin; i < end; i++) {
+                histogram[(keys[i] >> shift) & (radix_size - 1)]++;
+            }
+        });
+
+        // Digit major prefix sum, so every chunk scatters its keys after the
+        // ones of the previous chunks with the same digit, keeping it stable
+        size_t sum = 0;
+        for (size_t digit = 0; digit < radix_size; digit++) {
+            for (size_t chunk = 0; chunk < chunks; chunk++) {
+                size_t histogram = offsets[chunk][digit];
+                offsets[chunk][digit] = sum;
+                sum += histogram;
+            }
+        }
+
+        for_chunks([&](size_t chunk, size_t begin, size_t end) {
+            auto& offset = offsets[chunk];
+            for (size_t i = begin; i < end; i++) {
+                size_t destination =
+                    offset[(keys[i] >> shift) & (radix_size - 1)]++;
+                m_key_scratch[destination] = keys[i];
+                m_item_scratch[destination] = items[i];
+            }
+        });
+
+        keys.swap(m_key_scratch);
+        items.swap(m_item_scratch);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "threadpool.h"
+
+// Sort key of a draw, from the most to the least significant bits:
+// pass (4) | pipeline (16) | mesh (20) | depth (24)
+// Sorting by it groups the draws by the most expensive state change first,
+// and orders the draws that share all the state front to back.
+uint64_t make_render_key(uint32_t pass, uint32_t pipeline, uint32_t mesh,
+                         float depth);
+uint32_t render_key_pipeline(uint64_t key);
+uint32_t render_key_mesh(uint64_t key);
+
+// Keys and the item (e.g. a drawable index) they sort
+class RenderQueue {
+   public:
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> items;
+
+    void clear();
+    void push(uint64_t key, uint32_t item);
+    size_t size() const { return keys.size(); };
+
+    // Stable LSD radix sort on 8 bit digits, the digits that every key shares
+    // are skipped. Large queues are split between the workers of `pool`.
+    void sort(ThreadPool* pool = nullptr);
+
+   private:
+    std::vector<uint64_t> m_key_scratch;
+    std::vector<uint32_t> m_item_scratch;
+};
@@ -0,0 +1,815 @@
+#include "streaming.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "png.h"
+
+// Blocks bigger than the block size, or beyond this count, are freed once
+// released
+const size_t staging_retained_blocks = 4;
+
+static VkDeviceSize align16(VkDeviceSize size) {
+    return (size + 15) & ~VkDeviceSize(15);
+}
+
+// The textures are either baked to a block format or RGBA8
+static VkDeviceSize level_bytes(VkFormat format, uint32_t width,
+                                uint32_t height) {
+    const BlockFormat *block = find_block_format(format);
+    return block ? block_level_size(*block, width, height)
+                 : VkDeviceSize(width) * height * 4;
+}
+
+static VkDeviceSize region_bytes(const DecodedTexture &decoded,
+                                 const VkBufferImageCopy &region) {
+    return level_bytes(decoded.format, region.imageExtent.width,
+                       region.imageExtent.height);
+}
+
+static const char *format_name(VkFormat format) {
+    const BlockFormat *block = find_block_format(format);
+    return block ? block->name : "rgba8";
+}
+
+static void image_barrier(VkCommandBuffer cmd_buf, VkImage image,
+                          uint32_t first_mip, uint32_t mip_count,
+                          VkImageLayout old_layout, VkImageLayout new_layout,
+                          VkPipelineStageFlags src_stage,
+                          VkAccessFlags src_access,
+                          VkPipelineStageFlags dst_stage,
+                          VkAccessFlags dst_access) {
+    VkImageMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = first_mip,
+            .levelCount = mip_count,
+            .layerCount = 1,
+        },
+    };
+    vkCmdPipelineBarrier(cmd_buf, src_stage, dst_stage, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+}
+
+// Runs on a decoding thread: the levels of the first file baked from `path`
+// in one of `formats`, and not older than it, are packed in one staging
+// block as they are. Levels larger than max_extent are skipped.
+static std::optional<DecodedTexture> load_baked_texture(
+    StagingPool &staging, const std::string &path,
+    const std::vector<VkFormat> &formats, uint32_t max_extent,
+    uint32_t tail_extent) {
+    auto start = std::chrono::steady_clock::now();
+    std::error_code error;
+    auto source_time = std::filesystem::last_write_time(path, error);
+    bool has_source = !error;
+
+    for (VkFormat format : formats) {
+        const BlockFormat *block = find_block_format(format);
+        const std::string baked = baked_texture_path(path, *block);
+        auto baked_time = std::filesystem::last_write_time(baked, error);
+        if (error || (has_source && baked_time < source_time)) {
+            continue;
+        }
+        auto file = KtxFile::open(baked.c_str());
+        if (!file) {
+            continue;
+        }
+
+        const KtxHeader &header = *file->header;
+        uint32_t first_mip = 0;
+        while (max_extent && first_mip + 1 < header.level_count &&
+               std::max(header.width, header.height) >> first_mip >
+                   max_extent) {
+            first_mip++;
+        }
+        DecodedTexture out{
+            .format = format,
+            .extent{std::max(1u, header.width >> first_mip),
+                     std::max(1u, header.height >> first_mip)},
+            .mip_count = header.level_count - first_mip,
+        };
+        // The last level is always sampled first, however large
+        while (out.tail_mip + 1 < out.mip_count &&
+               std::max(out.extent.width, out.extent.height) >>
+                       out.tail_mip >
+                   tail_extent) {
+            out.tail_mip++;
+        }
+        out.top_count = out.tail_mip;
+
+        bool valid = header.vk_format == uint32_t(format);
+        VkDeviceSize size = 0;
+        for (uint32_t mip = 0; valid && mip < out.mip_count; mip++) {
+            uint32_t width = std::max(1u, out.extent.width >> mip);
+            uint32_t height = std::max(1u, out.extent.height >> mip);
+            valid = file->level(first_mip + mip).size() ==
+                    level_bytes(format, width, height);
+            size += align16(level_bytes(format, width, height));
+        }
+        if (!valid) {
+            printf("Texture %s does not hold a %s texture\n", baked.c_str(),
+                   block->name);
+            file->destroy();
+            continue;
+        }
+
+        out.staging = staging.acquire(size);
+        VkDeviceSize offset = 0;
+        for (uint32_t mip = 0; mip < out.mip_count; mip++) {
+            std::span<const uint8_t> level = file->level(first_mip + mip);
+            memcpy(out.staging.data + offset, level.data(), level.size());
+            out.regions.push_back(VkBufferImageCopy{
+                .bufferOffset = offset,
+                .imageSubresource{
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .mipLevel = mip,
+                    .layerCount = 1,
+                },
+                .imageExtent{std::max(1u, out.extent.width >> mip),
+                             std::max(1u, out.extent.height >> mip), 1},
+            });
+            offset += align16(level.size());
+        }
+        staging.flush(out.staging, size);
+        file->destroy();
+
+        out.ok = true;
+        out.decode_ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+        return out;
+    }
+    return std::optional<DecodedTexture>{};
+}
+
+// Runs on a decoding thread: level 0 and the tail levels are packed in one
+// staging block, the tail levels are built from level 0 with box filters
+static DecodedTexture decode_texture(StagingPool &staging,
+                                     const std::string &path,
+                                     uint32_t max_extent,
+                                     uint32_t tail_extent) {
+    auto start = std::chrono::steady_clock::now();
+    DecodedTexture out{};
+    std::optional<ImageData> image = load_png(path.c_str());
+    if (!image) {
+        return out;
+    }
+
+    ImageData top = std::move(*image);
+    while (max_extent && std::max(top.width, top.height) > max_extent) {
+        top = downsample(top);
+    }
+    out.format = VK_FORMAT_R8G8B8A8_SRGB;
+    out.extent = VkExtent2D{top.width, top.height};
+    out.mip_count = std::bit_width(std::max(top.width, top.height));
+
+    // The levels above the tail are only halved to get to it, the gpu blits
+    // its own from level 0
+    ImageData scratch;
+    const ImageData *level = &top;
+    out.tail_mip = 0;
+    while (std::max(level->width, level->height) > tail_extent) {
+        scratch = downsample(*level);
+        level = &scratch;
+        out.tail_mip++;
+    }
+    std::vector<ImageData> tail;
+    tail.reserve(out.mip_count - out.tail_mip);
+    tail.push_back(out.tail_mip ? std::move(scratch) : top);
+    while (tail.size() < out.mip_count - out.tail_mip) {
+        tail.push_back(downsample(tail.back()));
+    }
+    out.top_count = out.tail_mip ? 1 : 0;
+
+    std::vector<const ImageData *> levels;
+    if (out.tail_mip) {
+        levels.push_back(&top);
+    }
+    for (const ImageData &data : tail) {
+        levels.push_back(&data);
+    }
+    VkDeviceSize size = 0;
+    for (const ImageData *data : levels) {
+        size += align16(data->pixels.size());
+    }
+
+    out.staging = staging.acquire(size);
+    VkDeviceSize offset = 0;
+    for (size_t i = 0; i < levels.size(); i++) {
+        const ImageData *data = levels[i];
+        memcpy(out.staging.data + offset, data->pixels.data(),
+               data->pixels.size());
+        uint32_t mip = out.tail_mip ? (i ? out.tail_mip + i - 1 : 0)
+                                    : uint32_t(i);
+        out.regions.push_back(VkBufferImageCopy{
+            .bufferOffset = offset,
+            .imageSubresource{
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = mip,
+                .layerCount = 1,
+            },
+            .imageExtent{data->width, data->height, 1},
+        });
+        offset += align16(data->pixels.size());
+    }
+    staging.flush(out.staging, size);
+
+    out.ok = true;
+    out.decode_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    return out;
+}
+
+StagingBlock StagingPool::acquire(VkDeviceSize size) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto best = m_free.end();
+        for (auto it = m_free.begin(); it != m_free.end(); it++) {
+            if (it->size >= size && (best == m_free.end() ||
+                                     it->size < best->size)) {
+                best = it;
+            }
+        }
+        if (best != m_free.end()) {
+            StagingBlock out = *best;
+            m_free.erase(best);
+            return out;
+        }
+    }
+
+    // VMA is thread safe, the block is created without holding the lock
+    StagingBlock out{.size = std::max(size, m_block_size)};
+    VkBufferCreateInfo buffer_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = out.size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    };
+    VmaAllocationCreateInfo allocation_info{
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+    };
+    VmaAllocationInfo info;
+    assert(!vmaCreateBuffer(m_allocator, &buffer_info, &allocation_info,
+                            &out.buffer.buffer, &out.buffer.allocation,
+                            &info));
+    out.data = static_cast<char *>(info.pMappedData);
+    return out;
+}
+
+void StagingPool::flush(const StagingBlock &block, VkDeviceSize size) {
+    vmaFlushAllocation(m_allocator, block.buffer.allocation, 0, size);
+}
+
+void StagingPool::release(StagingBlock block) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (block.size > m_block_size ||
+        m_free.size() >= staging_retained_blocks) {
+        vmaDestroyBuffer(m_allocator, block.buffer.buffer,
+                         block.buffer.allocation);
+        return;
+    }
+    m_free.push_back(block);
+}
+
+void StagingPool::destroy() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &block : m_free) {
+        vmaDestroyBuffer(m_allocator, block.buffer.buffer,
+                         block.buffer.allocation);
+    }
+    m_free.clear();
+}
+
+GraphicsTextureStreamerBuilder *
+GraphicsTextureStreamerBuilder::set_thread_count(uint32_t count) {
+    m_thread_count = count;
+    return this;
+}
+
+GraphicsTextureStreamerBuilder *
+GraphicsTextureStreamerBuilder::set_frame_budget(VkDeviceSize bytes) {
+    m_frame_budget = bytes;
+    return this;
+}
+
+GraphicsTextureStreamerBuilder *
+GraphicsTextureStreamerBuilder::set_tail_extent(uint32_t extent) {
+    m_tail_extent = extent;
+    return this;
+}
+
+GraphicsTextureStreamerBuilder *
+GraphicsTextureStreamerBuilder::set_frames_in_flight(uint32_t count) {
+    m_frames_in_flight = count;
+    return this;
+}
+
+GraphicsTextureStreamerBuilder *GraphicsTextureStreamerBuilder::add_format(
+    VkFormat format) {
+    if (find_block_format(format)) {
+        m_formats.push_back(format);
+    }
+    return this;
+}
+
+GraphicsTextureStreamer GraphicsTextureStreamerBuilder::build() {
+    GraphicsTextureStreamer out{};
+    out.m_device = m_device;
+    out.m_allocator = m_allocator;
+    out.m_bindless = m_bindless;
+    out.m_graphics_family = m_graphics_family;
+    out.m_transfer_family = m_transfer_family;
+    out.m_transfer_queue = m_transfer_queue;
+    out.m_frame_budget = m_frame_budget;
+    out.m_tail_extent = std::max(1u, m_tail_extent);
+    out.m_frames_in_flight = std::max(1u, m_frames_in_flight);
+    out.m_formats = m_formats;
+    out.m_workers =
+        std::make_shared<ThreadPool>(std::max(1u, m_thread_count));
+    out.m_staging = std::make_shared<StagingPool>(m_allocator, m_frame_budget);
+
+    VkSemaphoreTypeCreateInfo type_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info,
+    };
+    assert(!vkCreateSemaphore(m_device, &semaphore_info, nullptr,
+                              &out.semaphore));
+    return out;
+}
+
+uint32_t GraphicsTextureStreamer::request(const std::string &path,
+                                          uint32_t max_extent) {
+    StreamedTexture texture{
+        .path = path,
+        .state = StreamState::Decoding,
+        .requested = std::chrono::steady_clock::now(),
+    };
+    texture.future = m_workers->submit([staging = m_staging, path,
+                                        formats = m_formats, max_extent,
+                                        tail = m_tail_extent]() {
+        std::optional<DecodedTexture> baked = load_baked_texture(
+            *staging, path, formats, max_extent, tail);
+        return baked ? std::move(*baked)
+                     : decode_texture(*staging, path, max_extent, tail);
+    });
+    m_textures.push_back(std::move(texture));
+    return m_textures.size() - 1;
+}
+
+uint64_t GraphicsTextureStreamer::record(
+    VkCommandBuffer cmd_buf, std::vector<TextureResidency> &changes) {
+    uint64_t done;
+    assert(!vkGetSemaphoreCounterValue(m_device, semaphore, &done));
+
+    // The frames that sampled these views are done
+    m_frame++;
+    size_t retired = 0;
+    for (size_t i = 0; i < m_retired.size(); i++) {
+        const RetiredView &view = m_retired[i];
+        if (m_frame - view.frame < m_frames_in_flight) {
+            m_retired[retired++] = view;
+            continue;
+        }
+        m_bindless->remove_texture(view.bindless_index);
+        vkDestroyImageView(m_device, view.view, nullptr);
+    }
+    m_retired.resize(retired);
+
+    // The frame waits for the value of the batches it consumes, which is
+    // already reached, only so that their copies are visible to it
+    uint64_t wait = 0;
+    size_t pending = 0;
+    for (size_t i = 0; i < m_batches.size(); i++) {
+        StreamBatch &batch = m_batches[i];
+        if (batch.value > done) {
+            if (pending != i) {
+                m_batches[pending] = std::move(batch);
+            }
+            pending++;
+            continue;
+        }
+        for (const StagingBlock &block : batch.staging) {
+            m_staging->release(block);
+        }
+        batch.staging.clear();
+        wait = std::max(wait, batch.value);
+        m_free_batches.push_back(std::move(batch));
+    }
+    m_batches.resize(pending);
+
+    for (uint32_t i = 0; i < m_textures.size(); i++) {
+        StreamedTexture &texture = m_textures[i];
+        if (texture.state == StreamState::Decoding &&
+            texture.future.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready) {
+            texture.decoded = texture.future.get();
+            if (!texture.decoded.ok) {
+                printf("Texture %s could not be loaded\n",
+                       texture.path.c_str());
+                texture.state = StreamState::Failed;
+                continue;
+            }
+            const DecodedTexture &decoded = texture.decoded;
+            VkDeviceSize bytes = 0;
+            VkDeviceSize rgba_bytes = 0;
+            for (uint32_t mip = 0; mip < decoded.mip_count; mip++) {
+                uint32_t width = std::max(1u, decoded.extent.width >> mip);
+                uint32_t height = std::max(1u, decoded.extent.height >> mip);
+                bytes += level_bytes(decoded.format, width, height);
+                rgba_bytes += level_bytes(VK_FORMAT_R8G8B8A8_SRGB, width,
+                                          height);
+            }
+            printf("Texture %s: %ux%u %s, %u mips, %.2f MB (%.2f MB as "
+                   "rgba8), loaded in %.1f ms\n",
+                   texture.path.c_str(), decoded.extent.width,
+                   decoded.extent.height, format_name(decoded.format),
+                   decoded.mip_count, bytes / (1024. * 1024.),
+                   rgba_bytes / (1024. * 1024.), decoded.decode_ms);
+            texture.state = StreamState::Decoded;
+        } else if (texture.state == StreamState::TailUploading &&
+                   texture.batch <= done) {
+            const DecodedTexture &decoded = texture.decoded;
+            image_barrier(cmd_buf, texture.image, decoded.tail_mip,
+                          decoded.mip_count - decoded.tail_mip,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                          VK_ACCESS_SHADER_READ_BIT);
+            publish(i, decoded.tail_mip, changes);
+            texture.state = decoded.tail_mip ? StreamState::TailResident
+                                             : StreamState::Resident;
+        } else if (texture.state == StreamState::TopUploading &&
+                   texture.batch <= done) {
+            record_mips(cmd_buf, texture);
+            publish(i, 0, changes);
+            texture.state = StreamState::Resident;
+        }
+    }
+
+    submit_uploads();
+    return wait;
+}
+
+// The levels above the tail were copied, the ones missing up to the tail
+// are blitted one after the other from the last copied one
+void GraphicsTextureStreamer::record_mips(VkCommandBuffer cmd_buf,
+                                          StreamedTexture &texture) {
+    const DecodedTexture &decoded = texture.decoded;
+    for (uint32_t mip = decoded.top_count; mip < decoded.tail_mip; mip++) {
+        image_barrier(cmd_buf, texture.image, mip - 1, 1,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_READ_BIT);
+        VkImageBlit blit{
+            .srcSubresource{
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = mip - 1,
+                .layerCount = 1,
+            },
+            .srcOffsets{
+                {0, 0, 0},
+                {int32_t(std::max(1u, decoded.extent.width >> (mip - 1))),
+                 int32_t(std::max(1u, decoded.extent.height >> (mip - 1))),
+                 1},
+            },
+            .dstSubresource{
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = mip,
+                .layerCount = 1,
+            },
+            .dstOffsets{
+                {0, 0, 0},
+                {int32_t(std::max(1u, decoded.extent.width >> mip)),
+                 int32_t(std::max(1u, decoded.extent.height >> mip)), 1},
+            },
+        };
+        vkCmdBlitImage(cmd_buf, texture.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                       VK_FILTER_LINEAR);
+    }
+
+    // The blit sources are in TRANSFER_SRC, the other levels above the tail
+    // are still in TRANSFER_DST
+    uint32_t first_source = decoded.top_count - 1;
+    uint32_t source_count = decoded.tail_mip - decoded.top_count;
+    if (source_count) {
+        image_barrier(cmd_buf, texture.image, first_source, source_count,
+                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT);
+    } else {
+        first_source = decoded.tail_mip;
+    }
+    if (first_source) {
+        image_barrier(cmd_buf, texture.image, 0, first_source,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT);
+    }
+    if (source_count) {
+        image_barrier(cmd_buf, texture.image, decoded.tail_mip - 1, 1,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT);
+    }
+}
+
+// A new view and bindless slot, the previous ones are retired as the frames
+// in flight may still sample them
+void GraphicsTextureStreamer::publish(uint32_t index, uint32_t first_mip,
+                                      std::vector<TextureResidency> &changes) {
+    StreamedTexture &texture = m_textures[index];
+    VkImageViewCreateInfo view_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = texture.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = texture.decoded.format,
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = first_mip,
+            .levelCount = texture.decoded.mip_count - first_mip,
+            .layerCount = 1,
+        },
+    };
+    VkImageView view;
+    assert(!vkCreateImageView(m_device, &view_info, nullptr, &view));
+
+    uint32_t slot = m_bindless->add_texture(view);
+    if (slot == GraphicsBindless::none) {
+        vkDestroyImageView(m_device, view, nullptr);
+        return;
+    }
+    if (texture.view) {
+        m_retired.push_back(RetiredView{
+            .view = texture.view,
+            .bindless_index = texture.bindless_index,
+            .frame = m_frame,
+        });
+    }
+    texture.view = view;
+    texture.bindless_index = slot;
+    changes.push_back(TextureResidency{
+        .texture = index,
+        .bindless_index = slot,
+        .first_mip = first_mip,
+    });
+    printf("Texture %s: mips %u to %u sampled after %.1f ms\n",
+           texture.path.c_str(), first_mip, texture.decoded.mip_count - 1,
+           std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - texture.requested)
+               .count());
+}
+
+void GraphicsTextureStreamer::create_image(StreamedTexture &texture) {
+    // Shared by both queues, instead of transferring the ownership of every
+    // level
+    uint32_t families[]{m_graphics_family, m_transfer_family};
+    bool concurrent = m_graphics_family != m_transfer_family;
+    // Only the levels of a PNG are blitted, block formats cannot be
+    const DecodedTexture &decoded = texture.decoded;
+    VkImageUsageFlags usage =
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (decoded.top_count < decoded.tail_mip) {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    VkImageCreateInfo image_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = decoded.format,
+        .extent = VkExtent3D{decoded.extent.width, decoded.extent.height, 1},
+        .mipLevels = decoded.mip_count,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT
+                                  : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = concurrent ? 2u : 0u,
+        .pQueueFamilyIndices = families,
+    };
+    VmaAllocationCreateInfo allocation_info{
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+    assert(!vmaCreateImage(m_allocator, &image_info, &allocation_info,
+                           &texture.image, &texture.allocation, nullptr));
+}
+
+// Copies the tails of the decoded textures, then the levels above the tail
+// of the ones sampled through it, within the frame budget
+void GraphicsTextureStreamer::submit_uploads() {
+    StreamBatch batch{};
+    VkDeviceSize budget = m_frame_budget;
+    bool recording = false;
+    auto begin = [&]() {
+        if (recording) {
+            return;
+        }
+        if (m_free_batches.empty()) {
+            VkCommandPoolCreateInfo pool_info{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = m_transfer_family,
+            };
+            assert(!vkCreateCommandPool(m_device, &pool_info, nullptr,
+                                        &batch.cmd_pool));
+            VkCommandBufferAllocateInfo cmd_info{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = batch.cmd_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+            };
+            assert(!vkAllocateCommandBuffers(m_device, &cmd_info,
+                                             &batch.cmd_buf));
+        } else {
+            batch = m_free_batches.back();
+            m_free_batches.pop_back();
+            assert(!vkResetCommandPool(m_device, batch.cmd_pool, 0));
+        }
+        VkCommandBufferBeginInfo begin_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        assert(!vkBeginCommandBuffer(batch.cmd_buf, &begin_info));
+        batch.value = m_value + 1;
+        recording = true;
+    };
+    // At least one copy per batch, however big
+    auto fits = [&](VkDeviceSize bytes) {
+        return !recording || bytes <= budget;
+    };
+
+    for (StreamedTexture &texture : m_textures) {
+        if (texture.state != StreamState::Decoded) {
+            continue;
+        }
+        DecodedTexture &decoded = texture.decoded;
+        size_t first_region = decoded.top_count;
+        VkDeviceSize bytes = 0;
+        for (size_t i = first_region; i < decoded.regions.size(); i++) {
+            bytes += region_bytes(decoded, decoded.regions[i]);
+        }
+        if (!fits(bytes)) {
+            break;
+        }
+        begin();
+        budget -= std::min(budget, bytes);
+
+        create_image(texture);
+        image_barrier(batch.cmd_buf, texture.image, 0, decoded.mip_count,
+                      VK_IMAGE_LAYOUT_UNDEFINED,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT);
+        vkCmdCopyBufferToImage(batch.cmd_buf, decoded.staging.buffer.buffer,
+                               texture.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               decoded.regions.size() - first_region,
+                               decoded.regions.data() + first_region);
+        texture.state = StreamState::TailUploading;
+        texture.batch = batch.value;
+        // Nothing else to copy, the block is free once the batch is done
+        if (!decoded.tail_mip) {
+            batch.staging.push_back(decoded.staging);
+            decoded.staging = {};
+        }
+    }
+
+    for (StreamedTexture &texture : m_textures) {
+        if (texture.state != StreamState::TailResident) {
+            continue;
+        }
+        DecodedTexture &decoded = texture.decoded;
+        VkDeviceSize bytes = 0;
+        for (size_t i = 0; i < decoded.top_count; i++) {
+            bytes += region_bytes(decoded, decoded.regions[i]);
+        }
+        if (!fits(bytes)) {
+            break;
+        }
+        begin();
+        budget -= std::min(budget, bytes);
+
+        vkCmdCopyBufferToImage(batch.cmd_buf, decoded.staging.buffer.buffer,
+                               texture.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               decoded.top_count, decoded.regions.data());
+        texture.state = StreamState::TopUploading;
+        texture.batch = batch.value;
+        batch.staging.push_back(decoded.staging);
+        decoded.staging = {};
+    }
+
+    if (!recording) {
+        return;
+    }
+    assert(!vkEndCommandBuffer(batch.cmd_buf));
+
+    m_value = batch.value;
+    VkTimelineSemaphoreSubmitInfo timeline{
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &m_value,
+    };
+    VkSubmitInfo submit{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch.cmd_buf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &semaphore,
+    };
+    assert(!vkQueueSubmit(m_transfer_queue, 1, &submit, VK_NULL_HANDLE));
+    m_batches.push_back(batch);
+}
+
+size_t GraphicsTextureStreamer::pending() const {
+    return std::count_if(
+        m_textures.begin(), m_textures.end(), [](const StreamedTexture &t) {
+            return t.state != StreamState::Resident &&
+                   t.state != StreamState::Failed;
+        });
+}
+
+void GraphicsTextureStreamer::destroy() {
+    for (StreamedTexture &texture : m_textures) {
+        if (texture.state == StreamState::Decoding) {
+            texture.decoded = texture.future.get();
+        }
+    }
+    if (m_value) {
+        VkSemaphoreWaitInfo wait_info{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &semaphore,
+            .pValues = &m_value,
+        };
+        assert(!vkWaitSemaphores(m_device, &wait_info, UINT64_MAX));
+    }
+
+    for (StreamBatch &batch : m_batches) {
+        for (const StagingBlock &block : batch.staging) {
+            m_staging->release(block);
+        }
+        m_free_batches.push_back(batch);
+    }
+    m_batches.clear();
+    for (StreamBatch &batch : m_free_batches) {
+        vkDestroyCommandPool(m_device, batch.cmd_pool, nullptr);
+    }
+    m_free_batches.clear();
+
+    for (StreamedTexture &texture : m_textures) {
+        if (texture.decoded.staging.data) {
+            m_staging->release(texture.decoded.staging);
+        }
+        if (texture.view) {
+            vkDestroyImageView(m_device, texture.view, nullptr);
+        }
+        if (texture.image) {
+            vmaDestroyImage(m_allocator, texture.image, texture.allocation);
+        }
+    }
+    m_textures.clear();
+    for (const RetiredView &view : m_retired) {
+        vkDestroyImageView(m_device, view.view, nullptr);
+    }
+    m_retired.clear();
+
+    m_staging->destroy();
+    // Joins the decoding threads, which are all done
+    m_workers.reset();
+    vkDestroySemaphore(m_device, semaphore, nullptr);
+}
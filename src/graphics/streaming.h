@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bindless.h"
+#include "ktx.h"
+#include "threadpool.h"
+#include "utils.h"
+
+// Mapped staging buffer, reused across uploads
+struct StagingBlock {
+    AllocatedBuffer buffer;
+    char *data;
+    VkDeviceSize size;
+};
+
+// Staging buffers shared by the decoding threads, which fill them, and the
+// uploads, which give them back once their copies are done
+class StagingPool {
+   public:
+    StagingPool(VmaAllocator allocator, VkDeviceSize block_size)
+        : m_allocator(allocator), m_block_size(block_size){};
+
+    // The smallest free block that fits, or a new one of at least the block
+    // size. Thread safe.
+    StagingBlock acquire(VkDeviceSize size);
+    // Makes the first `size` bytes written by the cpu visible to the gpu
+    void flush(const StagingBlock &block, VkDeviceSize size);
+    // Keeps a few blocks for the next uploads, frees the others. Thread safe.
+    void release(StagingBlock block);
+    void destroy();
+
+   private:
+    VmaAllocator m_allocator;
+    VkDeviceSize m_block_size;
+    std::mutex m_mutex;
+    std::vector<StagingBlock> m_free;
+};
+
+// Levels of a texture packed in a staging block by a decoding thread
+struct DecodedTexture {
+    bool ok;
+    StagingBlock staging;
+    VkFormat format;
+    VkExtent2D extent;
+    uint32_t mip_count;
+    // First level of the tail, the small levels sampled first
+    uint32_t tail_mip;
+    // Levels above the tail that are copied, the others up to the tail are
+    // blitted on the gpu from the last of them. A baked texture has all its
+    // levels, a PNG only level 0 and its tail, built on the cpu.
+    uint32_t top_count;
+    // The levels above the tail that are copied, then the tail levels
+    std::vector<VkBufferImageCopy> regions;
+    double decode_ms;
+};
+
+enum class StreamState {
+    Decoding,
+    // Waiting for a transfer batch with its tail
+    Decoded,
+    TailUploading,
+    // Sampled through its tail, waiting for a transfer batch with level 0
+    TailResident,
+    TopUploading,
+    Resident,
+    Failed,
+};
+
+struct StreamedTexture {
+    std::string path;
+    StreamState state;
+    std::future<DecodedTexture> future;
+    DecodedTexture decoded;
+    VkImage image;
+    VmaAllocation allocation;
+    // The tail view, then the view of every level once resident, and the
+    // bindless index it is sampled through
+    VkImageView view;
+    uint32_t bindless_index;
+    // Transfer batch of the pending upload
+    uint64_t batch;
+    std::chrono::steady_clock::time_point requested;
+};
+
+// Copies submitted to the transfer queue at once, done when the timeline
+// semaphore reaches `value`
+struct StreamBatch {
+    VkCommandPool cmd_pool;
+    VkCommandBuffer cmd_buf;
+    uint64_t value;
+    // Given back to the pool once the batch is done
+    std::vector<StagingBlock> staging;
+};
+
+// A view replaced by publish(), with the bindless index it was sampled
+// through. Both are freed once the frames recorded before `frame` are done.
+struct RetiredView {
+    VkImageView view;
+    uint32_t bindless_index;
+    uint64_t frame;
+};
+
+// The bindless index a texture is sampled with from now on, and its first
+// sampled level
+struct TextureResidency {
+    uint32_t texture;
+    uint32_t bindless_index;
+    uint32_t first_mip;
+};
+
+// Loads textures in the background, so that no frame waits for them.
+// Worker threads map the baked textures or decode the images and pack their
+// levels into pooled staging memory, the copies go through the transfer
+// queue (a dedicated one when the device has it) and the frames pick up the
+// finished copies: each texture is first sampled through its small mips,
+// then through all of them once the larger ones arrived (for a PNG level 0,
+// the levels in between are blitted on the gpu).
+class GraphicsTextureStreamer {
+   public:
+    // Timeline semaphore signaled by the transfer batches
+    VkSemaphore semaphore;
+
+    // Queues the loading of the PNG at `path`, halved until it fits
+    // max_extent (0 keeps the full size): from the file texbake made of it
+    // in the first of the formats that has one, else from the PNG itself.
+    // Returns the texture index used by the residency changes.
+    uint32_t request(const std::string &path, uint32_t max_extent = 0);
+    // Called once per frame, outside of a render pass: records the layout
+    // transitions and mip blits of the finished copies into cmd_buf, then
+    // submits the copies of the newly decoded textures. The frame recorded
+    // frames_in_flight calls before has to be done, its replaced views are
+    // freed. Appends the textures
+    // that changed to `changes`, their new bindless index can be used by the
+    // frame. Returns the semaphore value the frame has to wait for at the
+    // transfer stage, 0 when it does not need to.
+    uint64_t record(VkCommandBuffer cmd_buf,
+                    std::vector<TextureResidency> &changes);
+    // Textures that are neither resident nor failed
+    size_t pending() const;
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    GraphicsBindless *m_bindless;
+    uint32_t m_graphics_family;
+    uint32_t m_transfer_family;
+    VkQueue m_transfer_queue;
+    VkDeviceSize m_frame_budget;
+    uint32_t m_tail_extent;
+    uint32_t m_frames_in_flight;
+    std::vector<VkFormat> m_formats;
+
+    // On the heap, as neither can move, and the decoding tasks hold the
+    // staging pool
+    std::shared_ptr<ThreadPool> m_workers;
+    std::shared_ptr<StagingPool> m_staging;
+
+    std::vector<StreamedTexture> m_textures;
+    std::vector<StreamBatch> m_batches;
+    // Done batches, their command pools are reused by the next ones
+    std::vector<StreamBatch> m_free_batches;
+    uint64_t m_value;
+    // Calls to record(), the frames in flight may still sample the views
+    // retired by the last frames_in_flight of them
+    uint64_t m_frame;
+    std::vector<RetiredView> m_retired;
+
+    void create_image(StreamedTexture &texture);
+    void publish(uint32_t index, uint32_t first_mip,
+                 std::vector<TextureResidency> &changes);
+    void record_mips(VkCommandBuffer cmd_buf, StreamedTexture &texture);
+    void submit_uploads();
+
+    friend class GraphicsTextureStreamerBuilder;
+};
+
+class GraphicsTextureStreamerBuilder {
+   public:
+    // The transfer family may be the graphics one, when the device has no
+    // dedicated transfer queue. The device needs the timeline semaphores.
+    GraphicsTextureStreamerBuilder(VkDevice device, VmaAllocator allocator,
+                                   GraphicsBindless &bindless,
+                                   uint32_t graphics_family,
+                                   uint32_t transfer_family,
+                                   VkQueue transfer_queue)
+        : m_device(device),
+          m_allocator(allocator),
+          m_bindless(&bindless),
+          m_graphics_family(graphics_family),
+          m_transfer_family(transfer_family),
+          m_transfer_queue(transfer_queue),
+          m_thread_count(2),
+          m_frame_budget(32 << 20),
+          m_tail_extent(64),
+          m_frames_in_flight(2){};
+
+    // Decoding threads, separate from the global pool so that a long decode
+    // never delays the frame work queued there
+    GraphicsTextureStreamerBuilder *set_thread_count(uint32_t count);
+    // Bytes copied per frame, at least one level is always copied
+    GraphicsTextureStreamerBuilder *set_frame_budget(VkDeviceSize bytes);
+    // Levels whose larger side is at most `extent` are built on the cpu and
+    // sampled before level 0 arrives
+    GraphicsTextureStreamerBuilder *set_tail_extent(uint32_t extent);
+    // Frames recorded while the gpu draws an earlier one, which may still
+    // sample a replaced view
+    GraphicsTextureStreamerBuilder *set_frames_in_flight(uint32_t count);
+    // Block compressed format the textures may have been baked to, the
+    // formats are tried in the order they were added. The device has to
+    // sample it, none are tried by default.
+    GraphicsTextureStreamerBuilder *add_format(VkFormat format);
+    GraphicsTextureStreamer build();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    GraphicsBindless *m_bindless;
+    uint32_t m_graphics_family;
+    uint32_t m_transfer_family;
+    VkQueue m_transfer_queue;
+    uint32_t m_thread_count;
+    VkDeviceSize m_frame_budget;
+    uint32_t m_tail_extent;
+    uint32_t m_frames_in_flight;
+    std::vector<VkFormat> m_formats;
+};
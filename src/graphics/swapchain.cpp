@@ -2,6 +2,8 @@
 
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include "utils.h"
@@ -22,6 +24,7 @@ GraphicsSwapchainBuilder::GraphicsSwapchainBuilder(
       m_device(device),
       m_surface(surface),
       m_extent(),
+      m_present_mode(VK_PRESENT_MODE_FIFO_KHR),
       capabilities(),
       formats(),
       present_modes(),
@@ -69,16 +72,69 @@ GraphicsSwapchainBuilder* GraphicsSwapchainBuilder::set_extent(
     return this;
 }
 
+GraphicsSwapchainBuilder* GraphicsSwapchainBuilder::set_old_swapchain(
+    VkSwapchainKHR swapchain) {
+    create_info.oldSwapchain = swapchain;
+    return this;
+}
+
+GraphicsSwapchainBuilder* GraphicsSwapchainBuilder::set_present_mode(
+    VkPresentModeKHR mode) {
+    m_present_mode = mode;
+    return this;
+}
+
+GraphicsSwapchainBuilder* GraphicsSwapchainBuilder::set_image_count(
+    uint32_t count) {
+    if (!count) {
+        return this;
+    }
+    create_info.minImageCount = std::max(count, capabilities.minImageCount);
+    if (capabilities.maxImageCount &&
+        create_info.minImageCount > capabilities.maxImageCount) {
+        create_info.minImageCount = capabilities.maxImageCount;
+    }
+    return this;
+}
+
 GraphicsSwapchain GraphicsSwapchainBuilder::build() {
     GraphicsSwapchain destination{};
     destination.m_device = m_device;
     destination.m_allocator = m_allocator;
+
+    // A defined current extent is the size of the window, which the
+    // swapchain has to match
+    if (capabilities.currentExtent.width != UINT32_MAX) {
+        m_extent = capabilities.currentExtent;
+    }
+    m_extent.width =
+        std::clamp(m_extent.width, capabilities.minImageExtent.width,
+                   capabilities.maxImageExtent.width);
+    m_extent.height =
+        std::clamp(m_extent.height, capabilities.minImageExtent.height,
+                   capabilities.maxImageExtent.height);
     destination.extent = m_extent;
 
     destination.format = formats.at(0);
     destination.capabilities = capabilities;
     destination.present_modes = present_modes;
 
+    std::vector<VkPresentModeKHR> candidates{m_present_mode};
+    if (m_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+        candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+    } else if (m_present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+        candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+    }
+    candidates.push_back(VK_PRESENT_MODE_FIFO_KHR);
+    for (VkPresentModeKHR mode : candidates) {
+        if (std::find(present_modes.begin(), present_modes.end(), mode) !=
+            present_modes.end()) {
+            destination.present_mode = mode;
+            break;
+        }
+    }
+    create_info.presentMode = destination.present_mode;
+
     create_info.imageExtent = m_extent;
     create_info.imageFormat = destination.format.format;
     create_info.imageColorSpace = destination.format.colorSpace;
@@ -134,13 +190,9 @@ GraphicsSwapchain GraphicsSwapchainBuilder::build() {
         .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
     };
 
-    VmaAllocationCreateInfo depth_alloc_info{
-        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
-
-    vmaCreateImage(m_allocator, &depth_info, &depth_alloc_info,
-                   &destination.depth_image, &destination.m_depth_allocation,
-                   nullptr);
+    assert(!create_transient_image(m_allocator, depth_info,
+                                   &destination.depth_image,
+                                   &destination.m_depth_allocation));
 
     // Get depth view
     VkImageViewCreateInfo depth_view_info{
@@ -159,3 +211,18 @@ GraphicsSwapchain GraphicsSwapchainBuilder::build() {
 
     return destination;
 }
+
+const char* present_mode_name(VkPresentModeKHR mode) {
+    switch (mode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:
+            return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR:
+            return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR:
+            return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+            return "fifo relaxed";
+        default:
+            return "unknown";
+    }
+}
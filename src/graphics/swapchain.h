@@ -11,6 +11,8 @@ class GraphicsSwapchain {
     VkSurfaceFormatKHR format;
     VkSurfaceCapabilitiesKHR capabilities;
     std::vector<VkPresentModeKHR> present_modes;
+    // The mode in use, the preferred one or its fallback
+    VkPresentModeKHR present_mode;
     std::vector<VkImage> images;
     std::vector<VkImageView> views;
     VkFormat depth_format;
@@ -33,7 +35,19 @@ class GraphicsSwapchainBuilder {
     GraphicsSwapchainBuilder(VkPhysicalDevice physical_device,
                              VmaAllocator allocator, VkDevice device,
                              VkSurfaceKHR surface);
+    // Used when the surface lets the swapchain pick its size, clamped to the
+    // surface limits
     GraphicsSwapchainBuilder* set_extent(VkExtent2D extent);
+    // The swapchain being replaced, it is retired but still has to be
+    // destroyed once the frames that use it are done
+    GraphicsSwapchainBuilder* set_old_swapchain(VkSwapchainKHR swapchain);
+    // FIFO by default. An unsupported mode falls back to the closest one:
+    // MAILBOX and IMMEDIATE to each other, then to FIFO, and FIFO_RELAXED to
+    // FIFO, which every surface supports
+    GraphicsSwapchainBuilder* set_present_mode(VkPresentModeKHR mode);
+    // Minimum image count, clamped to the surface limits. 0 keeps the
+    // default of one more than the surface minimum
+    GraphicsSwapchainBuilder* set_image_count(uint32_t count);
     GraphicsSwapchain build();
 
     VkSurfaceCapabilitiesKHR capabilities;
@@ -45,6 +59,9 @@ class GraphicsSwapchainBuilder {
     VkDevice m_device;
     VkSurfaceKHR m_surface;
     VkExtent2D m_extent;
+    VkPresentModeKHR m_present_mode;
     VkSwapchainCreateInfoKHR create_info;
     VmaAllocator m_allocator;
 };
+
+const char* present_mode_name(VkPresentModeKHR mode);
@@ -0,0 +1,97 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <bit>
+
+GraphicsTextureBuilder *GraphicsTextureBuilder::set_image(
+    const ImageData &image) {
+    m_image = &image;
+    return this;
+}
+
+GraphicsTextureBuilder *GraphicsTextureBuilder::set_max_extent(
+    uint32_t extent) {
+    m_max_extent = extent;
+    return this;
+}
+
+GraphicsTextureBuilder *GraphicsTextureBuilder::set_format(VkFormat format) {
+    m_format = format;
+    return this;
+}
+
+GraphicsTexture GraphicsTextureBuilder::build() {
+    GraphicsTexture out{};
+    out.m_device = m_device;
+    out.m_allocator = m_upload->allocator;
+    out.format = m_format;
+
+    // The first level is the image, or its biggest halving that fits
+    ImageData scaled;
+    const ImageData *top = m_image;
+    while (m_max_extent && std::max(top->width, top->height) > m_max_extent) {
+        scaled = downsample(*top);
+        top = &scaled;
+    }
+    std::vector<ImageData> mips;
+    mips.reserve(std::bit_width(std::max(top->width, top->height)));
+    const ImageData *previous = top;
+    while (std::max(previous->width, previous->height) > 1) {
+        mips.push_back(downsample(*previous));
+        previous = &mips.back();
+    }
+
+    out.extent = VkExtent2D{top->width, top->height};
+    out.mip_count = 1 + mips.size();
+
+    VkImageCreateInfo image_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = m_format,
+        .extent = VkExtent3D{out.extent.width, out.extent.height, 1},
+        .mipLevels = out.mip_count,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    };
+    VmaAllocationCreateInfo allocation_info{
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+    assert(!vmaCreateImage(out.m_allocator, &image_info, &allocation_info,
+                           &out.image, &out.m_allocation, nullptr));
+
+    VkImageViewCreateInfo view_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = out.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = m_format,
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = out.mip_count,
+            .layerCount = 1,
+        },
+    };
+    assert(!vkCreateImageView(m_device, &view_info, nullptr, &out.view));
+
+    m_upload->transition_image(out.image, out.mip_count,
+                               VK_IMAGE_LAYOUT_UNDEFINED,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    m_upload->write_image(out.image, 0, out.extent, top->pixels.data(),
+                          top->pixels.size());
+    for (uint32_t mip = 1; mip < out.mip_count; mip++) {
+        const ImageData &data = mips[mip - 1];
+        m_upload->write_image(out.image, mip,
+                              VkExtent2D{data.width, data.height},
+                              data.pixels.data(), data.pixels.size());
+    }
+    m_upload->transition_image(out.image, out.mip_count,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    return out;
+}
+
+void GraphicsTexture::destroy() {
+    vkDestroyImageView(m_device, view, nullptr);
+    vmaDestroyImage(m_allocator, image, m_allocation);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "png.h"
+#include "upload.h"
+
+// Sampled 2D image with its whole mip chain
+class GraphicsTexture {
+   public:
+    VkImage image;
+    VkImageView view;
+    VkFormat format;
+    VkExtent2D extent;
+    uint32_t mip_count;
+
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    VmaAllocation m_allocation;
+
+    friend class GraphicsTextureBuilder;
+};
+
+class GraphicsTextureBuilder {
+   public:
+    GraphicsTextureBuilder(GraphicsUpload &upload, VkDevice device)
+        : m_upload(&upload),
+          m_device(device),
+          m_image(nullptr),
+          m_max_extent(0),
+          m_format(VK_FORMAT_R8G8B8A8_SRGB){};
+
+    // RGBA pixels, read by build()
+    GraphicsTextureBuilder *set_image(const ImageData &image);
+    // Bigger images are halved until they fit, 0 keeps the full size
+    GraphicsTextureBuilder *set_max_extent(uint32_t extent);
+    // An 8 bit RGBA format, sRGB by default
+    GraphicsTextureBuilder *set_format(VkFormat format);
+    // The mips are box filtered on the cpu, and every level goes through
+    // `upload`, which has to be flushed before the texture is sampled
+    GraphicsTexture build();
+
+   private:
+    GraphicsUpload *m_upload;
+    VkDevice m_device;
+    const ImageData *m_image;
+    uint32_t m_max_extent;
+    VkFormat m_format;
+};
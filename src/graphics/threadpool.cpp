@@ -0,0 +1,71 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_count) : m_stop(false) {
+    if (!thread_count) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    m_workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; i++) {
+        m_workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(
+    size_t count, size_t chunks,
+    const std::function<void(size_t chunk, size_t begin, size_t end)>& task) {
+    chunks = std::max<size_t>(1, std::min(chunks, count));
+
+    std::vector<std::future<void>> pending;
+    pending.reserve(chunks);
+    for (size_t i = 0; i < chunks; i++) {
+        size_t begin = count * i / chunks;
+        size_t end = count * (i + 1) / chunks;
+        pending.push_back(
+            submit([&task, i, begin, end]() { task(i, begin, end); }));
+    }
+    for (auto& p : pending) {
+        p.get();
+    }
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_cv.notify_one();
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
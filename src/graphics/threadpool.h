@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool {
+   public:
+    explicit ThreadPool(size_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return m_workers.size(); };
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& task) {
+        using R = std::invoke_result_t<F>;
+        auto packaged =
+            std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+        std::future<R> result = packaged->get_future();
+        enqueue([packaged]() { (*packaged)(); });
+        return result;
+    };
+
+    // Splits [0, count) in `chunks` contiguous ranges and runs
+    // task(chunk, begin, end) for each of them, returning once all are done.
+    // Must not be called from one of the pool's own workers.
+    void parallel_for(
+        size_t count, size_t chunks,
+        const std::function<void(size_t chunk, size_t begin, size_t end)>&
+            task);
+
+    // Lazily created pool shared by the loaders
+    static ThreadPool& global();
+
+   private:
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+
+    void enqueue(std::function<void()> task);
+    void work();
+};
@@ -0,0 +1,141 @@
+#include "transform.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+uint32_t Transforms::add(glm::vec3 position, glm::quat rotation,
+                         glm::vec3 scale) {
+    positions.push_back(position);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    world.emplace_back(1.f);
+    dirty.push_back(true);
+    return positions.size() - 1;
+}
+
+void Transforms::set_position(uint32_t transform, glm::vec3 position) {
+    positions[transform] = position;
+    dirty[transform] = true;
+}
+
+void Transforms::set_rotation(uint32_t transform, glm::quat rotation) {
+    rotations[transform] = rotation;
+    dirty[transform] = true;
+}
+
+void Transforms::set_scale(uint32_t transform, glm::vec3 scale) {
+    scales[transform] = scale;
+    dirty[transform] = true;
+}
+
+size_t Transforms::update() {
+    size_t updated = 0;
+    for (size_t i = 0; i < positions.size(); i++) {
+        if (!dirty[i]) {
+            continue;
+        }
+        dirty[i] = false;
+        updated++;
+
+        // The rotation matrix of a unit quaternion, with its columns scaled
+        const glm::quat& q = rotations[i];
+        const glm::vec3& s = scales[i];
+        float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+        float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+        float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+        glm::mat4& m = world[i];
+        m[0] = glm::vec4{1.f - 2.f * (yy + zz), 2.f * (xy + wz),
+                         2.f * (xz - wy), 0.f} *
+               s.x;
+        m[1] = glm::vec4{2.f * (xy - wz), 1.f - 2.f * (xx + zz),
+                         2.f * (yz + wx), 0.f} *
+               s.y;
+        m[2] = glm::vec4{2.f * (xz + wy), 2.f * (yz - wx),
+                         1.f - 2.f * (xx + yy), 0.f} *
+               s.z;
+        m[3] = glm::vec4{positions[i], 1.f};
+    }
+    return updated;
+}
+
+#if defined(__AVX__)
+void multiply_transforms(const glm::mat4& viewproj, const glm::mat4* world,
+                         const uint32_t* indices, size_t count,
+                         glm::mat4* out) {
+    // Every column of viewproj in both lanes, so that one instruction works
+    // on two columns of the world matrix
+    __m256 vp[4];
+    for (int k = 0; k < 4; k++) {
+        __m128 column = _mm_loadu_ps(&viewproj[k][0]);
+        vp[k] = _mm256_set_m128(column, column);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const float* w = &world[indices[i]][0][0];
+        float* o = &out[i][0][0];
+
+        for (int pair = 0; pair < 2; pair++) {
+            // Columns 2 * pair and 2 * pair + 1, one per lane
+            __m256 columns = _mm256_loadu_ps(w + pair * 8);
+            __m256 result =
+                _mm256_mul_ps(vp[0], _mm256_permute_ps(columns, 0x00));
+#if defined(__FMA__)
+            result = _mm256_fmadd_ps(vp[1], _mm256_permute_ps(columns, 0x55),
+                                     result);
+            result = _mm256_fmadd_ps(vp[2], _mm256_permute_ps(columns, 0xaa),
+                                     result);
+            result = _mm256_fmadd_ps(vp[3], _mm256_permute_ps(columns, 0xff),
+                                     result);
+#else
+            result = _mm256_add_ps(
+                result,
+                _mm256_mul_ps(vp[1], _mm256_permute_ps(columns, 0x55)));
+            result = _mm256_add_ps(
+                result,
+                _mm256_mul_ps(vp[2], _mm256_permute_ps(columns, 0xaa)));
+            result = _mm256_add_ps(
+                result,
+                _mm256_mul_ps(vp[3], _mm256_permute_ps(columns, 0xff)));
+#endif
+            _mm256_storeu_ps(o + pair * 8, result);
+        }
+    }
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+void multiply_transforms(const glm::mat4& viewproj, const glm::mat4* world,
+                         const uint32_t* indices, size_t count,
+                         glm::mat4* out) {
+    __m128 vp[4];
+    for (int k = 0; k < 4; k++) {
+        vp[k] = _mm_loadu_ps(&viewproj[k][0]);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const float* w = &world[indices[i]][0][0];
+        float* o = &out[i][0][0];
+
+        for (int j = 0; j < 4; j++) {
+            __m128 result = _mm_mul_ps(vp[0], _mm_set1_ps(w[j * 4 + 0]));
+            result =
+                _mm_add_ps(result, _mm_mul_ps(vp[1], _mm_set1_ps(w[j * 4 + 1])));
+            result =
+                _mm_add_ps(result, _mm_mul_ps(vp[2], _mm_set1_ps(w[j * 4 + 2])));
+            result =
+                _mm_add_ps(result, _mm_mul_ps(vp[3], _mm_set1_ps(w[j * 4 + 3])));
+            _mm_storeu_ps(o + j * 4, result);
+        }
+    }
+}
+#else
+void multiply_transforms(const glm::mat4& viewproj, const glm::mat4* world,
+                         const uint32_t* indices, size_t count,
+                         glm::mat4* out) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = viewproj * world[indices[i]];
+    }
+}
+#endif
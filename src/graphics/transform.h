@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <vector>
+
+// Position, rotation and scale of the objects, one array per component.
+// The world matrices are cached and only recomputed for the transforms that
+// changed since the last update().
+class Transforms {
+   public:
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    // translate(position) * rotate(rotation) * scale(scale)
+    std::vector<glm::mat4> world;
+    std::vector<uint8_t> dirty;
+
+    uint32_t add(glm::vec3 position,
+                 glm::quat rotation = glm::quat{1.f, 0.f, 0.f, 0.f},
+                 glm::vec3 scale = glm::vec3{1.f});
+    void set_position(uint32_t transform, glm::vec3 position);
+    void set_rotation(uint32_t transform, glm::quat rotation);
+    void set_scale(uint32_t transform, glm::vec3 scale);
+    size_t size() const { return positions.size(); };
+
+    // Recomputes the dirty world matrices, returns how many there were
+    size_t update();
+};
+
+// out[i] = viewproj * world[indices[i]], for the matrices of a frame.
+// Two columns per instruction with AVX (fused multiply-add with FMA), one
+// with SSE, scalar code otherwise. `out` may be write combined memory, it is
+// only written.
+void multiply_transforms(const glm::mat4& viewproj, const glm::mat4* world,
+                         const uint32_t* indices, size_t count,
+                         glm::mat4* out);
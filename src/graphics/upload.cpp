@@ -0,0 +1,242 @@
+#include "upload.h"
+
+#include <algorithm>
+#include <cstring>
+
+GraphicsUploadBuilder *GraphicsUploadBuilder::set_staging_size(
+    VkDeviceSize size) {
+    m_staging_size = size;
+    return this;
+}
+
+GraphicsUpload GraphicsUploadBuilder::build() {
+    GraphicsUpload out{};
+    out.allocator = m_allocator;
+    out.m_device = m_device;
+    out.m_queue = m_queue;
+    out.m_staging_size = m_staging_size;
+
+    assert(!vkCreateCommandPool(m_device, &command_pool_info, nullptr,
+                                &out.m_cmd_pool));
+
+    VkCommandBufferAllocateInfo cmdbuf_alloc_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = out.m_cmd_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    assert(!vkAllocateCommandBuffers(m_device, &cmdbuf_alloc_info,
+                                     &out.m_cmd_buf));
+
+    VkFenceCreateInfo fence_info{
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    assert(!vkCreateFence(m_device, &fence_info, nullptr, &out.m_fence));
+
+    return out;
+}
+
+AllocatedBuffer GraphicsUpload::create_buffer(VkDeviceSize size,
+                                              VkBufferUsageFlags usage) {
+    AllocatedBuffer out{};
+
+    VkBufferCreateInfo buffer_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    };
+
+    // Prefer device local memory, and let VMA pick a host visible type when
+    // there is one, so that write() can skip the staging copy
+    VmaAllocationCreateInfo allocation_info{
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                 VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+    };
+
+    assert(!vmaCreateBuffer(allocator, &buffer_info, &allocation_info,
+                            &out.buffer, &out.allocation, nullptr));
+    return out;
+}
+
+StagingBuffer GraphicsUpload::create_staging(VkDeviceSize size) {
+    StagingBuffer out{.size = size};
+
+    VkBufferCreateInfo buffer_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    };
+
+    VmaAllocationCreateInfo allocation_info{
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+    };
+
+    VmaAllocationInfo info;
+    assert(!vmaCreateBuffer(allocator, &buffer_info, &allocation_info,
+                            &out.buffer.buffer, &out.buffer.allocation,
+                            &info));
+    out.data = static_cast<char *>(info.pMappedData);
+    return out;
+}
+
+void GraphicsUpload::write(AllocatedBuffer destination, VkDeviceSize offset,
+                           const void *data, VkDeviceSize size) {
+    if (!size) {
+        return;
+    }
+
+    VkMemoryPropertyFlags memory_flags;
+    vmaGetAllocationMemoryProperties(allocator, destination.allocation,
+                                     &memory_flags);
+    if (memory_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void *mapped;
+        vmaMapMemory(allocator, destination.allocation, &mapped);
+        memcpy(static_cast<char *>(mapped) + offset, data, size);
+        vmaUnmapMemory(allocator, destination.allocation);
+        vmaFlushAllocation(allocator, destination.allocation, offset, size);
+        return;
+    }
+
+    VkDeviceSize staging_offset;
+    VkBuffer staging = stage(data, size, &staging_offset);
+    VkBufferCopy region{
+        .srcOffset = staging_offset,
+        .dstOffset = offset,
+        .size = size,
+    };
+    vkCmdCopyBuffer(m_cmd_buf, staging, destination.buffer, 1, &region);
+}
+
+void GraphicsUpload::transition_image(VkImage image, uint32_t mip_count,
+                                      VkImageLayout old_layout,
+                                      VkImageLayout new_layout) {
+    begin_recording();
+    bool to_transfer = new_layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    VkImageMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = to_transfer ? VkAccessFlags(0)
+                                     : VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = to_transfer ? VK_ACCESS_TRANSFER_WRITE_BIT
+                                     : VK_ACCESS_SHADER_READ_BIT,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = mip_count,
+            .layerCount = 1,
+        },
+    };
+    vkCmdPipelineBarrier(m_cmd_buf,
+                         to_transfer ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+                                     : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         to_transfer ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                                     : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void GraphicsUpload::write_image(VkImage image, uint32_t mip,
+                                 VkExtent2D extent, const void *data,
+                                 VkDeviceSize size) {
+    VkDeviceSize staging_offset;
+    VkBuffer staging = stage(data, size, &staging_offset);
+    VkBufferImageCopy region{
+        .bufferOffset = staging_offset,
+        .imageSubresource{
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = mip,
+            .layerCount = 1,
+        },
+        .imageExtent{extent.width, extent.height, 1},
+    };
+    vkCmdCopyBufferToImage(m_cmd_buf, staging, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+void GraphicsUpload::begin_recording() {
+    if (m_recording) {
+        return;
+    }
+    VkCommandBufferBeginInfo begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    assert(!vkBeginCommandBuffer(m_cmd_buf, &begin_info));
+    m_recording = true;
+}
+
+VkBuffer GraphicsUpload::stage(const void *data, VkDeviceSize size,
+                               VkDeviceSize *offset) {
+    if (m_staging.empty() ||
+        m_staging.back().used + size > m_staging.back().size) {
+        m_staging.push_back(create_staging(std::max(m_staging_size, size)));
+    }
+    StagingBuffer &staging = m_staging.back();
+    memcpy(staging.data + staging.used, data, size);
+    begin_recording();
+
+    *offset = staging.used;
+    // Keep the next copy source aligned for the transfer engine, and for the
+    // texel blocks of the image copies
+    staging.used = (staging.used + size + 15) & ~VkDeviceSize(15);
+    return staging.buffer.buffer;
+}
+
+void GraphicsUpload::flush() {
+    if (!m_recording) {
+        return;
+    }
+
+    for (auto &staging : m_staging) {
+        vmaFlushAllocation(allocator, staging.buffer.allocation, 0,
+                           staging.used);
+    }
+
+    // Make the copies visible to whatever reads the buffers next
+    VkMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+    };
+    vkCmdPipelineBarrier(m_cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+    assert(!vkEndCommandBuffer(m_cmd_buf));
+
+    VkSubmitInfo submit{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &m_cmd_buf,
+    };
+    assert(!vkQueueSubmit(m_queue, 1, &submit, m_fence));
+    assert(!vkWaitForFences(m_device, 1, &m_fence, true, UINT64_MAX));
+    assert(!vkResetFences(m_device, 1, &m_fence));
+    assert(!vkResetCommandPool(m_device, m_cmd_pool, 0));
+    m_recording = false;
+
+    // Keep one staging buffer around for the next batch
+    for (size_t i = 1; i < m_staging.size(); i++) {
+        vmaDestroyBuffer(allocator, m_staging[i].buffer.buffer,
+                         m_staging[i].buffer.allocation);
+    }
+    if (!m_staging.empty()) {
+        m_staging.resize(1);
+        m_staging[0].used = 0;
+    }
+}
+
+void GraphicsUpload::destroy() {
+    flush();
+    for (auto &staging : m_staging) {
+        vmaDestroyBuffer(allocator, staging.buffer.buffer,
+                         staging.buffer.allocation);
+    }
+    m_staging.clear();
+    vkDestroyFence(m_device, m_fence, nullptr);
+    vkDestroyCommandPool(m_device, m_cmd_pool, nullptr);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "utils.h"
+
+struct StagingBuffer {
+    AllocatedBuffer buffer;
+    char *data;
+    VkDeviceSize size;
+    VkDeviceSize used;
+};
+
+// Fills device local buffers. Memory that is also host visible (UMA, resizable
+// BAR, software rasterizers) is written in place, everything else goes through
+// a staging buffer and is copied on the gpu in one batch by flush().
+class GraphicsUpload {
+   public:
+    VmaAllocator allocator;
+
+    AllocatedBuffer create_buffer(VkDeviceSize size, VkBufferUsageFlags usage);
+    void write(AllocatedBuffer destination, VkDeviceSize offset,
+               const void *data, VkDeviceSize size);
+    // Images are always staged. A mip level is written once the image is in
+    // TRANSFER_DST_OPTIMAL, and transitioned to SHADER_READ_ONLY_OPTIMAL
+    // after its last write, both recorded with transition_image().
+    void transition_image(VkImage image, uint32_t mip_count,
+                          VkImageLayout old_layout, VkImageLayout new_layout);
+    void write_image(VkImage image, uint32_t mip, VkExtent2D extent,
+                     const void *data, VkDeviceSize size);
+    // Submits the pending copies and waits for them on a single fence
+    void flush();
+    void destroy();
+
+   private:
+    VkDevice m_device;
+    VkQueue m_queue;
+    VkCommandPool m_cmd_pool;
+    VkCommandBuffer m_cmd_buf;
+    VkFence m_fence;
+    bool m_recording;
+
+    VkDeviceSize m_staging_size;
+    std::vector<StagingBuffer> m_staging;
+
+    StagingBuffer create_staging(VkDeviceSize size);
+    void begin_recording();
+    // Copies the data to a staging buffer, returns it and the offset of the
+    // data
+    VkBuffer stage(const void *data, VkDeviceSize size, VkDeviceSize *offset);
+
+    friend class GraphicsUploadBuilder;
+};
+
+class GraphicsUploadBuilder {
+   public:
+    GraphicsUploadBuilder(VkDevice device, VmaAllocator allocator,
+                          uint32_t queue_family, VkQueue queue)
+        : m_device(device),
+          m_allocator(allocator),
+          m_queue(queue),
+          m_staging_size(64 << 20),
+          command_pool_info(VkCommandPoolCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+              .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+              .queueFamilyIndex = queue_family,
+          }){};
+
+    GraphicsUploadBuilder *set_staging_size(VkDeviceSize size);
+    GraphicsUpload build();
+
+   private:
+    VkDevice m_device;
+    VmaAllocator m_allocator;
+    VkQueue m_queue;
+    VkDeviceSize m_staging_size;
+    VkCommandPoolCreateInfo command_pool_info;
+};
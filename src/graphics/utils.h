@@ -13,3 +13,25 @@ struct AllocatedBuffer {
     VkBuffer buffer;
     VmaAllocation allocation;
 };
+
+// Creates an attachment that only lives during a render pass (e.g. a depth
+// buffer that is cleared and never stored) as a transient image in lazily
+// allocated memory, which tiled gpus may never back outside of the tile
+// memory. Devices without such memory get ordinary device local memory.
+inline VkResult create_transient_image(VmaAllocator allocator,
+                                       VkImageCreateInfo info, VkImage *image,
+                                       VmaAllocation *allocation) {
+    info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    VmaAllocationCreateInfo lazy_info{
+        .usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED,
+    };
+    if (!vmaCreateImage(allocator, &info, &lazy_info, image, allocation,
+                        nullptr)) {
+        return VK_SUCCESS;
+    }
+    VmaAllocationCreateInfo device_info{
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+    return vmaCreateImage(allocator, &info, &device_info, image, allocation,
+                          nullptr);
+}
@@ -1,7 +1,84 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 #include "graphics/engine.h"
 
 int main(int argc, char *argv[]) {
-    GraphicsEngine engine;
+    GraphicsEngineConfig config{};
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--no-instancing")) {
+            config.instancing = false;
+        } else if (!strcmp(argv[i], "--no-culling")) {
+            config.culling = false;
+        } else if (!strcmp(argv[i], "--gpu-culling")) {
+            config.gpu_culling = true;
+        } else if (!strcmp(argv[i], "--no-sort")) {
+            config.sort_queue = false;
+        } else if (!strcmp(argv[i], "--shuffle")) {
+            config.shuffle = true;
+        } else if (!strcmp(argv[i], "--record-threads") && i + 1 < argc) {
+            config.record_threads = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--record-bench")) {
+            config.record_bench = true;
+        } else if (!strcmp(argv[i], "--grid") && i + 1 < argc) {
+            config.grid_size = std::max(0, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--headless")) {
+            config.headless = true;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            config.frame_count = std::max(0, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+            config.capture_prefix = argv[++i];
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            config.trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--no-profile")) {
+            config.profile = false;
+        } else if (!strcmp(argv[i], "--pipeline-cache") && i + 1 < argc) {
+            config.pipeline_cache_path = argv[++i];
+        } else if (!strcmp(argv[i], "--no-pipeline-cache")) {
+            config.pipeline_cache_path.clear();
+        } else if (!strcmp(argv[i], "--present-mode") && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (!strcmp(mode, "fifo")) {
+                config.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+            } else if (!strcmp(mode, "fifo-relaxed")) {
+                config.present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            } else if (!strcmp(mode, "mailbox")) {
+                config.present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+            } else if (!strcmp(mode, "immediate")) {
+                config.present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            } else {
+                printf("unknown present mode: %s\n", mode);
+            }
+        } else if (!strcmp(argv[i], "--frames-in-flight") && i + 1 < argc) {
+            config.frames_in_flight =
+                std::clamp(atoi(argv[++i]), 1, (int)MAX_FRAMES_IN_FLIGHT);
+        } else if (!strcmp(argv[i], "--swapchain-images") && i + 1 < argc) {
+            config.swapchain_images = std::clamp(atoi(argv[++i]), 1, 4);
+        } else if (!strcmp(argv[i], "--low-latency")) {
+            config.low_latency = true;
+        } else if (!strcmp(argv[i], "--dynamic-rendering")) {
+            config.dynamic_rendering = true;
+        } else if (!strcmp(argv[i], "--no-bindless")) {
+            config.bindless = false;
+        } else if (!strcmp(argv[i], "--no-compressed-textures")) {
+            config.compressed_textures = false;
+        } else if (!strcmp(argv[i], "--no-quantized-vertices")) {
+            config.quantized_vertices = false;
+        } else if (!strcmp(argv[i], "--cluster-culling")) {
+            config.gpu_culling = true;
+            config.cluster_culling = true;
+        } else {
+            printf("unknown option: %s\n", argv[i]);
+        }
+    }
+
+    // Headless runs have no window to close
+    if (config.headless && !config.frame_count) {
+        config.frame_count = 600;
+    }
+
+    GraphicsEngine engine(config);
     engine.run();
     return 0;
 }
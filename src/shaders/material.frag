@@ -0,0 +1,52 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 in_normal;
+layout (location = 1) in vec3 in_color;
+// Model space, the meshes have no uvs so the texture is projected along the
+// main axis of the normal
+layout (location = 2) in vec3 in_position;
+layout (location = 3) flat in uint in_material;
+
+layout (location = 0) out vec4 out_clr;
+
+// GpuMaterial
+struct Material {
+        vec4 color;
+        uint texture;
+        float uv_scale;
+        uint padding0;
+        uint padding1;
+};
+
+const uint NO_TEXTURE = 0xffffffffu;
+
+// The bindless set, the material table is its first buffer
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(std430, set = 1, binding = 1) readonly buffer materials_buffer {
+        Material materials[];
+} buffers[];
+layout(set = 1, binding = 2) uniform sampler linear_sampler;
+
+void main() {
+        Material material = buffers[0].materials[in_material];
+
+        vec3 n = abs(in_normal);
+        vec2 uv = n.x > n.y && n.x > n.z ? in_position.zy
+                : n.y > n.z              ? in_position.xz
+                                         : in_position.xy;
+        uv *= material.uv_scale;
+        // The material may differ between neighbour pixels, so the gradients
+        // are taken before branching on it
+        vec2 uv_dx = dFdx(uv);
+        vec2 uv_dy = dFdy(uv);
+
+        vec4 color = material.color * vec4(in_color, 1.f);
+        if (material.texture != NO_TEXTURE) {
+                color *= textureGrad(
+                        sampler2D(textures[nonuniformEXT(material.texture)],
+                                  linear_sampler),
+                        uv, uv_dx, uv_dy);
+        }
+        out_clr = color;
+}
@@ -7,17 +7,26 @@ layout (location = 2) in vec3 in_color;
 
 layout (location = 0) out vec3 out_normal;
 layout (location = 1) out vec3 out_color;
+layout (location = 2) out vec3 out_position;
+layout (location = 3) flat out uint out_material;
 
-layout(push_constant) uniform pc {
-        mat4 transform;
+// viewproj * model, indexed by instance (firstInstance included)
+layout(std430, set = 0, binding = 0) readonly buffer instances {
+        mat4 mvps[];
 };
 
+// Material of every instance, indexed like the matrices: a single instanced
+// draw may span several materials that share a pipeline
+layout(std430, set = 0, binding = 1) readonly buffer instance_materials {
+        uint materials[];
+};
 
 void main()
 {
-	gl_Position = vec4(in_position, 1.f);
-	gl_Position = transform * vec4(in_position, 1.f);
+	gl_Position = mvps[gl_InstanceIndex] * vec4(in_position, 1.f);
 
         out_normal = in_normal;
         out_color = in_color;
+        out_position = in_position;
+        out_material = materials[gl_InstanceIndex];
 }
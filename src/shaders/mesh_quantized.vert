@@ -0,0 +1,62 @@
+#version 450
+
+// QuantizedVertex
+layout (location = 0) in vec4 in_position;
+layout (location = 1) in vec2 in_normal;
+layout (location = 2) in vec4 in_color;
+
+layout (location = 0) out vec3 out_normal;
+layout (location = 1) out vec3 out_color;
+layout (location = 2) out vec3 out_position;
+layout (location = 3) flat out uint out_material;
+
+// GpuMesh, the quantized positions are relative to the bounds of the mesh
+struct MeshInfo {
+        uint index_count;
+        uint first_index;
+        int vertex_offset;
+        uint first_cluster;
+        vec4 aabb_min;
+        vec4 aabb_extent;
+};
+
+// viewproj * model, indexed by instance (firstInstance included)
+layout(std430, set = 0, binding = 0) readonly buffer instances {
+        mat4 mvps[];
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer instance_materials {
+        uint materials[];
+};
+
+// Mesh of every instance, indexed like the matrices
+layout(std430, set = 0, binding = 2) readonly buffer instance_meshes {
+        uint meshes[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer meshes_buffer {
+        MeshInfo mesh_infos[];
+};
+
+// Inverse of the octahedral folding of VertexTraits<QuantizedVertex>
+vec3 decode_normal(vec2 e)
+{
+        vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+        float t = max(-n.z, 0.f);
+        n.x += n.x >= 0.f ? -t : t;
+        n.y += n.y >= 0.f ? -t : t;
+        return normalize(n);
+}
+
+void main()
+{
+        MeshInfo mesh = mesh_infos[meshes[gl_InstanceIndex]];
+        vec3 position =
+                mesh.aabb_min.xyz + in_position.xyz * mesh.aabb_extent.xyz;
+        gl_Position = mvps[gl_InstanceIndex] * vec4(position, 1.f);
+
+        out_normal = decode_normal(in_normal);
+        out_color = in_color.rgb;
+        out_position = position;
+        out_material = materials[gl_InstanceIndex];
+}
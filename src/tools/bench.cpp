@@ -0,0 +1,216 @@
+// Draws parameterized scenes headlessly through each of the draw paths of
+// the engine, and reports the CPU and GPU frame costs and the memory use of
+// every run as CSV, and optionally JSON.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "../graphics/engine.h"
+
+struct Scene {
+    size_t drawables;
+    uint32_t meshes;
+    // The registry collapses them to one pipeline per state with bindless
+    // materials, two per state without
+    uint32_t materials;
+    // Distinct pipeline states the materials cycle through
+    uint32_t pipelines;
+    uint32_t triangles;
+};
+
+struct Path {
+    const char* name;
+    bool instancing;
+    uint32_t record_threads;
+    bool gpu_culling;
+};
+
+struct Run {
+    Scene scene;
+    const char* path;
+    GraphicsBenchResult result;
+};
+
+static std::vector<Scene> make_scenes(size_t max_drawables) {
+    std::vector<Scene> scenes;
+    // Drawable count
+    for (size_t count : {1'000, 10'000, 100'000, 1'000'000}) {
+        scenes.push_back(Scene{count, 1, 1, 1, 80});
+    }
+    // Distinct meshes, materials and pipelines
+    for (uint32_t meshes : {16, 256}) {
+        scenes.push_back(Scene{100'000, meshes, 1, 1, 80});
+    }
+    for (uint32_t materials : {8, 64}) {
+        scenes.push_back(Scene{100'000, 1, materials, 1, 80});
+    }
+    for (uint32_t pipelines : {8, 64}) {
+        scenes.push_back(Scene{100'000, 1, pipelines, pipelines, 80});
+    }
+    // Mesh size
+    for (uint32_t triangles : {12, 1'000, 20'000}) {
+        scenes.push_back(Scene{10'000, 1, 1, 1, triangles});
+    }
+
+    std::erase_if(scenes, [&](const Scene& scene) {
+        return scene.drawables > max_drawables;
+    });
+    return scenes;
+}
+
+static void write_csv_header(FILE* file) {
+    fprintf(file,
+            "drawables,meshes,materials,pipelines,triangles,path,draws,"
+            "pipeline_binds,visible,frame_avg_ms,record_avg_ms,record_p99_ms,"
+            "submit_avg_ms,gpu_min_ms,gpu_avg_ms,gpu_p99_ms,allocated_mb,"
+            "block_mb\n");
+}
+
+static void write_csv_row(FILE* file, const Run& run) {
+    const GraphicsBenchResult& r = run.result;
+    fprintf(file,
+            "%zu,%u,%u,%u,%u,%s,%.0f,%.0f,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+            "%.3f,%.3f,%.1f,%.1f\n",
+            run.scene.drawables, run.scene.meshes, run.scene.materials,
+            run.scene.pipelines, run.scene.triangles, run.path, r.draw_calls,
+            r.pipeline_binds, r.visible, r.frame_ms.avg, r.record_ms.avg,
+            r.record_ms.p99, r.submit_ms.avg, r.gpu_ms.min, r.gpu_ms.avg,
+            r.gpu_ms.p99, r.allocated_bytes / 1048576.,
+            r.block_bytes / 1048576.);
+    fflush(file);
+}
+
+static void write_summary(FILE* file, const char* name,
+                          const RollingStats::Summary& s) {
+    fprintf(file,
+            "\"%s\": {\"min\": %.4f, \"avg\": %.4f, \"p99\": %.4f, "
+            "\"count\": %zu}",
+            name, s.min, s.avg, s.p99, s.count);
+}
+
+static bool write_json(const char* path, const std::vector<Run>& runs) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Could not write %s\n", path);
+        return false;
+    }
+    fprintf(file, "[\n");
+    for (size_t i = 0; i < runs.size(); i++) {
+        const Run& run = runs[i];
+        const GraphicsBenchResult& r = run.result;
+        fprintf(file,
+                "  {\"drawables\": %zu, \"meshes\": %u, \"materials\": %u, "
+                "\"pipelines\": %u, \"triangles\": %u, \"path\": \"%s\", "
+                "\"draws\": %.1f, \"pipeline_binds\": %.1f, "
+                "\"visible\": %.1f, ",
+                run.scene.drawables, run.scene.meshes, run.scene.materials,
+                run.scene.pipelines, run.scene.triangles, run.path,
+                r.draw_calls, r.pipeline_binds, r.visible);
+        write_summary(file, "frame_ms", r.frame_ms);
+        fprintf(file, ", ");
+        write_summary(file, "record_ms", r.record_ms);
+        fprintf(file, ", ");
+        write_summary(file, "submit_ms", r.submit_ms);
+        fprintf(file, ", ");
+        write_summary(file, "gpu_ms", r.gpu_ms);
+        fprintf(file,
+                ", \"allocated_bytes\": %llu, \"block_bytes\": %llu}%s\n",
+                (unsigned long long)r.allocated_bytes,
+                (unsigned long long)r.block_bytes,
+                i + 1 < runs.size() ? "," : "");
+    }
+    fprintf(file, "]\n");
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    size_t max_drawables = 1'000'000;
+    size_t frames = 200;
+    const char* csv_path = nullptr;
+    const char* json_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            max_drawables = 10'000;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = std::clamp(atoi(argv[++i]), 1, 512);
+        } else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            printf("unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    FILE* csv = nullptr;
+    if (csv_path && !(csv = fopen(csv_path, "wb"))) {
+        printf("Could not write %s\n", csv_path);
+        return 1;
+    }
+
+    uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+    const Path paths[] = {
+        {"per-draw", false, 1, false},
+        {"instanced", true, 1, false},
+        {"instanced-mt", true, threads, false},
+        {"gpu-culled", true, 1, true},
+    };
+
+    std::vector<Run> runs;
+    write_csv_header(stdout);
+    if (csv) {
+        write_csv_header(csv);
+    }
+    for (const Scene& scene : make_scenes(max_drawables)) {
+        for (const Path& path : paths) {
+            GraphicsEngineConfig config{
+                .instancing = path.instancing,
+                .gpu_culling = path.gpu_culling,
+                .record_threads = path.record_threads,
+                .headless = true,
+                .profile = true,
+                .drawable_count = scene.drawables,
+                .mesh_count = scene.meshes,
+                .material_count = scene.materials,
+                .pipeline_count = scene.pipelines,
+                .mesh_triangles = scene.triangles,
+            };
+
+            // The biggest scenes take seconds per frame on the per draw path
+            size_t scene_frames =
+                std::clamp<size_t>(20'000'000 / scene.drawables, 20, frames);
+
+            Run run{scene, path.name, {}};
+            {
+                GraphicsEngine engine(config);
+                run.result =
+                    engine.bench(config.frames_in_flight * 4, scene_frames);
+            }
+            if (path.gpu_culling && !run.result.gpu_culling) {
+                printf("gpu culling is not supported, skipped\n");
+                continue;
+            }
+
+            write_csv_row(stdout, run);
+            if (csv) {
+                write_csv_row(csv, run);
+            }
+            runs.push_back(run);
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+    if (json_path && !write_json(json_path, runs)) {
+        return 1;
+    }
+    return 0;
+}
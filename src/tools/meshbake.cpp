@@ -0,0 +1,127 @@
+// Bakes the binary cache of every OBJ file in a directory, and reports how
+// long a cold parse takes compared to mapping the baked cache.
+// With --bench it instead compares the throughput of the serial and the
+// parallel OBJ parsers, and checks that they agree.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "../graphics/meshcache.h"
+#include "../graphics/objloader.h"
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+static bool same_data(const MeshData &a, const MeshData &b) {
+    return a.vertices.size() == b.vertices.size() &&
+           a.indices.size() == b.indices.size() &&
+           !memcmp(a.vertices.data(), b.vertices.data(),
+                   a.vertices.size() * sizeof(Vertex)) &&
+           !memcmp(a.indices.data(), b.indices.data(),
+                   a.indices.size() * sizeof(uint32_t));
+}
+
+static int bench(const std::string &directory,
+                 const std::vector<std::filesystem::path> &sources) {
+    printf("%-32s %10s %14s %14s %8s\n", "file", "size (MB)",
+           "serial (MB/s)", "parallel (MB/s)", "match");
+
+    int failed = 0;
+    for (auto &source : sources) {
+        const std::string filename = source.filename().string();
+        double size_mb =
+            std::filesystem::file_size(source) / (1024. * 1024.);
+
+        auto start = std::chrono::steady_clock::now();
+        auto serial = load_obj(directory.c_str(), filename.c_str());
+        Milliseconds serial_time = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        auto parallel = load_obj_parallel(directory.c_str(), filename.c_str());
+        Milliseconds parallel_time = std::chrono::steady_clock::now() - start;
+
+        bool match = serial && parallel && same_data(*serial, *parallel);
+        failed += !match;
+
+        printf("%-32s %10.2f %14.2f %14.2f %8s\n", filename.c_str(), size_mb,
+               size_mb / serial_time.count() * 1000.,
+               size_mb / parallel_time.count() * 1000., match ? "yes" : "NO");
+    }
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool bench_mode = argc > 1 && !strcmp(argv[1], "--bench");
+    if (bench_mode) {
+        argc--;
+        argv++;
+    }
+    std::string directory = argc > 1 ? argv[1] : ASSETS_PATH;
+    if (!directory.empty() && directory.back() != '/' &&
+        directory.back() != '\\') {
+        directory += '/';
+    }
+
+    std::vector<std::filesystem::path> sources;
+    std::error_code error;
+    for (auto &entry :
+         std::filesystem::directory_iterator(directory, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".obj") {
+            sources.push_back(entry.path());
+        }
+    }
+    if (error) {
+        printf("cannot read %s\n", directory.c_str());
+        return 1;
+    }
+
+    if (bench_mode) {
+        return bench(directory, sources);
+    }
+
+    printf("%-32s %10s %10s %12s %12s\n", "file", "vertices", "indices",
+           "parse (ms)", "mmap (ms)");
+
+    int failed = 0;
+    for (auto &source : sources) {
+        const std::string filename = source.filename().string();
+        const std::string path = directory + filename;
+
+        auto start = std::chrono::steady_clock::now();
+        auto data = load_obj(directory.c_str(), filename.c_str());
+        Milliseconds parse_time = std::chrono::steady_clock::now() - start;
+
+        if (!data || !MeshCache::write(path, data->vertices, data->indices)) {
+            printf("%-32s failed\n", filename.c_str());
+            failed++;
+            continue;
+        }
+
+        // Copy the mapped blobs out, standing in for the upload to the gpu,
+        // so that the pages are actually read
+        std::vector<char> scratch(data->vertices.size() * sizeof(Vertex) +
+                                  data->indices.size() * sizeof(uint32_t));
+        start = std::chrono::steady_clock::now();
+        auto cache = MeshCache::open(path);
+        if (!cache) {
+            printf("%-32s cache did not validate\n", filename.c_str());
+            failed++;
+            continue;
+        }
+        memcpy(scratch.data(), cache->vertices().data(),
+               cache->vertices().size_bytes());
+        memcpy(scratch.data() + cache->vertices().size_bytes(),
+               cache->indices().data(), cache->indices().size_bytes());
+        cache->destroy();
+        Milliseconds mmap_time = std::chrono::steady_clock::now() - start;
+
+        printf("%-32s %10zu %10zu %12.3f %12.3f\n", filename.c_str(),
+               data->vertices.size(), data->indices.size(), parse_time.count(),
+               mmap_time.count());
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+// Compares how fast the final matrices of a frame are produced: the old
+// per drawable proj * view * model with glm, glm with the view-projection
+// computed once, and the batched SIMD kernel. Also reports the update of the
+// cached world matrices.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "../graphics/transform.h"
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+// Runs `task` until at least `min_matrices` were produced, returns matrices
+// per second
+template <typename F>
+static double measure(size_t count, F&& task) {
+    const size_t min_matrices = 20'000'000;
+    size_t repetitions = std::max<size_t>(1, min_matrices / count);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < repetitions; r++) {
+        task();
+    }
+    Milliseconds time = std::chrono::steady_clock::now() - start;
+    return count * repetitions / time.count() * 1000.;
+}
+
+static float max_difference(const std::vector<glm::mat4>& a,
+                            const std::vector<glm::mat4>& b) {
+    float out = 0.f;
+    for (size_t i = 0; i < a.size(); i++) {
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                out = std::max(out, std::abs(a[i][c][r] - b[i][c][r]));
+            }
+        }
+    }
+    return out;
+}
+
+int main() {
+    glm::mat4 view = glm::lookAt(glm::vec3{0.f, 2.f, 5.f}, glm::vec3{0.f},
+                                 glm::vec3{0.f, 1.f, 0.f});
+    glm::mat4 proj =
+        glm::perspective(glm::radians(90.f), 16.f / 9.f, 0.1f, 200.f);
+
+    printf("%10s %14s %14s %14s %14s %10s\n", "objects", "glm (M/s)",
+           "glm vp (M/s)", "batched (M/s)", "update (M/s)", "max diff");
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-100.f, 100.f);
+    std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+
+    for (size_t count : {10'000, 100'000, 1'000'000}) {
+        Transforms transforms;
+        for (size_t i = 0; i < count; i++) {
+            float a = angle(rng);
+            transforms.add(
+                glm::vec3{position(rng), position(rng), position(rng)},
+                glm::quat{std::cos(a / 2), 0.f, std::sin(a / 2), 0.f},
+                glm::vec3{.5f});
+        }
+
+        double update = measure(count, [&]() {
+            std::fill(transforms.dirty.begin(), transforms.dirty.end(), true);
+            transforms.update();
+        });
+
+        // The queue order is not the storage order
+        std::vector<uint32_t> indices(count);
+        std::iota(indices.begin(), indices.end(), 0);
+        std::shuffle(indices.begin(), indices.end(), rng);
+
+        std::vector<glm::mat4> reference(count);
+        double per_drawable = measure(count, [&]() {
+            for (size_t i = 0; i < count; i++) {
+                reference[i] = proj * view * transforms.world[indices[i]];
+            }
+        });
+
+        std::vector<glm::mat4> out(count);
+        double precomputed = measure(count, [&]() {
+            glm::mat4 viewproj = proj * view;
+            for (size_t i = 0; i < count; i++) {
+                out[i] = viewproj * transforms.world[indices[i]];
+            }
+        });
+
+        double batched = measure(count, [&]() {
+            multiply_transforms(proj * view, transforms.world.data(),
+                                indices.data(), count, out.data());
+        });
+
+        printf("%10zu %14.1f %14.1f %14.1f %14.1f %10.2g\n", count,
+               per_drawable / 1e6, precomputed / 1e6, batched / 1e6,
+               update / 1e6, max_difference(reference, out));
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+// Bakes every PNG of a directory into block compressed KTX2 textures, with
+// all their mips, next to the source: BC7, plus BC1 and ETC2 for the opaque
+// ones or BC3 for the others. Reports the memory of each format against
+// RGBA8, and how long a cold PNG decode takes compared to mapping the baked
+// file.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "../graphics/compress.h"
+#include "../graphics/ktx.h"
+#include "../graphics/png.h"
+#include "../graphics/threadpool.h"
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+static bool has_alpha(const ImageData &image) {
+    for (size_t i = 3; i < image.pixels.size(); i += 4) {
+        if (image.pixels[i] != 255) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Level 0 halved until it fits max_extent (0 keeps the full size), then
+// every level down to 1x1, like the streamer builds them
+static std::vector<ImageData> build_mips(ImageData image,
+                                         uint32_t max_extent) {
+    while (max_extent && std::max(image.width, image.height) > max_extent) {
+        image = downsample(image);
+    }
+    std::vector<ImageData> mips;
+    mips.push_back(std::move(image));
+    while (mips.back().width > 1 || mips.back().height > 1) {
+        mips.push_back(downsample(mips.back()));
+    }
+    return mips;
+}
+
+// Rows of blocks are spread over the global pool
+static std::vector<uint8_t> compress_level(const ImageData &image,
+                                           const BlockFormat &format) {
+    std::vector<uint8_t> out(
+        block_level_size(format, image.width, image.height));
+    uint32_t rows = (image.height + 3) / 4;
+    ThreadPool &pool = ThreadPool::global();
+    pool.parallel_for(rows, pool.size() * 4,
+                      [&](size_t, size_t begin, size_t end) {
+                          compress_blocks(image, format, begin, end,
+                                          out.data());
+                      });
+    return out;
+}
+
+static size_t rgba_size(const std::vector<ImageData> &mips) {
+    size_t size = 0;
+    for (const ImageData &mip : mips) {
+        size += mip.pixels.size();
+    }
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t max_extent = 0;
+    if (argc > 2 && !strcmp(argv[1], "--max-extent")) {
+        max_extent = uint32_t(atoi(argv[2]));
+        argc -= 2;
+        argv += 2;
+    }
+    std::string directory = argc > 1 ? argv[1] : ASSETS_PATH;
+    if (!directory.empty() && directory.back() != '/' &&
+        directory.back() != '\\') {
+        directory += '/';
+    }
+
+    std::vector<std::filesystem::path> sources;
+    std::error_code error;
+    for (auto &entry :
+         std::filesystem::directory_iterator(directory, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".png") {
+            sources.push_back(entry.path());
+        }
+    }
+    if (error) {
+        printf("cannot read %s\n", directory.c_str());
+        return 1;
+    }
+
+    printf("%-24s %-6s %11s %5s %10s %6s %12s %10s\n", "file", "format",
+           "extent", "mips", "size (MB)", "ratio", "encode (ms)",
+           "load (ms)");
+
+    int failed = 0;
+    for (auto &source : sources) {
+        const std::string filename = source.filename().string();
+        const std::string path = directory + filename;
+
+        // The cold path of the runtime: decoding the PNG and building its
+        // mips on the cpu
+        auto start = std::chrono::steady_clock::now();
+        auto image = load_png(path.c_str());
+        if (!image) {
+            printf("%-24s failed\n", filename.c_str());
+            failed++;
+            continue;
+        }
+        std::vector<ImageData> mips =
+            build_mips(std::move(*image), max_extent);
+        Milliseconds decode_time = std::chrono::steady_clock::now() - start;
+
+        const size_t rgba_bytes = rgba_size(mips);
+        char extent[24];
+        snprintf(extent, sizeof(extent), "%ux%u", mips[0].width,
+                 mips[0].height);
+        printf("%-24s %-6s %11s %5zu %10.2f %6.1f %12s %10.1f\n",
+               filename.c_str(), "rgba8", extent, mips.size(),
+               rgba_bytes / (1024. * 1024.), 1., "-", decode_time.count());
+
+        bool alpha = has_alpha(mips[0]);
+        std::vector<VkFormat> formats{VK_FORMAT_BC7_SRGB_BLOCK};
+        if (alpha) {
+            formats.push_back(VK_FORMAT_BC3_SRGB_BLOCK);
+        } else {
+            formats.push_back(VK_FORMAT_BC1_RGB_SRGB_BLOCK);
+            formats.push_back(VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK);
+        }
+
+        for (VkFormat vk_format : formats) {
+            const BlockFormat &format = *find_block_format(vk_format);
+            const std::string baked = baked_texture_path(path, format);
+
+            start = std::chrono::steady_clock::now();
+            std::vector<std::vector<uint8_t>> levels;
+            size_t baked_bytes = 0;
+            for (const ImageData &mip : mips) {
+                levels.push_back(compress_level(mip, format));
+                baked_bytes += levels.back().size();
+            }
+            Milliseconds encode_time =
+                std::chrono::steady_clock::now() - start;
+
+            if (!KtxFile::write(baked.c_str(), format, mips[0].width,
+                                mips[0].height, levels)) {
+                printf("%-24s %-6s failed\n", filename.c_str(), format.name);
+                failed++;
+                continue;
+            }
+
+            // Copy the mapped levels out, standing in for the copy to the
+            // staging memory, so that the pages are actually read
+            std::vector<uint8_t> scratch(baked_bytes);
+            start = std::chrono::steady_clock::now();
+            auto file = KtxFile::open(baked.c_str());
+            if (!file) {
+                printf("%-24s %-6s did not validate\n", filename.c_str(),
+                       format.name);
+                failed++;
+                continue;
+            }
+            size_t offset = 0;
+            for (uint32_t mip = 0; mip < file->header->level_count; mip++) {
+                std::span<const uint8_t> level = file->level(mip);
+                memcpy(scratch.data() + offset, level.data(), level.size());
+                offset += level.size();
+            }
+            file->destroy();
+            Milliseconds load_time = std::chrono::steady_clock::now() - start;
+
+            printf("%-24s %-6s %11s %5zu %10.2f %6.1f %12.1f %10.1f\n",
+                   filename.c_str(), format.name, extent, levels.size(),
+                   baked_bytes / (1024. * 1024.),
+                   double(rgba_bytes) / baked_bytes, encode_time.count(),
+                   load_time.count());
+        }
+    }
+
+    return failed ? 1 : 0;
+}